@@ -0,0 +1,58 @@
+/**
+* @file autotuner.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "sample_config.h"
+
+/**
+* TuneResult: one tried configuration of the default model and what it achieved
+*/
+struct TuneResult {
+    size_t streamNum;
+    size_t slotNum;
+    size_t maxBatchSize;
+    double throughput;  // completed requests per second
+    double p99Ms;       // p99 latency from submit to callback
+
+    TuneResult() : streamNum(0), slotNum(0), maxBatchSize(0), throughput(0.0), p99Ms(0.0) {}
+};
+
+/**
+* Autotuner: picks stream_num, slot_num and max_batch_size of the default model. A stored result for
+* the device type and the hash of the model files is reused, otherwise each setting is swept in turn,
+* keeping the best value found so far for the others. Every trial starts an engine with the candidate
+* settings and keeps it saturated with zeroed inputs for a fixed time. Must be called after aclInit.
+*/
+class Autotuner {
+public:
+    /**
+    * @brief Constructor
+    */
+    Autotuner();
+
+    /**
+    * @brief apply the stored or the swept result to the default model, does nothing when disabled
+    * @param [in] engineConfig: engine settings and the autotune candidates
+    * @param [inout] modelConfigs: models to serve, the first one is tuned
+    * @return result
+    */
+    Result Tune(const EngineConfig &engineConfig, std::vector<ModelConfig> &modelConfigs);
+
+private:
+    std::string GetTuneKey(const ModelConfig &config) const;
+    bool LoadResult(const std::string &path, const std::string &key, TuneResult &result) const;
+    Result SaveResult(const std::string &path, const std::string &key, const TuneResult &result) const;
+    Result Sweep(const EngineConfig &engineConfig, const std::vector<ModelConfig> &modelConfigs,
+        TuneResult &best) const;
+    Result RunTrial(const EngineConfig &engineConfig, std::vector<ModelConfig> modelConfigs,
+        TuneResult &trial) const;
+};
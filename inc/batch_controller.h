@@ -0,0 +1,112 @@
+/**
+* @file batch_controller.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+#include "model_family.h"
+
+/**
+* BatchControlStats: current decision of the BatchController for one model and what it was based on
+*/
+struct BatchControlStats {
+    ModelKey model;
+    size_t batchSize;    // batch size interactive batches are formed up to
+    uint32_t delayUs;    // batching delay of interactive batches
+    double arrivalRate;  // interactive requests per second, smoothed
+    double execMs;       // measured execution time at batchSize
+    double p99Ms;        // p99 of the end to end latency in the last control period
+    double targetMs;     // p99 latency target
+    size_t increases;    // times the batch size was raised
+    size_t decreases;    // times the batch size was cut
+
+    BatchControlStats() : batchSize(0), delayUs(0), arrivalRate(0.0), execMs(0.0), p99Ms(0.0), targetMs(0.0),
+        increases(0), decreases(0) {}
+};
+
+/**
+* BatchController: adjusts the batch size and batching delay of interactive requests of each model to
+* the highest throughput that meets its p99 latency target. Every control period the p99 of the end to
+* end latency is compared with the target: the batch size is raised by one while there is headroom and
+* the next size still executes within the target, and halved when the target is missed. The delay is
+* the time the arrival rate needs to fill the batch, limited by the latency left after execution.
+*/
+class BatchController {
+public:
+    /**
+    * @brief Constructor
+    */
+    BatchController();
+
+    /**
+    * @brief control one model, starting from its max batch size and delay
+    * @param [in] model: model key
+    * @param [in] targetMs: p99 latency target from submit to callback, in milliseconds
+    * @param [in] maxBatchSize: upper limit of the batch size
+    * @param [in] maxDelayUs: upper limit of the batching delay
+    * @param [in] selector: measured execution time of the model variants
+    */
+    void AddModel(const ModelKey &model, double targetMs, size_t maxBatchSize, uint32_t maxDelayUs,
+        const std::shared_ptr<const VariantSelector> &selector);
+
+    /**
+    * @brief count one interactive request of a model
+    * @param [in] model: model key
+    */
+    void RecordArrival(const ModelKey &model);
+
+    /**
+    * @brief add the end to end latency of one completed interactive request, adjusts the limits at the
+    * end of a control period
+    * @param [in] model: model key
+    * @param [in] ms: time from submit to callback, in milliseconds
+    */
+    void RecordLatency(const ModelKey &model, double ms);
+
+    /**
+    * @brief get the current limits of a model
+    * @param [in] model: model key
+    * @param [out] batchSize: batch size to form up to
+    * @param [out] delayUs: batching delay
+    * @return false if the model is not controlled
+    */
+    bool GetLimits(const ModelKey &model, size_t &batchSize, uint32_t &delayUs) const;
+
+    /**
+    * @brief get the decisions of every controlled model
+    * @return stats
+    */
+    std::vector<BatchControlStats> GetStats() const;
+
+private:
+    /**
+    * ControlState: limits of one model and the measurements of the current control period
+    */
+    struct ControlState {
+        BatchControlStats stats;
+        size_t maxBatchSize;
+        uint32_t maxDelayUs;
+        std::shared_ptr<const VariantSelector> selector;
+        size_t arrivals;               // interactive requests in this period
+        std::vector<double> latencies;  // end to end latencies in this period
+        std::chrono::steady_clock::time_point periodStart;
+
+        ControlState() : maxBatchSize(1), maxDelayUs(0), arrivals(0) {}
+    };
+
+    static void Adjust(ControlState &state, std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex mutex_;
+    std::map<ModelKey, ControlState> states_;
+};
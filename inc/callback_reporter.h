@@ -0,0 +1,63 @@
+/**
+* @file callback_reporter.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <atomic>
+#include <thread>
+#include "utils.h"
+#include "acl/acl.h"
+
+/**
+* CallbackReporter: the thread that runs the host callbacks launched on the streams of one device.
+* Streams are subscribed to it, callbacks launched with aclrtLaunchCallback then run in this thread.
+*/
+class CallbackReporter {
+public:
+    /**
+    * @brief Constructor
+    */
+    CallbackReporter();
+
+    /**
+    * @brief Destructor
+    */
+    ~CallbackReporter();
+
+    /**
+    * @brief start the report thread
+    * @param [in] context: context of the device, set current in the report thread
+    * @return result
+    */
+    Result Start(aclrtContext context);
+
+    /**
+    * @brief route the callbacks of stream to the report thread
+    * @param [in] stream: stream to subscribe
+    * @return result
+    */
+    Result Subscribe(aclrtStream stream);
+
+    /**
+    * @brief stop routing the callbacks of stream, its callbacks must all have run
+    * @param [in] stream: subscribed stream
+    */
+    void Unsubscribe(aclrtStream stream);
+
+    /**
+    * @brief stop the report thread, every subscribed stream must be unsubscribed first
+    */
+    void Stop();
+
+private:
+    void Run();
+
+    aclrtContext context_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+};
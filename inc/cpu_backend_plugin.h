@@ -0,0 +1,72 @@
+/**
+* @file cpu_backend_plugin.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* C interface of a CPU inference backend, implemented by a shared library that is loaded with dlopen.
+* The library exports the functions below under the names in CPU_BACKEND_SYMBOL_*, all return 0 on
+* success. CpuBackendExecute may be called from several threads at once, also on the same model.
+*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CPU_BACKEND_ABI_VERSION 1
+
+#define CPU_BACKEND_SYMBOL_GET_VERSION "CpuBackendGetVersion"
+#define CPU_BACKEND_SYMBOL_LOAD_MODEL "CpuBackendLoadModel"
+#define CPU_BACKEND_SYMBOL_EXECUTE "CpuBackendExecute"
+#define CPU_BACKEND_SYMBOL_UNLOAD_MODEL "CpuBackendUnloadModel"
+
+/**
+* CpuBackendModelInfo: sizes of a loaded model, the same layout as output 0 of the .om model
+*/
+typedef struct CpuBackendModelInfo {
+    size_t sampleInputSize;   // bytes of one input sample
+    size_t sampleOutputNum;   // floats of output 0 of one sample
+    size_t maxBatchSize;      // 0 means no limit
+} CpuBackendModelInfo;
+
+/**
+* @brief get the interface version the library implements
+* @return CPU_BACKEND_ABI_VERSION of the library
+*/
+typedef int32_t (*CpuBackendGetVersionFunc)(void);
+
+/**
+* @brief load a model
+* @param [in] path: model file
+* @param [out] model: handle of the loaded model
+* @param [out] info: sizes of the model
+* @return 0 on success
+*/
+typedef int32_t (*CpuBackendLoadModelFunc)(const char *path, void **model, CpuBackendModelInfo *info);
+
+/**
+* @brief execute one batch
+* @param [in] model: handle returned by load
+* @param [in] input: batchSize samples of sampleInputSize bytes each
+* @param [in] batchSize: number of samples
+* @param [out] output: batchSize * sampleOutputNum floats
+* @return 0 on success
+*/
+typedef int32_t (*CpuBackendExecuteFunc)(void *model, const void *input, size_t batchSize, float *output);
+
+/**
+* @brief unload a model
+* @param [in] model: handle returned by load
+*/
+typedef void (*CpuBackendUnloadModelFunc)(void *model);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,153 @@
+/**
+* @file cpu_executor.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "utils.h"
+#include "cpu_backend_plugin.h"
+#include "infer_request.h"
+#include "model_registry.h"
+
+/**
+* CpuStats: batches served by the CPU backend
+*/
+struct CpuStats {
+    size_t batches;
+    size_t samples;
+    double busyMs;  // execution time summed over the threads
+
+    CpuStats() : batches(0), samples(0), busyMs(0.0) {}
+};
+
+/**
+* CpuExecutor: executes batches with a CPU backend library on a pool of threads. Models with a
+* cpu_model_path are loaded on first use and timed with one warmup execution, the measured time per
+* sample is kept up to date so the engine can balance the completion time against the devices.
+*/
+class CpuExecutor {
+public:
+    /**
+    * @brief Constructor
+    */
+    CpuExecutor();
+
+    /**
+    * @brief Destructor
+    */
+    ~CpuExecutor();
+
+    /**
+    * @brief load the backend library and start the threads
+    * @param [in] pluginPath: shared library implementing cpu_backend_plugin.h
+    * @param [in] threadNum: batches executed at once
+    * @param [in] catalog: models that may be served, the ones without cpu_model_path are not
+    * @return result
+    */
+    Result Init(const std::string &pluginPath, size_t threadNum, const std::shared_ptr<const ModelCatalog> &catalog);
+
+    /**
+    * @brief whether the backend is loaded
+    * @return true after a successful Init
+    */
+    bool IsEnabled() const;
+
+    /**
+    * @brief get the sizes of a model, loading and timing it if needed
+    * @param [in] key: model name and version
+    * @param [out] info: sizes of the model
+    * @return result, FAILED if the model has no cpu_model_path or cannot be loaded
+    */
+    Result GetModelInfo(const ModelKey &key, CpuBackendModelInfo &info);
+
+    /**
+    * @brief estimate when a batch queued now would complete, from the queued samples and the
+    * measured time per sample
+    * @param [in] key: model of the batch, loaded already
+    * @param [in] batchSize: samples of the batch
+    * @return milliseconds, 0 if the model is not loaded
+    */
+    double EstimateCompletionMs(const ModelKey &key, size_t batchSize) const;
+
+    /**
+    * @brief queue one batch of a loaded model, request callbacks are called from the executor threads
+    * @param [in] batch: requests to execute together, no more than the model max batch size
+    * @return result
+    */
+    Result Enqueue(const InferBatchPtr &batch);
+
+    /**
+    * @brief get number of queued and executing requests
+    * @return outstanding request number
+    */
+    size_t GetOutstanding() const;
+
+    /**
+    * @brief get the counters
+    * @return stats
+    */
+    CpuStats GetStats() const;
+
+    /**
+    * @brief block until all queued and executing requests are completed
+    */
+    void WaitIdle();
+
+    /**
+    * @brief finish the queued requests and stop the threads
+    */
+    void Stop();
+
+    /**
+    * @brief stop, unload every model and the backend library
+    */
+    void Destroy();
+
+private:
+    /**
+    * CpuModel: one model loaded by the backend
+    */
+    struct CpuModel {
+        void *handle;
+        CpuBackendModelInfo info;
+        double msPerSample;  // moving average of the execution time of one sample
+
+        CpuModel() : handle(nullptr), msPerSample(0.0) {}
+    };
+
+    void Run();
+    Result LoadModel(const ModelKey &key, std::shared_ptr<CpuModel> &model);
+    Result Execute(CpuModel &model, const InferBatchPtr &batch, std::vector<float> &output, double &ms);
+    void FinishBatch(const InferBatchPtr &batch, const CpuModel *model, const std::vector<float> &output);
+    void DropUnneededRequests(const InferBatchPtr &batch);
+
+    void *library_;
+    CpuBackendLoadModelFunc loadModel_;
+    CpuBackendExecuteFunc execute_;
+    CpuBackendUnloadModelFunc unloadModel_;
+    std::shared_ptr<const ModelCatalog> catalog_;
+    size_t threadNum_;
+
+    std::mutex loadMutex_;           // serializes model loading
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;      // wakes the threads on a new batch
+    std::condition_variable idleCond_;  // wakes WaitIdle
+    std::map<ModelKey, std::shared_ptr<CpuModel>> models_;
+    std::deque<InferBatchPtr> queue_;
+    size_t outstanding_;
+    CpuStats stats_;
+    bool stop_;
+    std::vector<std::thread> threads_;
+};
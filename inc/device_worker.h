@@ -0,0 +1,175 @@
+/**
+* @file device_worker.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <vector>
+#include "utils.h"
+#include "callback_reporter.h"
+#include "infer_request.h"
+#include "model_registry.h"
+#include "sample_config.h"
+#include "stream_executor.h"
+#include "acl/acl.h"
+
+/**
+* GroupStats: streams of one compute group of a device and how busy they were
+*/
+struct GroupStats {
+    int32_t groupId;     // -1 for the streams without a group
+    size_t lanes;        // streams bound to the group
+    int32_t aicoreNum;   // AI cores of the group, 0 if unknown
+    double busyMs;       // device time spent executing batches on its streams
+    double utilization;  // busyMs over the time since start, per stream
+
+    GroupStats() : groupId(-1), lanes(0), aicoreNum(0), busyMs(0.0), utilization(0.0) {}
+};
+
+/**
+* DeviceWorker: owns the context, the model registry and a pool of stream executors of one device.
+* Streams may be bound to compute groups, each group gets a context of its own.
+*/
+class DeviceWorker {
+public:
+    /**
+    * @brief Constructor
+    */
+    DeviceWorker();
+
+    /**
+    * @brief Destructor
+    */
+    ~DeviceWorker();
+
+    /**
+    * @brief open device, create context, load the default model and start one executor per stream.
+    * The executors take requests only after every slot has been warmed up.
+    * @param [in] deviceId: device id
+    * @param [in] catalog: models that may be served, other models are loaded on first use
+    * @param [in] defaultModel: model loaded at init, its config gives the stream / slot numbers
+    * @param [in] memBudget: device memory for models in bytes, 0 means no limit
+    * @param [in] priority: streams and slots reserved for interactive requests
+    * @param [in] laneGroups: compute group of each stream, -1 or missing entries mean no group
+    * @return result
+    */
+    Result Init(int32_t deviceId, const std::shared_ptr<const ModelCatalog> &catalog, const ModelKey &defaultModel,
+        size_t memBudget, const PriorityConfig &priority, const std::vector<int32_t> &laneGroups);
+
+    /**
+    * @brief dispatch one batch to the executor with the least outstanding requests among the
+    * streams of its priority
+    * @param [in] batch: requests to execute in one execution
+    * @return result
+    */
+    Result Submit(const InferBatchPtr &batch);
+
+    /**
+    * @brief dispatch one batch like Submit, but never to one executor, used for hedged duplicates
+    * @param [in] batch: requests to execute in one execution
+    * @param [in] exclude: executor the batch must not go to, nullptr for none
+    * @return result, FAILED without a log when no other executor serves the priority
+    */
+    Result Submit(const InferBatchPtr &batch, const StreamExecutor *exclude);
+
+    /**
+    * @brief get a model of this device, loading it if needed
+    * @param [in] key: model name and version
+    * @return model variants, nullptr if it cannot be loaded
+    */
+    std::shared_ptr<ModelFamily> AcquireModel(const ModelKey &key);
+
+    /**
+    * @brief reload a model in the background and switch to it, see ModelRegistry::Reload
+    * @param [in] key: model name and version
+    * @return result
+    */
+    Result ReloadModel(const ModelKey &key);
+
+    /**
+    * @brief get counters of the model registry
+    * @return stats
+    */
+    RegistryStats GetRegistryStats() const;
+
+    /**
+    * @brief get the utilization of each compute group used by the streams
+    * @return stats, one entry per group, the streams without a group last
+    */
+    std::vector<GroupStats> GetGroupStats() const;
+
+    /**
+    * @brief get the latency measured by the warmup at init, one entry per variant of the default model
+    * @return startup baseline
+    */
+    std::vector<WarmupResult> GetWarmupBaseline() const;
+
+    /**
+    * @brief get number of executors (streams) of the device
+    * @return lane number
+    */
+    size_t GetLaneCount() const;
+
+    /**
+    * @brief get number of queued and in-flight requests of all executors
+    * @return outstanding request number
+    */
+    size_t GetOutstanding() const;
+
+    /**
+    * @brief block until all executors are idle
+    */
+    void WaitIdle();
+
+    /**
+    * @brief register every executor with the stealer
+    * @param [in] stealer: stealer shared by the lanes of all devices
+    * @param [in] numaNode: NUMA node of this device
+    */
+    void RegisterLanes(WorkStealer &stealer, int32_t numaNode);
+
+    /**
+    * @brief let idle executors steal queued batches, once every lane is registered
+    * @param [in] stealer: stealer shared by the lanes of all devices
+    */
+    void EnableStealing(WorkStealer *stealer);
+
+    /**
+    * @brief let the executors run out their queues and stop their threads
+    */
+    void Stop();
+
+    /**
+    * @brief stop executors, unload model, destroy context and reset device
+    */
+    void Destroy();
+
+private:
+    void ReleaseRetiredModels();
+    void SetWarmupBaseline(const std::vector<WarmupResult> &results);
+    Result CreateGroupContexts(const std::vector<int32_t> &laneGroups, size_t laneNum);
+    void LoadGroupInfo(uint32_t groupCount);
+    aclrtContext GetLaneContext(size_t lane) const;
+
+    int32_t deviceId_;
+    bool deviceOpened_;
+    aclrtContext context_;
+    std::map<int32_t, aclrtContext> groupContexts_;  // one context per compute group, bound with aclrtSetGroup
+    std::map<int32_t, int32_t> groupCores_;          // AI cores of each used group
+    std::vector<int32_t> laneGroups_;                // group of each executor, -1 runs on context_
+    std::chrono::steady_clock::time_point startTime_;
+    CallbackReporter reporter_;  // runs the completion callbacks of all streams
+    ModelRegistry registry_;  // models shared by the slots of all executors
+    std::vector<std::unique_ptr<StreamExecutor>> executors_;
+    std::vector<WarmupResult> baseline_;  // warmup latency of the default model, set at init
+    size_t interactiveStreams_;  // executors_[0, interactiveStreams_) are reserved for interactive batches
+    std::atomic<size_t> nextExecutor_;  // rotates the start of the search so ties are spread
+};
@@ -0,0 +1,118 @@
+/**
+* @file dynamic_batcher.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+
+/**
+* DynamicBatcher: collects requests into a batch until it is full or its oldest request
+* has waited for the max batching delay, whichever comes first, then dispatches the batch.
+* Requests of different priorities, models or image sizes are queued and batched separately, and
+* ready batches of a higher priority are dispatched first.
+* An optional policy lowers the size a batch waits for, based on the number of queued requests, and
+* another one sets the max batching delay of each queue.
+* Requests whose deadline has passed while queued are shed, and cancelled ones dropped, instead of dispatched.
+*/
+class DynamicBatcher {
+public:
+    typedef std::function<Result(const InferBatchPtr &)> DispatchFunc;
+    typedef std::function<size_t(const BatchKey &, size_t)> BatchSizeFunc;
+    typedef std::function<uint32_t(const BatchKey &)> BatchDelayFunc;
+
+    /**
+    * @brief Constructor
+    */
+    DynamicBatcher();
+
+    /**
+    * @brief Destructor
+    */
+    ~DynamicBatcher();
+
+    /**
+    * @brief set the batch size policy, must be called before Start
+    * @param [in] policy: called with the key and number of queued requests of a queue, returns the
+    *                     batch size to form, the result is capped by the max batch size
+    */
+    void SetBatchSizePolicy(const BatchSizeFunc &policy);
+
+    /**
+    * @brief set the batching delay policy, must be called before Start
+    * @param [in] policy: called with the key of a queue, returns the max time its oldest request waits,
+    *                     in microseconds. Replaces the delays given to Start and SetMaxDelay.
+    */
+    void SetBatchDelayPolicy(const BatchDelayFunc &policy);
+
+    /**
+    * @brief set the max batching delay of one priority, must be called before Start
+    * @param [in] priority: request class
+    * @param [in] maxDelayUs: max time the oldest request of a batch waits, in microseconds
+    */
+    void SetMaxDelay(InferPriority priority, uint32_t maxDelayUs);
+
+    /**
+    * @brief start the batching thread
+    * @param [in] maxBatchSize: max number of requests in one batch
+    * @param [in] maxDelayUs: max time the oldest request of a batch waits, in microseconds, for the
+    *                         priorities without a delay of their own
+    * @param [in] dispatch: called from the batching thread with every formed batch
+    * @return result
+    */
+    Result Start(size_t maxBatchSize, uint32_t maxDelayUs, const DispatchFunc &dispatch);
+
+    /**
+    * @brief queue one request for batching
+    * @param [in] request: request to execute
+    * @return result
+    */
+    Result Add(const InferRequestPtr &request);
+
+    /**
+    * @brief block until every added request has been dispatched
+    */
+    void WaitIdle();
+
+    /**
+    * @brief dispatch the requests still queued and stop the batching thread
+    */
+    void Stop();
+
+private:
+    void Run();
+    void FailBatch(const InferBatchPtr &batch);
+    static void DropUnneeded(const InferBatchPtr &batch, std::chrono::steady_clock::time_point now,
+        std::vector<InferRequestPtr> &expired, std::vector<InferRequestPtr> &cancelled);
+    size_t GetTargetBatchSize(const BatchKey &key, size_t queued) const;
+    std::chrono::microseconds GetMaxDelay(const BatchKey &key) const;
+
+    size_t maxBatchSize_;
+    std::chrono::microseconds maxDelay_;
+    std::map<InferPriority, std::chrono::microseconds> priorityDelays_;  // set by SetMaxDelay
+    DispatchFunc dispatch_;
+    BatchSizeFunc batchSizePolicy_;
+    BatchDelayFunc batchDelayPolicy_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable idleCond_;
+    std::map<BatchKey, std::deque<InferRequestPtr>> queues_;  // one queue per priority, model and image size
+    size_t queued_;       // requests in all queues
+    size_t dispatching_;  // requests taken from queue_ whose dispatch has not returned yet
+    bool stop_;
+    std::thread thread_;
+};
@@ -0,0 +1,142 @@
+/**
+* @file frame_gate.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+#include "roi_preprocessor.h"
+#include "sample_config.h"
+
+/**
+* FrameGateStats: frames seen by the FrameGate
+*/
+struct FrameGateStats {
+    size_t frames;  // frames checked
+    size_t reused;  // frames answered with the result of an earlier frame
+
+    FrameGateStats() : frames(0), reused(0) {}
+};
+
+/**
+* FrameTicket: what a frame sent for execution leaves in the gate of its stream
+*/
+struct FrameTicket {
+    std::vector<uint8_t> thumbnail;  // downscaled luma of the frame
+    uint64_t sequence;               // order of the frame in its stream
+
+    FrameTicket() : sequence(0) {}
+};
+
+/**
+* FrameGate: temporal deduplication of video streams. Every frame is reduced to a small luma thumbnail
+* and compared with the thumbnail of the last frame of its stream executed by the same model. When the
+* mean absolute difference stays below the threshold, the result of that frame is reused, up to a number
+* of frames and an age after which the next frame is executed again.
+*/
+class FrameGate {
+public:
+    /**
+    * @brief Constructor
+    */
+    FrameGate();
+
+    /**
+    * @brief set the threshold and reuse limits, a threshold of 0 disables the gate
+    * @param [in] config: gate settings
+    */
+    void SetConfig(const FrameGateConfig &config);
+
+    /**
+    * @brief whether frames may reuse results
+    * @return true if the threshold is set
+    */
+    bool IsEnabled() const;
+
+    /**
+    * @brief look for a result of the stream the frame may reuse
+    * @param [in] streamId: video stream of the frame
+    * @param [in] model: model name and version classifying the frame
+    * @param [in] frame: decoded frame
+    * @param [out] result: reused result, valid when true is returned
+    * @param [out] ticket: passed to Update once the frame is executed, valid when false is returned
+    * @return true if the frame need not be executed
+    */
+    bool Reuse(uint64_t streamId, const ModelKey &model, const DecodedImage &frame, InferResult &result,
+        FrameTicket &ticket);
+
+    /**
+    * @brief make an executed frame the reference of its stream, unless a later frame is already
+    * @param [in] streamId: video stream of the frame
+    * @param [in] model: model passed to Reuse
+    * @param [in] ticket: returned by Reuse for the frame
+    * @param [in] result: result of the frame
+    */
+    void Update(uint64_t streamId, const ModelKey &model, FrameTicket &ticket, const InferResult &result);
+
+    /**
+    * @brief forget the reference frames of a stream that has ended
+    * @param [in] streamId: video stream
+    */
+    void EndStream(uint64_t streamId);
+
+    /**
+    * @brief drop the reference frames of a model, after it was reloaded
+    * @param [in] model: model name and version
+    */
+    void Invalidate(const ModelKey &model);
+
+    /**
+    * @brief get the counters
+    * @return stats
+    */
+    FrameGateStats GetStats() const;
+
+    /**
+    * @brief sum of absolute differences of two byte arrays, SSE2 or NEON where available
+    * @param [in] first: bytes
+    * @param [in] second: bytes
+    * @param [in] size: number of bytes of each
+    * @return sum of |first[i] - second[i]|
+    */
+    static uint32_t SumAbsDiff(const uint8_t *first, const uint8_t *second, size_t size);
+
+    /**
+    * @brief downscale a decoded image to a 32x32 luma thumbnail, each pixel averages points of its cell
+    * @param [in] frame: decoded image, checked by RoiPreprocessor::Check
+    * @param [out] thumbnail: 32x32 luma bytes, row major
+    */
+    static void MakeThumbnail(const DecodedImage &frame, std::vector<uint8_t> &thumbnail);
+
+private:
+    typedef std::pair<uint64_t, ModelKey> StreamKey;  // stream id and model
+
+    /**
+    * StreamState: reference frame of one stream for one model
+    */
+    struct StreamState {
+        std::vector<uint8_t> thumbnail;  // empty until a frame of the stream has been executed
+        InferResult result;
+        std::chrono::steady_clock::time_point time;  // when the reference frame was executed
+        uint64_t sequence;  // of the reference frame
+        uint64_t next;      // sequence of the next frame
+        size_t reuseCount;  // frames that reused the reference so far
+
+        StreamState() : sequence(0), next(1), reuseCount(0) {}
+    };
+
+    FrameGateConfig config_;
+    mutable std::mutex mutex_;
+    std::map<StreamKey, StreamState> streams_;
+    FrameGateStats stats_;
+};
@@ -0,0 +1,248 @@
+/**
+* @file infer_engine.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "utils.h"
+#include "batch_controller.h"
+#include "cpu_executor.h"
+#include "device_worker.h"
+#include "dynamic_batcher.h"
+#include "frame_gate.h"
+#include "near_duplicate_index.h"
+#include "infer_request.h"
+#include "model_registry.h"
+#include "request_hedger.h"
+#include "result_cache.h"
+#include "roi_preprocessor.h"
+#include "sample_config.h"
+#include "work_stealer.h"
+
+/**
+* ShedStats: what admission control did with the submitted requests
+*/
+struct ShedStats {
+    size_t admitted;  // queued for execution
+    size_t rejected;  // shed at Submit, the estimated completion was past the deadline
+    size_t expired;   // admitted, then shed in a queue before upload
+
+    ShedStats() : admitted(0), rejected(0), expired(0) {}
+};
+
+/**
+* InferEngine: one DeviceWorker per device, batches requests per model and spreads the batches over
+* all devices of the process. Slow requests may be hedged with a duplicate on another lane.
+* With a CPU backend, batches of models it can run go to the CPU or the devices, whichever is
+* estimated to complete them first, and without devices all of them run on the CPU.
+* A model with a cascade model runs its device batches on that lighter model first, only the samples
+* it is not confident about are executed by the model itself.
+*/
+class InferEngine {
+public:
+    /**
+    * @brief Constructor
+    */
+    InferEngine();
+
+    /**
+    * @brief Destructor
+    */
+    ~InferEngine();
+
+    /**
+    * @brief enumerate devices and load the default model on each of them in parallel. Returns once every
+    * slot has been warmed up, the engine is ready from then on. When no device is found and a CPU
+    * backend is configured, every request is served by the CPU backend.
+    * @param [in] engineConfig: devices to use and device memory budget
+    * @param [in] modelConfigs: models that may be served, the first one is the default model
+    * @return result
+    */
+    Result Init(const EngineConfig &engineConfig, const std::vector<ModelConfig> &modelConfigs);
+
+    /**
+    * @brief queue one request for batching, its input must be one sample of the model input.
+    * For dynamic HW models the request image size must be one of GetImageSizes().
+    * A model not used before is loaded first, the request model key is completed with the defaults.
+    * Interactive requests are batched and executed ahead of bulk ones.
+    * A request that would finish after its deadline, estimated from the requests ahead of it and the
+    * measured execution time, is shed at once: its callback is called with a shed result.
+    * With the result cache enabled, an input seen recently is answered from the cache, and one
+    * identical to a request in flight gets the result of that request instead of executing again.
+    * @param [in] request: request to execute
+    * @return result
+    */
+    Result Submit(const InferRequestPtr &request);
+
+    /**
+    * @brief classify boxes of one decoded image together. Every box is cropped, resized and normalized
+    * straight into its sample of the batch input when the batch is staged, and the boxes are executed
+    * as one batch, or as few batches of the model max batch size as hold them.
+    * @param [in] request: image, boxes and the callback receiving the result of every box
+    * @return result, FAILED if the request is invalid and the callback is not called
+    */
+    Result SubmitRois(const RoiRequest &request);
+
+    /**
+    * @brief submit the classification of one frame of a video stream. With the frame gate enabled, a
+    * frame that barely differs from the last executed frame of its stream is not executed, its callback
+    * is called at once with the result of that frame.
+    * @param [in] streamId: video stream of the frame, each stream has its own reference frame
+    * @param [in] frame: decoded frame the difference is measured on
+    * @param [in] request: classification of the frame, as for Submit
+    * @return result
+    */
+    Result SubmitFrame(uint64_t streamId, const DecodedImage &frame, const InferRequestPtr &request);
+
+    /**
+    * @brief forget the reference frame of a video stream that has ended
+    * @param [in] streamId: video stream
+    */
+    void EndStream(uint64_t streamId);
+
+    /**
+    * @brief submit the classification of one decoded image. With the near duplicate index enabled, an
+    * image whose perceptual hash is close to the hash of an image executed before, such as a re-encoded
+    * or resized copy, is not executed, its callback is called at once with the result of that image.
+    * @param [in] image: decoded image the hash is computed on
+    * @param [in] request: classification of the image, as for Submit
+    * @return result
+    */
+    Result SubmitImage(const DecodedImage &image, const InferRequestPtr &request);
+
+    /**
+    * @brief whether warmup is done and requests are accepted
+    * @return true if ready
+    */
+    bool IsReady() const;
+
+    /**
+    * @brief get the resolution buckets of a dynamic HW model, inputs are preprocessed to one of them
+    * @param [in] model: model name and version, empty ones mean the defaults
+    * @return image sizes, empty for fixed shape models
+    */
+    std::vector<ImageSize> GetImageSizes(const ModelKey &model);
+
+    /**
+    * @brief get the input size of one sample of a model
+    * @param [in] model: model name and version, empty ones mean the defaults
+    * @param [in] imageSize: resolution bucket, 0x0 for fixed shape models
+    * @return size in bytes, 0 if the model cannot be loaded or has no such bucket
+    */
+    size_t GetSampleInputSize(const ModelKey &model, const ImageSize &imageSize);
+
+    /**
+    * @brief get number of streams of all devices
+    * @return lane number
+    */
+    size_t GetLaneCount() const;
+
+    /**
+    * @brief reload a model from its .om files on every device without stopping traffic. Each device
+    * loads and warms up the new copy in the background, then new batches switch to it and the old
+    * copy is unloaded after its last execution. The new model must have the same input and output sizes.
+    * @param [in] model: model name and version, empty ones mean the defaults
+    * @return result
+    */
+    Result ReloadModel(const ModelKey &model);
+
+    /**
+    * @brief get the numbers of admitted and shed requests
+    * @return stats
+    */
+    ShedStats GetShedStats() const;
+
+    /**
+    * @brief get the hits and misses of the result cache
+    * @return stats
+    */
+    ResultCacheStats GetResultCacheStats() const;
+
+    /**
+    * @brief get the images looked up in the near duplicate index and the ones that reused a result
+    * @return stats
+    */
+    NearDuplicateStats GetNearDuplicateStats() const;
+
+    /**
+    * @brief get the batch size and delay chosen for each model with a latency target
+    * @return stats
+    */
+    std::vector<BatchControlStats> GetBatchControlStats() const;
+
+    /**
+    * @brief block until all devices are idle
+    */
+    void WaitIdle();
+
+    /**
+    * @brief destroy all device workers
+    */
+    void Destroy();
+
+private:
+    /**
+    * ModelInfo: input sizes and batch limit of a model, known once it has been loaded
+    */
+    struct ModelInfo {
+        std::map<ImageSize, size_t> sampleInputSizes;  // input size of one sample per resolution bucket
+        size_t maxBatchSize;
+        bool selectBatchSize;  // the model has several batch size variants
+        bool onCpu;            // the CPU backend can execute its batches too
+        std::shared_ptr<CascadePlan> cascade;  // device batches run on a lighter model first, may be null
+
+        ModelInfo() : maxBatchSize(1), selectBatchSize(false), onCpu(false) {}
+    };
+
+    ModelKey ResolveModel(const ModelKey &model) const;
+    Result Admit(const InferRequestPtr &request);
+    void Readmit(const std::vector<InferRequestPtr> &requests);
+    Result LoadModelInfo(const ModelKey &key);
+    Result LoadCpuModelInfo(const ModelKey &key, const ModelConfig &config, ModelInfo &info);
+    void LoadCascade(const ModelKey &key, const ModelConfig &config, ModelInfo &info);
+    size_t GetTargetBatchSize(const BatchKey &key, size_t queued);
+    uint32_t GetBatchDelayUs(const ModelKey &key, InferPriority priority) const;
+    double EstimateCompletionMs(const ModelKey &key, InferPriority priority) const;
+    size_t SelectWorker();
+    Result DispatchBatch(const InferBatchPtr &batch);
+    bool RunOnCpu(const InferBatchPtr &batch) const;
+    double EstimateDeviceCompletionMs(const ModelKey &key, size_t batchSize) const;
+    Result DispatchDuplicate(const InferRequestPtr &duplicate, const StreamExecutor *exclude);
+    void LogStats() const;
+
+    std::vector<std::unique_ptr<DeviceWorker>> workers_;
+    DynamicBatcher batcher_;
+    WorkStealer stealer_;  // lanes of all devices
+    RequestHedger hedger_;
+    BatchController batchController_;  // batch size and delay of models with a latency target
+    CpuExecutor cpuExecutor_;          // optional CPU backend
+    FrameGate frameGate_;              // reuses results of nearly identical video frames
+    ResultCache resultCache_;          // results of recent inputs, shares executions of identical ones
+    NearDuplicateIndex duplicates_;    // results of images by perceptual hash
+    std::shared_ptr<ModelCatalog> catalog_;
+    ModelKey defaultModel_;
+    std::map<std::string, std::string> defaultVersions_;  // first configured version of each model name
+    std::atomic<bool> ready_;  // set after init and warmup, Submit is rejected before
+    std::atomic<size_t> pending_[PRIORITY_NUM];  // admitted requests not completed yet
+    std::atomic<size_t> admitted_;
+    std::atomic<size_t> rejected_;
+    std::atomic<size_t> expired_;
+    size_t laneCount_;                        // streams of all devices
+    uint32_t batchDelayUs_[PRIORITY_NUM];     // max batching delay of each priority
+    std::chrono::milliseconds defaultDeadline_;  // for requests without a deadline, 0 means none
+
+    std::mutex loadMutex_;    // serializes loading of model info
+    mutable std::mutex modelsMutex_;  // guards models_
+    std::map<ModelKey, ModelInfo> models_;
+    std::atomic<size_t> nextWorker_;  // rotates the start of the search so ties are spread
+};
@@ -0,0 +1,181 @@
+/**
+* @file infer_request.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+class StreamExecutor;
+
+/**
+* ModelKey: identifies one model served by the engine
+*/
+struct ModelKey {
+    std::string name;
+    std::string version;
+
+    ModelKey() {}
+    ModelKey(const std::string &modelName, const std::string &modelVersion) : name(modelName), version(modelVersion) {}
+
+    bool operator<(const ModelKey &other) const
+    {
+        return (name < other.name) || ((name == other.name) && (version < other.version));
+    }
+};
+
+/**
+* InferResult: result of one inference, delivered to the request callback
+*/
+struct InferResult {
+    Result ret;
+    bool shed;                  // not executed because it could not finish before its deadline
+    bool cancelled;             // not executed because another copy of the request completed first
+    std::vector<float> scores;  // output 0 of the model, as float
+
+    InferResult() : ret(FAILED), shed(false), cancelled(false) {}
+};
+
+typedef std::function<void(const InferResult &)> InferCallback;
+
+/**
+* InferPriority: request classes, each batched in its own queues, lower values are served first
+*/
+enum InferPriority {
+    PRIORITY_INTERACTIVE = 0,  // latency critical, runs on the reserved streams and slots
+    PRIORITY_BULK,             // backfill, batched for throughput, uses the capacity left idle
+    PRIORITY_NUM
+};
+
+/**
+* InputWriter: writes one sample straight into the batch input
+* @param [out] sample: sample memory in the batch input
+* @param [in] size: sample size in bytes
+* @return result
+*/
+typedef std::function<Result(uint8_t *sample, size_t size)> InputWriter;
+
+/**
+* InferRequest: one input waiting in a queue, owns its input data
+*/
+struct InferRequest {
+    std::vector<uint8_t> input;  // one sample
+    InputWriter writer;          // produces the sample instead of input when set
+    ModelKey model;              // empty name means the default model, empty version its default version
+    uint64_t height;             // image size of input, 0 for fixed shape models
+    uint64_t width;
+    InferPriority priority;
+    InferCallback callback;
+    std::chrono::steady_clock::time_point enqueueTime;
+    std::chrono::steady_clock::time_point deadline;  // the result is useless after it, max means none
+    std::shared_ptr<std::atomic<bool>> cancel;       // set when a hedged copy completed first, may be null
+    std::shared_ptr<std::atomic<StreamExecutor *>> lane;  // lane the request was queued on, set for hedged ones
+
+    InferRequest() : height(0), width(0), priority(PRIORITY_INTERACTIVE),
+        deadline(std::chrono::steady_clock::time_point::max()) {}
+};
+
+typedef std::shared_ptr<InferRequest> InferRequestPtr;
+
+/**
+* @brief call the request callback with a shed result, for a request dropped for its deadline
+* @param [in] request: dropped request
+*/
+inline void ShedRequest(const InferRequestPtr &request)
+{
+    InferResult result;
+    result.shed = true;
+    if (request->callback) {
+        request->callback(result);
+    }
+}
+
+/**
+* @brief whether another copy of the request has completed, so it need not run
+* @param [in] request: request
+* @return true if cancelled
+*/
+inline bool IsCancelled(const InferRequestPtr &request)
+{
+    return (request->cancel != nullptr) && request->cancel->load();
+}
+
+/**
+* @brief call the request callback with a cancelled result, for a request dropped because it was cancelled
+* @param [in] request: dropped request
+*/
+inline void CancelRequest(const InferRequestPtr &request)
+{
+    InferResult result;
+    result.cancelled = true;
+    if (request->callback) {
+        request->callback(result);
+    }
+}
+
+/**
+* CascadePlan: a model whose batches run on a lighter model first, only the samples the light model
+* is not confident about are executed by the model itself. Shared by all batches of the model.
+*/
+struct CascadePlan {
+    ModelKey light;                 // model run first
+    ModelKey full;                  // model the uncertain samples escalate to
+    float margin;                   // a light result is used when its top 1 score leads top 2 by at least this
+    std::atomic<size_t> samples;    // samples run on the light model
+    std::atomic<size_t> escalated;  // samples run on the full model again
+
+    CascadePlan() : margin(0.0f), samples(0), escalated(0) {}
+};
+
+/**
+* InferBatch: requests executed together in one model execution, sample i is requests[i].
+* All requests of a batch are for the same model, image size and priority.
+*/
+struct InferBatch {
+    std::vector<InferRequestPtr> requests;
+    ModelKey model;
+    uint64_t height;
+    uint64_t width;
+    InferPriority priority;
+    std::shared_ptr<CascadePlan> cascade;  // set when the batch runs on cascade->light, may be null
+
+    InferBatch() : height(0), width(0), priority(PRIORITY_INTERACTIVE) {}
+};
+
+typedef std::shared_ptr<InferBatch> InferBatchPtr;
+
+/**
+* BatchKey: requests can only be batched together when their keys are equal
+*/
+struct BatchKey {
+    InferPriority priority;
+    ModelKey model;
+    ImageSize imageSize;
+
+    BatchKey() : priority(PRIORITY_INTERACTIVE) {}
+
+    bool operator<(const BatchKey &other) const
+    {
+        if (priority != other.priority) {
+            return priority < other.priority;
+        }
+        if (model < other.model) {
+            return true;
+        }
+        if (other.model < model) {
+            return false;
+        }
+        return imageSize < other.imageSize;
+    }
+};
@@ -0,0 +1,255 @@
+/**
+* @file model_context.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <memory>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+#include "model_process.h"
+#include "acl/acl.h"
+
+/**
+* WarmupPolicy: how long to run synthetic executions before a model takes traffic
+*/
+struct WarmupPolicy {
+    size_t minIterations;  // 0 disables warmup
+    size_t maxIterations;  // stop here even if the latency has not settled
+    double stableRatio;    // settled when the slowest of the last runs is within this ratio of the fastest
+
+    WarmupPolicy() : minIterations(0), maxIterations(0), stableRatio(0.0) {}
+};
+
+/**
+* WarmupResult: latency of the warmup executions of one model variant, the startup baseline
+*/
+struct WarmupResult {
+    size_t batchSize;   // max batch size of the variant
+    size_t iterations;  // executions run
+    float firstMs;      // device time of the first execution
+    float steadyMs;     // mean device time of the last runs
+    bool stable;        // the latency settled before maxIterations
+
+    WarmupResult() : batchSize(0), iterations(0), firstMs(0.0f), steadyMs(0.0f), stable(false) {}
+};
+
+/**
+* ModelContext: per thread execution state of a shared ModelProcess,
+* input / output datasets with their device and pinned host buffers and a completion event.
+* A context is used by one thread at a time, the model it refers to may be shared by many.
+*/
+class ModelContext {
+public:
+    /**
+    * @brief Constructor
+    */
+    ModelContext();
+
+    /**
+    * @brief Destructor
+    */
+    ~ModelContext();
+
+    /**
+    * @brief create datasets and buffers sized from the model description
+    * @param [in] model: loaded model with description
+    * @return result
+    */
+    Result Init(const std::shared_ptr<const ModelProcess> &model);
+
+    /**
+    * @brief create buffers large enough for capacity and model, then bind model
+    * @param [in] model: loaded model with description
+    * @param [in] capacity: sizes of other models this context may be bound to later
+    * @return result
+    */
+    Result Init(const std::shared_ptr<const ModelProcess> &model, const ModelIoSizes &capacity);
+
+    /**
+    * @brief execute another model with the same buffers, only the datasets are rebuilt.
+    * Buffers are reallocated larger when the model does not fit them.
+    * @param [in] model: loaded model with description
+    * @return result
+    */
+    Result Bind(const std::shared_ptr<const ModelProcess> &model);
+
+    /**
+    * @brief whether Bind(model) keeps the current buffers, and with them the input already on device
+    * @param [in] model: loaded model with description
+    * @return true if the model fits the buffers
+    */
+    bool CanBind(const std::shared_ptr<const ModelProcess> &model) const;
+
+    /**
+    * @brief release the bound model but keep the buffers, must be called with the context set current
+    */
+    void Unbind();
+
+    /**
+    * @brief execute zeroed inputs at the max batch (and largest image size) on stream until the
+    * latency settles, blocking
+    * @param [in] stream: stream to launch on
+    * @param [in] policy: number of executions and when the latency counts as settled
+    * @param [out] result: latency of the executions
+    * @return result
+    */
+    Result Warmup(aclrtStream stream, const WarmupPolicy &policy, WarmupResult &result);
+
+    /**
+    * @brief destroy datasets and buffers
+    */
+    void Destroy();
+
+    /**
+    * @brief copy input, execute and copy output back, blocks until the result is ready
+    * @param [in] inputData: input data in host memory
+    * @param [in] dataSize: input data size
+    * @param [out] result: model output
+    * @return result
+    */
+    Result Execute(const void *inputData, size_t dataSize, InferResult &result);
+
+    /**
+    * @brief stage input and queue its upload on stream
+    * @param [in] inputData: input data in host memory
+    * @param [in] dataSize: input data size
+    * @param [in] stream: stream to launch the copy on
+    * @return result
+    */
+    Result CopyInputAsync(const void *inputData, size_t dataSize, aclrtStream stream);
+
+    /**
+    * @brief copy one sample into the input at offset, the copy to device happens in UploadInputAsync
+    * @param [in] offset: byte offset in input 0
+    * @param [in] inputData: sample data in host memory
+    * @param [in] dataSize: sample data size
+    * @return result
+    */
+    Result StageInput(size_t offset, const void *inputData, size_t dataSize);
+
+    /**
+    * @brief let writer produce one sample in the input at offset, the copy to device happens in UploadInputAsync
+    * @param [in] offset: byte offset in input 0
+    * @param [in] dataSize: sample size
+    * @param [in] writer: writes the sample
+    * @return result
+    */
+    Result StageInput(size_t offset, size_t dataSize, const InputWriter &writer);
+
+    /**
+    * @brief queue upload of the first dataSize staged bytes on stream
+    * @param [in] dataSize: staged size
+    * @param [in] stream: stream to launch the copy on
+    * @return result
+    */
+    Result UploadInputAsync(size_t dataSize, aclrtStream stream);
+
+    /**
+    * @brief queue a copy between two places of input 0 on device, to reuse samples uploaded for an
+    * earlier execution
+    * @param [in] srcOffset: byte offset of the data in input 0
+    * @param [in] dstOffset: byte offset it is copied to, the two ranges must not overlap
+    * @param [in] size: bytes to copy
+    * @param [in] stream: stream to launch the copy on
+    * @return result
+    */
+    Result MoveInputAsync(size_t srcOffset, size_t dstOffset, size_t size, aclrtStream stream);
+
+    /**
+    * @brief set number of samples of the next execution, picks a dynamic batch gear if the model has them
+    * @param [in] batchSize: number of samples staged
+    * @return result
+    */
+    Result SetBatchSize(size_t batchSize);
+
+    /**
+    * @brief set image size of the next execution, for dynamic HW models only
+    * @param [in] height: image height, one of the model image size gears, 0 keeps the model default
+    * @param [in] width: image width, one of the model image size gears, 0 keeps the model default
+    * @return result
+    */
+    Result SetImageSize(uint64_t height, uint64_t width);
+
+    /**
+    * @brief queue execute and output download on stream, then record the completion event
+    * @param [in] stream: stream to launch on
+    * @return result
+    */
+    Result ExecuteAsync(aclrtStream stream);
+
+    /**
+    * @brief wait for the completion event of the last ExecuteAsync
+    * @return result
+    */
+    Result Synchronize();
+
+    /**
+    * @brief get device time of the last ExecuteAsync, from execute start to output downloaded
+    * @param [out] ms: elapsed time in milliseconds
+    * @return result
+    */
+    Result GetElapsedTime(float &ms) const;
+
+    /**
+    * @brief read output 0 as float, valid after Execute or Synchronize
+    * @param [out] result: model output
+    * @return result
+    */
+    Result GetResult(InferResult &result) const;
+
+    /**
+    * @brief read output 0 of one sample of the batch as float, valid after Execute or Synchronize
+    * @param [in] index: sample index in the batch
+    * @param [out] result: model output of the sample
+    * @return result
+    */
+    Result GetResult(size_t index, InferResult &result) const;
+
+    /**
+    * @brief dump model output result to file
+    */
+    void DumpModelOutputResult() const;
+
+    /**
+    * @brief print top 5 of each model output
+    */
+    void OutputModelResult() const;
+
+    /**
+    * @brief get max input size of the model
+    * @return input size
+    */
+    size_t GetInputSize() const;
+
+    /**
+    * @brief get the model this context executes
+    * @return model
+    */
+    const std::shared_ptr<const ModelProcess> &GetModel() const;
+
+private:
+    Result CreateBuffers();
+    Result CreateDatasets();
+    void DestroyDatasets();
+    void DestroyBuffers();
+    const void *GetOutputData(size_t index, size_t &len) const;
+
+    std::shared_ptr<const ModelProcess> model_;
+    ModelIoSizes capacity_;     // sizes the buffers were allocated with
+    std::vector<void *> inputDevBuffers_;    // input 0 plus any extra inputs such as the dynamic batch tensor
+    std::vector<void *> outputDevBuffers_;
+    void *inputHostBuffer_;     // pinned host staging of input 0 (host run mode only)
+    std::vector<void *> outputHostBuffers_;  // pinned host copies of outputs (host run mode only)
+    size_t inputSize_;          // input 0 size of the bound model
+    size_t batchSize_;          // batch size of the next execution, only this many output rows are downloaded
+    aclmdlDataset *input_;      // datasets of the bound model over the buffers above
+    aclmdlDataset *output_;
+    aclrtEvent startEvent_;     // recorded before execute
+    aclrtEvent event_;          // recorded after the output download
+};
@@ -0,0 +1,224 @@
+/**
+* @file model_family.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "model_context.h"
+#include "model_process.h"
+
+class VariantSelector;
+
+/**
+* ModelVariant: one build of the network at a given max batch size
+*/
+struct ModelVariant {
+    std::string path;
+    size_t batchSize;
+    std::shared_ptr<ModelProcess> model;    // nullptr while unloaded
+    std::weak_ptr<ModelProcess> released;   // unloaded model that may still be bound to a slot
+    std::chrono::steady_clock::time_point lastUsed;
+    bool wanted;   // unloaded but asked for by a batch, the registry loads it again
+    bool loading;  // being loaded again, batches use a larger variant meanwhile
+
+    ModelVariant() : batchSize(0), wanted(false), loading(false) {}
+};
+
+/**
+* ModelFamily: the same network compiled at several batch sizes, loaded on one device.
+* Every variant is loaded once at Init to learn its sizes, variants not used for a while
+* are unloaded. An unloaded variant asked for again is loaded and warmed up by the loader thread
+* of the registry, within its memory budget, while batches run on a larger variant. The largest
+* variant is never unloaded.
+*/
+class ModelFamily {
+public:
+    /**
+    * @brief Constructor
+    */
+    ModelFamily();
+
+    /**
+    * @brief Destructor
+    */
+    ~ModelFamily();
+
+    /**
+    * @brief load every variant, must be called with the device context set current
+    * @param [in] paths: .om files of the same network, in any order
+    * @param [in] idleUnloadSec: unload a variant not used for this long, 0 never unloads
+    * @return result
+    */
+    Result Load(const std::vector<std::string> &paths, uint32_t idleUnloadSec);
+
+    /**
+    * @brief get the smallest loaded variant that holds batchSize samples. When the smallest such variant
+    * is unloaded, it is marked as wanted and the next larger loaded variant is returned.
+    * @param [in] batchSize: number of samples to execute
+    * @return model, nullptr before Load
+    */
+    std::shared_ptr<const ModelProcess> Acquire(size_t batchSize);
+
+    /**
+    * @brief take an unloaded variant asked for by Acquire, it is marked as loading until
+    * LoadIdleVariant or CancelVariantLoad
+    * @param [out] index: index of the variant
+    * @param [out] path: .om file of the variant
+    * @return true if a variant has to be loaded
+    */
+    bool TakeWantedVariant(size_t &index, std::string &path);
+
+    /**
+    * @brief load and warm up a variant taken by TakeWantedVariant, without blocking Acquire meanwhile.
+    * Must be called with the device context set current.
+    * @param [in] index: index of the variant
+    * @param [in] policy: warmup executions of the variant
+    * @return result
+    */
+    Result LoadIdleVariant(size_t index, const WarmupPolicy &policy);
+
+    /**
+    * @brief give up loading a variant taken by TakeWantedVariant
+    * @param [in] index: index of the variant
+    */
+    void CancelVariantLoad(size_t index);
+
+    /**
+    * @brief run warmup executions on every loaded variant on a stream of its own, the settled latency
+    * seeds the selector. Must be called with the context set current.
+    * @param [in] policy: number of executions and when the latency counts as settled
+    * @param [out] results: latency of each warmed up variant
+    * @return result
+    */
+    Result Warmup(const WarmupPolicy &policy, std::vector<WarmupResult> &results);
+
+    /**
+    * @brief whether other uses the same input, output, image and batch sizes, so it can replace this family
+    * @param [in] other: loaded family
+    * @return true if compatible
+    */
+    bool IsCompatible(const ModelFamily &other) const;
+
+    /**
+    * @brief mark every loaded variant as evicted or replaced by a reload
+    */
+    void Retire();
+
+    /**
+    * @brief get the largest variant, it is always loaded
+    * @return model, nullptr before Load
+    */
+    std::shared_ptr<const ModelProcess> GetModel() const;
+
+    /**
+    * @brief get buffer sizes large enough for every variant
+    * @return sizes
+    */
+    ModelIoSizes GetIoCapacity() const;
+
+    /**
+    * @brief get max batch size of each variant, ascending
+    * @return batch sizes
+    */
+    std::vector<size_t> GetBatchSizes() const;
+
+    /**
+    * @brief get device memory held by the loaded variants
+    * @return size in bytes
+    */
+    size_t GetDeviceMemSize() const;
+
+    /**
+    * @brief get device memory all variants need once loaded, without loading them
+    * @param [in] paths: .om files of the variants
+    * @param [out] size: size in bytes
+    * @return result
+    */
+    static Result QueryDeviceMemSize(const std::vector<std::string> &paths, size_t &size);
+
+    /**
+    * @brief set the selector that receives the measured latency of each variant, and its batch sizes
+    * @param [in] selector: selector of the model, may be nullptr
+    */
+    void SetSelector(const std::shared_ptr<VariantSelector> &selector);
+
+    /**
+    * @brief get the selector of the model
+    * @return selector, nullptr if none
+    */
+    std::shared_ptr<VariantSelector> GetSelector() const;
+
+    /**
+    * @brief unload every variant
+    */
+    void Unload();
+
+private:
+    Result LoadVariant(ModelVariant &variant);
+    static Result WarmupModel(const std::shared_ptr<ModelProcess> &model, aclrtStream stream,
+        const WarmupPolicy &policy, WarmupResult &result);
+    void UnloadIdleVariants(std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex mutex_;
+    std::vector<ModelVariant> variants_;  // ascending batch size
+    ModelIoSizes capacity_;
+    std::shared_ptr<VariantSelector> selector_;
+    std::chrono::seconds idleUnload_;
+    std::chrono::steady_clock::time_point lastIdleCheck_;
+};
+
+/**
+* VariantSelector: chooses how many requests to batch for the variants of a family, from the
+* queue depth and the measured latency of each variant. Shared by every device of the engine.
+*/
+class VariantSelector {
+public:
+    /**
+    * @brief Constructor
+    */
+    VariantSelector();
+
+    /**
+    * @brief set the variants to choose from
+    * @param [in] batchSizes: max batch size of each variant, ascending
+    */
+    void SetBatchSizes(const std::vector<size_t> &batchSizes);
+
+    /**
+    * @brief add one measured execution of a variant
+    * @param [in] batchSize: max batch size of the executed variant
+    * @param [in] ms: device time of the execution, in milliseconds
+    */
+    void Record(size_t batchSize, float ms);
+
+    /**
+    * @brief get the measured latency of the variant that would execute a batch
+    * @param [in] batchSize: number of samples of the batch
+    * @return latency in milliseconds, 0 until a variant has been measured
+    */
+    double GetLatency(size_t batchSize) const;
+
+    /**
+    * @brief choose the batch size that drains the pending requests fastest
+    * @param [in] pending: number of queued requests
+    * @return batch size of the chosen variant
+    */
+    size_t Select(size_t pending) const;
+
+private:
+    double EstimateLatency(size_t index) const;
+
+    mutable std::mutex mutex_;
+    std::vector<size_t> batchSizes_;
+    std::vector<double> latencyMs_;  // moving average of each variant, 0 until measured
+};
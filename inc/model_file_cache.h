@@ -0,0 +1,57 @@
+/**
+* @file model_file_cache.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+typedef std::shared_ptr<const std::vector<uint8_t>> ModelFileData;
+
+/**
+* ModelFileCache: reads .om files in background threads during startup, so file reading overlaps
+* with acl and device initialization. Loads then take the bytes from memory instead of the file.
+*/
+class ModelFileCache {
+public:
+    /**
+    * @brief get the process wide cache
+    * @return cache
+    */
+    static ModelFileCache &Instance();
+
+    /**
+    * @brief start reading a file in the background, files already requested are skipped
+    * @param [in] path: .om file path
+    */
+    void Prefetch(const std::string &path);
+
+    /**
+    * @brief get the content of a prefetched file, waits until it has been read
+    * @param [in] path: .om file path
+    * @return file content, nullptr if the file was not prefetched or reading failed
+    */
+    ModelFileData Get(const std::string &path);
+
+    /**
+    * @brief drop every file, later loads read from the file again
+    */
+    void Clear();
+
+private:
+    ModelFileCache() {}
+
+    std::mutex mutex_;
+    std::map<std::string, std::shared_future<ModelFileData>> files_;
+};
@@ -8,12 +8,37 @@
 * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 */
 #pragma once
+#include <atomic>
 #include <iostream>
+#include <vector>
 #include "utils.h"
 #include "acl/acl.h"
 
 /**
-* ModelProcess
+* ModelIoSizes: byte sizes of each input and output of a model
+*/
+struct ModelIoSizes {
+    std::vector<size_t> inputSizes;
+    std::vector<size_t> outputSizes;
+
+    /**
+    * @brief grow every size to the max of itself and other
+    * @param [in] other: sizes of another model
+    */
+    void Merge(const ModelIoSizes &other);
+
+    /**
+    * @brief whether buffers of these sizes can hold every input and output of other
+    * @param [in] other: sizes of another model
+    * @return true if other fits
+    */
+    bool Fits(const ModelIoSizes &other) const;
+};
+
+/**
+* ModelProcess: one loaded model (id, description, work and weight memory).
+* It is not changed after load and desc creation, so any number of ModelContext
+* objects on any threads may execute it concurrently.
 */
 class ModelProcess {
 public:
@@ -34,6 +59,15 @@ public:
     */
     Result LoadModelFromFileWithMem(const char *modelPath);
 
+    /**
+    * @brief load model from a model file already read to host memory, with mem
+    * @param [in] model: model file content
+    * @param [in] modelSize: size of model file content
+    * @param [in] modelName: model name or path, used in logs
+    * @return result
+    */
+    Result LoadModelFromMemWithMem(const void *model, size_t modelSize, const char *modelName);
+
     /**
     * @brief unload model
     */
@@ -51,46 +85,121 @@ public:
     void DestroyDesc();
 
     /**
-    * @brief create model input
-    * @param [in] inputDataBuffer: input buffer
-    * @param [in] bufferSize: input buffer size
+    * @brief model execute, blocks until the result is ready
+    * @param [in] input: input dataset
+    * @param [in] output: output dataset
     * @return result
     */
-    Result CreateInput(void *inputDataBuffer, size_t bufferSize);
+    Result Execute(const aclmdlDataset *input, aclmdlDataset *output) const;
 
     /**
-    * @brief destroy input resource
+    * @brief model execute asynchronously on stream
+    * @param [in] input: input dataset
+    * @param [in] output: output dataset
+    * @param [in] stream: stream to launch the execution on
+    * @return result
     */
-    void DestroyInput();
+    Result ExecuteAsync(const aclmdlDataset *input, aclmdlDataset *output, aclrtStream stream) const;
 
     /**
-    * @brief create output buffer
-    * @return result
+    * @brief get model id
+    * @return model id
     */
-    Result CreateOutput();
+    uint32_t GetModelId() const;
 
     /**
-    * @brief destroy output resource
+    * @brief get model description, nullptr before CreateDesc
+    * @return model description
     */
-    void DestroyOutput();
+    aclmdlDesc *GetModelDesc() const;
 
     /**
-    * @brief model execute
-    * @return result
+    * @brief get max batch size, the largest dynamic batch gear or the static batch dim of input 0
+    * @return max batch size
+    */
+    size_t GetMaxBatchSize() const;
+
+    /**
+    * @brief whether the model was built with dynamic batch gears
+    * @return true if batch size can be set per execution
+    */
+    bool IsDynamicBatch() const;
+
+    /**
+    * @brief get index of the dynamic batch tensor in the input dataset, valid for dynamic batch models
+    * @return input index
     */
-    Result Execute();
+    size_t GetDynamicTensorIndex() const;
 
     /**
-    * @brief dump model output result to file
+    * @brief get batch size the model runs for batchSize samples, smallest gear not less than batchSize
+    * @param [in] batchSize: number of samples
+    * @return batch size to execute with
     */
-    void DumpModelOutputResult();
+    size_t SelectBatchSize(size_t batchSize) const;
 
     /**
-    * @brief get model output result
+    * @brief whether the model was built with dynamic image size gears
+    * @return true if height and width can be set per execution
     */
-    void OutputModelResult();
+    bool IsDynamicHW() const;
+
+    /**
+    * @brief get the image size gears of a dynamic HW model
+    * @return image sizes, ascending, empty for fixed shape models
+    */
+    const std::vector<ImageSize> &GetImageSizes() const;
+
+    /**
+    * @brief get input 0 size of one sample, at the largest image size for dynamic HW models
+    * @return input size
+    */
+    size_t GetSampleInputSize() const;
+
+    /**
+    * @brief get input 0 size of one sample of the given image size
+    * @param [in] height: image height, 0 means the largest
+    * @param [in] width: image width, 0 means the largest
+    * @return input size
+    */
+    size_t GetSampleInputSize(uint64_t height, uint64_t width) const;
+
+    /**
+    * @brief get output size of one sample
+    * @param [in] index: output index
+    * @return output size
+    */
+    size_t GetSampleOutputSize(size_t index) const;
+
+    /**
+    * @brief get byte sizes of all inputs and outputs
+    * @return sizes
+    */
+    ModelIoSizes GetIoSizes() const;
+
+    /**
+    * @brief get device memory held by the model, work memory plus weights
+    * @return size in bytes
+    */
+    size_t GetDeviceMemSize() const;
+
+    /**
+    * @brief mark the model as evicted or replaced by a reload, contexts unbind it once idle so it can be unloaded
+    */
+    void Retire();
+
+    /**
+    * @brief whether the model has been evicted or replaced by a reload
+    * @return true if retired
+    */
+    bool IsRetired() const;
 
 private:
+    Result MallocModelMem();
+    void FreeModelMem();
+    Result InitBatchInfo();
+    Result InitImageSizeInfo();
+
 	// 模型标识符
     uint32_t modelId_;
 	// 分别代表工作内存 权值内存的大小以及指向内存的指针
@@ -100,12 +209,16 @@ private:
     void *modelWeightPtr_;
 	
     bool loadFlag_;  // model load flag
+    std::atomic<bool> retired_;  // evicted or replaced by a reload, only the executions in flight still use it
 	// 模型描述信息
     aclmdlDesc *modelDesc_;
-	
-	// 通过模型描述信息初始化的输入信息
-    aclmdlDataset *input_;// input_ : 存放输入信息（里面可以看成一个链表 每一个节点都是输出信息）
-	// 通过模型描述信息初始化的输出信息
-    aclmdlDataset *output_;// output_ : 存放输出信息（里面可以看成一个链表 每一个节点都是输出信息）
+	// batch信息 动态batch模型为各档位(升序) 静态模型为空
+    std::vector<uint64_t> batchGears_;
+    size_t maxBatchSize_;
+    size_t dynamicTensorIndex_;
+	// 动态分辨率模型的各档位(升序) 与动态batch不会同时存在
+    std::vector<ImageSize> imageSizes_;
+    uint64_t maxImageArea_;
+	// 输入输出dataset不在这里 由每个线程自己的ModelContext持有
 };
 
@@ -0,0 +1,175 @@
+/**
+* @file model_registry.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "utils.h"
+#include "infer_request.h"
+#include "model_family.h"
+#include "sample_config.h"
+#include "acl/acl.h"
+
+/**
+* ModelCatalogEntry: a model the engine may serve, loaded on first use
+*/
+struct ModelCatalogEntry {
+    ModelConfig config;
+    std::shared_ptr<VariantSelector> selector;  // shared by the devices, chooses batch sizes of the model
+
+    /**
+    * @brief get the .om files of the model, its variants or its model path
+    * @return paths
+    */
+    std::vector<std::string> GetPaths() const;
+
+    /**
+    * @brief get the warmup settings of the model
+    * @return policy
+    */
+    WarmupPolicy GetWarmupPolicy() const;
+};
+
+typedef std::map<ModelKey, ModelCatalogEntry> ModelCatalog;
+
+/**
+* RegistryStats: counters of one ModelRegistry
+*/
+struct RegistryStats {
+    size_t hits;          // Acquire found the model loaded
+    size_t misses;        // Acquire had to load or share the model
+    size_t evictions;
+    size_t reloads;
+    double totalLoadMs;   // time spent loading models
+    size_t loadedModels;
+    size_t memUsed;       // device memory of the loaded models
+
+    RegistryStats() : hits(0), misses(0), evictions(0), reloads(0), totalLoadMs(0.0), loadedModels(0), memUsed(0) {}
+};
+
+/**
+* ModelRegistry: the models loaded on one device, keyed by name and version. Models are loaded on
+* first use and the least recently used ones are evicted when the device memory budget would be
+* exceeded. Models built from the same .om files share one loaded copy. An evicted model is
+* retired: slots unbind it once their execution completes, the last one unloads it.
+*/
+class ModelRegistry {
+public:
+    /**
+    * @brief Constructor
+    */
+    ModelRegistry();
+
+    /**
+    * @brief Destructor
+    */
+    ~ModelRegistry();
+
+    /**
+    * @brief set the models that may be loaded and the memory budget, start the variant loader thread
+    * @param [in] context: context of the device, set current before loading
+    * @param [in] catalog: models that may be loaded
+    * @param [in] memBudget: device memory for models in bytes, 0 means no limit
+    * @return result
+    */
+    Result Init(aclrtContext context, const std::shared_ptr<const ModelCatalog> &catalog, size_t memBudget);
+
+    /**
+    * @brief set the function that unbinds idle slots from evicted models, called without the registry
+    * lock and with the device context set current after an eviction, so their memory is freed
+    * before the next model is loaded
+    * @param [in] handler: retire handler
+    */
+    void SetRetireHandler(const std::function<void()> &handler);
+
+    /**
+    * @brief get a loaded model, loading it and evicting others if needed. Other models can be
+    * acquired while one is loading, callers of the same model wait for its load. A variant of the
+    * model unloaded for idleness and asked for again is queued to the variant loader thread, callers
+    * keep using the loaded variants and never wait for it.
+    * @param [in] key: model name and version
+    * @return model variants, nullptr if the model is unknown or cannot be loaded
+    */
+    std::shared_ptr<ModelFamily> Acquire(const ModelKey &key);
+
+    /**
+    * @brief load the .om files of a model again and switch to them once warmed up, requests keep
+    * using the old copy meanwhile. The old copy is unloaded after its last execution.
+    * @param [in] key: model name and version
+    * @return result, SUCCESS without loading if the model is not loaded on this device
+    */
+    Result Reload(const ModelKey &key);
+
+    /**
+    * @brief get counters
+    * @return stats
+    */
+    RegistryStats GetStats() const;
+
+    /**
+    * @brief stop the variant loader thread, variants not loaded yet stay unloaded
+    */
+    void StopLoading();
+
+    /**
+    * @brief stop the variant loader and release every model, must be called with the device context
+    * set current
+    */
+    void Clear();
+
+private:
+    struct Entry {
+        std::shared_ptr<ModelFamily> family;  // nullptr while loading
+        bool loading;
+        size_t reservedMem;  // memory set aside for a model or variant being loaded or reloaded
+        std::chrono::steady_clock::time_point lastUsed;
+
+        Entry() : loading(false), reservedMem(0) {}
+    };
+
+    /**
+    * VariantLoad: a variant unloaded for idleness to be loaded again by the loader thread
+    */
+    struct VariantLoad {
+        ModelKey key;
+        std::weak_ptr<ModelFamily> family;
+        size_t index;
+        std::string path;
+    };
+
+    Result MakeRoom(size_t size, const ModelKey &key);
+    void QueueWantedVariant(const ModelKey &key, const std::shared_ptr<ModelFamily> &family);
+    void RunLoader();
+    void LoadWantedVariant(std::unique_lock<std::mutex> &lock, const VariantLoad &load);
+    bool IsCascadePair(const ModelKey &first, const ModelKey &second) const;
+    size_t GetMemUsed() const;
+    static std::string GetPathsKey(const std::vector<std::string> &paths);
+
+    aclrtContext context_;
+    std::shared_ptr<const ModelCatalog> catalog_;
+    size_t memBudget_;
+    std::function<void()> retireHandler_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable loadCond_;  // wakes callers waiting for a model being loaded
+    std::map<ModelKey, Entry> entries_;
+    std::map<std::string, std::weak_ptr<ModelFamily>> families_;  // loaded copies by .om files
+    RegistryStats stats_;
+    std::condition_variable loaderCond_;  // wakes the loader thread
+    std::deque<VariantLoad> variantLoads_;
+    bool stopLoader_;
+    std::thread loader_;
+};
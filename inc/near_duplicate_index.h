@@ -0,0 +1,141 @@
+/**
+* @file near_duplicate_index.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+#include "roi_preprocessor.h"
+#include "sample_config.h"
+
+/**
+* NearDuplicateStats: images looked up in the NearDuplicateIndex
+*/
+struct NearDuplicateStats {
+    size_t images;   // images looked up
+    size_t reused;   // images answered with the result of a near duplicate
+    size_t entries;  // hashes kept now
+
+    NearDuplicateStats() : images(0), reused(0), entries(0) {}
+};
+
+/**
+* NearDuplicateIndex: perceptual hashes of executed images per model, with their results. The hash
+* keeps the signs of the lowest frequencies of the image, so re-encoded or resized copies get hashes
+* that differ in few bits. The 64 bits are split into 4 chunks of 16 bits with a table each: a hash
+* within distance d of the query matches one chunk within distance d / 4, so only the table entries
+* near the query chunks are compared.
+*/
+class NearDuplicateIndex {
+public:
+    /**
+    * @brief Constructor
+    */
+    NearDuplicateIndex();
+
+    /**
+    * @brief set the size and distance limit, 0 entries disables the index
+    * @param [in] config: index settings
+    */
+    void SetConfig(const NearDuplicateConfig &config);
+
+    /**
+    * @brief whether images may reuse results
+    * @return true if enabled
+    */
+    bool IsEnabled() const;
+
+    /**
+    * @brief perceptual hash of an image: DCT of its 32x32 luma thumbnail, one bit per coefficient of the
+    * lowest 8x8 frequencies, set when the coefficient is above their median. The DCT uses SSE or NEON
+    * where available.
+    * @param [in] image: decoded image, checked by RoiPreprocessor::Check
+    * @return 64 bit hash
+    */
+    static uint64_t Hash(const DecodedImage &image);
+
+    /**
+    * @brief number of differing bits of two hashes
+    * @param [in] first: hash
+    * @param [in] second: hash
+    * @return Hamming distance, 0 to 64
+    */
+    static uint32_t Distance(uint64_t first, uint64_t second);
+
+    /**
+    * @brief look for the result of the nearest image of a model within the configured distance
+    * @param [in] model: model name and version
+    * @param [in] hash: hash of the image
+    * @param [out] result: reused result, valid when true is returned
+    * @return true if the image need not be executed
+    */
+    bool Find(const ModelKey &model, uint64_t hash, InferResult &result);
+
+    /**
+    * @brief keep the result of an executed image, the oldest hash of the model is dropped when full
+    * @param [in] model: model name and version
+    * @param [in] hash: hash of the image
+    * @param [in] result: result of the image, failed results are not kept
+    */
+    void Insert(const ModelKey &model, uint64_t hash, const InferResult &result);
+
+    /**
+    * @brief drop the hashes of a model, after it was reloaded
+    * @param [in] model: model name and version
+    */
+    void Invalidate(const ModelKey &model);
+
+    /**
+    * @brief get the counters
+    * @return stats
+    */
+    NearDuplicateStats GetStats() const;
+
+private:
+    static const size_t CHUNK_NUM = 4;
+
+    struct Entry {
+        uint64_t hash;
+        InferResult result;
+    };
+
+    typedef std::vector<std::pair<uint64_t, uint64_t>> ChunkBucket;  // hash and id of each entry
+
+    /**
+    * ModelIndex: hashes of one model version
+    */
+    struct ModelIndex {
+        std::map<uint64_t, Entry> entries;  // by id, oldest first
+        std::unordered_map<uint32_t, ChunkBucket> chunks[CHUNK_NUM];  // entries by the value of each chunk
+        uint64_t nextId;
+
+        ModelIndex() : nextId(0) {}
+    };
+
+    /**
+    * Match: nearest entry found so far
+    */
+    struct Match {
+        uint64_t id;
+        uint32_t distance;
+    };
+
+    static void Probe(const ModelIndex &index, size_t chunk, uint32_t value, size_t firstBit, size_t radius,
+        uint64_t hash, Match &best);
+    static void EraseOldest(ModelIndex &index);
+
+    NearDuplicateConfig config_;
+    mutable std::mutex mutex_;
+    std::map<ModelKey, ModelIndex> models_;
+    NearDuplicateStats stats_;
+};
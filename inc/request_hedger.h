@@ -0,0 +1,123 @@
+/**
+* @file request_hedger.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+#include "sample_config.h"
+
+/**
+* HedgeStats: counters of the RequestHedger
+*/
+struct HedgeStats {
+    size_t tracked;  // requests watched for hedging
+    size_t hedged;   // duplicates dispatched
+    size_t won;      // duplicates that completed before their original
+    double delayMs;  // current hedging delay, 0 while there are too few samples
+
+    HedgeStats() : tracked(0), hedged(0), won(0), delayMs(0.0) {}
+};
+
+/**
+* RequestHedger: when a request has not completed within a percentile of the observed latency, a
+* duplicate is dispatched to a lane other than the one the request is queued on. The first result is
+* delivered, the other copy is cancelled if it has not been uploaded yet and discarded otherwise.
+* Duplicates are capped by a budget relative to the tracked requests.
+*/
+class RequestHedger {
+public:
+    typedef std::function<Result(const InferRequestPtr &, const StreamExecutor *)> DispatchFunc;
+
+    /**
+    * @brief Constructor
+    */
+    RequestHedger();
+
+    /**
+    * @brief Destructor
+    */
+    ~RequestHedger();
+
+    /**
+    * @brief start the timer thread, does nothing when hedging is disabled
+    * @param [in] config: latency percentile and budget
+    * @param [in] dispatch: called from the timer thread to execute a duplicate on the least loaded lane
+    * other than the given lane of the original, fails when there is no other lane
+    * @return result
+    */
+    Result Start(const HedgeConfig &config, const DispatchFunc &dispatch);
+
+    /**
+    * @brief whether requests are tracked
+    * @return true if hedging is enabled and started
+    */
+    bool IsEnabled() const;
+
+    /**
+    * @brief watch one request before it is queued, its callback is replaced by one that delivers
+    * the first result of the request or its duplicate
+    * @param [in] request: request to watch
+    */
+    void Track(const InferRequestPtr &request);
+
+    /**
+    * @brief get the counters
+    * @return stats
+    */
+    HedgeStats GetStats() const;
+
+    /**
+    * @brief stop the timer thread, no duplicates are dispatched afterwards
+    */
+    void Stop();
+
+private:
+    /**
+    * HedgeState: the request and its duplicate share one state, the first result wins
+    */
+    struct HedgeState {
+        std::atomic<bool> done;
+        InferCallback callback;      // callback of the original request, guarded by the hedger mutex
+        InferRequestPtr request;     // original, copied for the duplicate, released once done, guarded too
+        std::shared_ptr<std::atomic<bool>> cancel;  // set once done, the other copy is then dropped
+        std::chrono::steady_clock::time_point start;
+
+        HedgeState() : done(false) {}
+    };
+
+    void Run();
+    void Complete(std::shared_ptr<HedgeState> state, const InferResult &result, bool duplicate);
+    InferRequestPtr CreateDuplicate(const std::shared_ptr<HedgeState> &state, const InferRequestPtr &original);
+    void RecordLatency(double ms);
+    bool TakeBudget();
+
+    HedgeConfig config_;
+    DispatchFunc dispatch_;
+    std::atomic<bool> enabled_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::multimap<std::chrono::steady_clock::time_point, std::weak_ptr<HedgeState>> timers_;
+    std::vector<double> latencies_;  // ring of the latest latencies
+    size_t nextLatency_;
+    size_t newLatencies_;            // recorded since the delay was computed
+    std::chrono::steady_clock::duration delay_;  // zero until enough latencies are recorded
+    HedgeStats stats_;
+    bool stop_;
+    std::thread thread_;
+};
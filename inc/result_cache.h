@@ -0,0 +1,183 @@
+/**
+* @file result_cache.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+#include "sample_config.h"
+
+/**
+* ResultCacheKey: one input of one model, identified by the hash and size of the input bytes
+*/
+struct ResultCacheKey {
+    ModelKey model;
+    ImageSize imageSize;  // of dynamic HW models, the same bytes may be read at another shape
+    uint64_t hash;
+    size_t size;
+
+    ResultCacheKey() : hash(0), size(0) {}
+
+    bool operator==(const ResultCacheKey &other) const
+    {
+        return (hash == other.hash) && (size == other.size) && (imageSize == other.imageSize) &&
+            (model.name == other.model.name) && (model.version == other.model.version);
+    }
+
+    bool operator<(const ResultCacheKey &other) const
+    {
+        if (hash != other.hash) {
+            return hash < other.hash;
+        }
+        if (size != other.size) {
+            return size < other.size;
+        }
+        if (imageSize != other.imageSize) {
+            return imageSize < other.imageSize;
+        }
+        return model < other.model;
+    }
+};
+
+/**
+* ResultCacheStats: what the cache did with the looked up requests
+*/
+struct ResultCacheStats {
+    size_t hits;       // answered from the cache
+    size_t misses;     // executed
+    size_t coalesced;  // waited for an identical request in flight
+    size_t readmitted; // waited, but the request in flight was shed or cancelled so they were admitted again
+    size_t evictions;  // results dropped for room
+    size_t expired;    // results dropped for their age
+    size_t entries;    // results cached now
+
+    ResultCacheStats() : hits(0), misses(0), coalesced(0), readmitted(0), evictions(0), expired(0), entries(0) {}
+};
+
+/**
+* CacheLookup: outcome of ResultCache::Lookup
+*/
+enum CacheLookup {
+    CACHE_HIT = 0,    // the result is returned, nothing to execute
+    CACHE_COALESCED,  // an identical request is in flight, the callback is called with its result
+    CACHE_MISS,       // the caller executes the request and passes its result to Complete
+    CACHE_BYPASS      // an identical request in flight is less urgent, the caller executes the request alone
+};
+
+/**
+* ResultCache: results of recent inputs per model, split into shards with their own lock and least
+* recently used list. Identical requests in flight at the same time share one execution, the ones
+* arriving later wait for the result of the first unless it has a lower priority or a later deadline.
+*/
+class ResultCache {
+public:
+    /**
+    * @brief Constructor
+    */
+    ResultCache();
+
+    /**
+    * @brief set the size and age limit, must be called before the first Lookup
+    * @param [in] config: cache settings, 0 entries disables the cache
+    */
+    void SetConfig(const ResultCacheConfig &config);
+
+    /**
+    * @brief whether results are cached
+    * @return true if enabled
+    */
+    bool IsEnabled() const;
+
+    /**
+    * @brief hash of input bytes, 8 bytes at a time on four independent lanes
+    * @param [in] data: input bytes
+    * @param [in] size: number of bytes
+    * @return 64 bit hash
+    */
+    static uint64_t Hash(const uint8_t *data, size_t size);
+
+    /**
+    * @brief look up the result of an input, or register the request as in flight
+    * @param [in] key: model and input
+    * @param [in] request: its callback is called with the result of the identical request in flight on
+    * CACHE_COALESCED, its priority and deadline decide whether it may wait for that request
+    * @param [out] result: cached result on CACHE_HIT
+    * @return what the caller has to do
+    */
+    CacheLookup Lookup(const ResultCacheKey &key, const InferRequestPtr &request, InferResult &result);
+
+    /**
+    * @brief deliver the result of a request that missed, to the requests waiting for it, and keep it
+    * if it succeeded
+    * @param [in] key: key passed to Lookup
+    * @param [in] result: result of the execution
+    * @param [out] readmit: the waiting requests when the result was shed or cancelled, they may still
+    * finish in time and are to be executed by the caller, their callbacks are not called
+    */
+    void Complete(const ResultCacheKey &key, const InferResult &result, std::vector<InferRequestPtr> &readmit);
+
+    /**
+    * @brief drop the results of a model, after it was reloaded
+    * @param [in] model: model name and version
+    */
+    void Invalidate(const ModelKey &model);
+
+    /**
+    * @brief get the counters
+    * @return stats summed over the shards
+    */
+    ResultCacheStats GetStats() const;
+
+private:
+    static const size_t SHARD_NUM = 16;
+
+    struct KeyHash {
+        size_t operator()(const ResultCacheKey &key) const
+        {
+            return static_cast<size_t>(key.hash);
+        }
+    };
+
+    struct Entry {
+        InferResult result;
+        std::chrono::steady_clock::time_point time;      // when the result was stored
+        std::list<ResultCacheKey>::iterator lruPosition;  // in the lru list of the shard
+    };
+
+    /**
+    * Inflight: the executing request of a key and the requests waiting for it
+    */
+    struct Inflight {
+        InferPriority priority;
+        std::chrono::steady_clock::time_point deadline;
+        std::vector<InferRequestPtr> waiters;
+    };
+
+    /**
+    * Shard: part of the keys, selected by the hash
+    */
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<ResultCacheKey, Entry, KeyHash> entries;
+        std::list<ResultCacheKey> lru;  // most recently used first
+        std::map<ResultCacheKey, Inflight> inflight;  // executing keys
+        ResultCacheStats stats;
+    };
+
+    Shard &GetShard(const ResultCacheKey &key);
+
+    size_t shardCapacity_;
+    std::chrono::milliseconds ttl_;
+    Shard shards_[SHARD_NUM];
+};
@@ -0,0 +1,101 @@
+/**
+* @file roi_preprocessor.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+
+/**
+* DecodedImage: one decoded frame, 8 bit RGB, rows of width * 3 bytes
+*/
+struct DecodedImage {
+    std::shared_ptr<const std::vector<uint8_t>> pixels;  // shared by the boxes until they are executed
+    uint32_t width;
+    uint32_t height;
+
+    DecodedImage() : width(0), height(0) {}
+};
+
+/**
+* RoiBox: region of the image in pixels, clipped to the image
+*/
+struct RoiBox {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+
+    RoiBox() : x(0), y(0), width(0), height(0) {}
+    RoiBox(uint32_t left, uint32_t top, uint32_t boxWidth, uint32_t boxHeight) : x(left), y(top), width(boxWidth),
+        height(boxHeight) {}
+};
+
+/**
+* RoiNormalize: per channel (value - mean) * scale, channels in model order.
+* The defaults are those of script/transferPic.py for resnet50: BGR, mean subtracted, no scaling.
+*/
+struct RoiNormalize {
+    float mean[3];
+    float scale[3];
+    bool bgr;  // model channel 0 is blue
+
+    RoiNormalize();
+};
+
+typedef std::function<void(const std::vector<InferResult> &)> RoiCallback;
+
+/**
+* RoiRequest: boxes of one frame to classify together, each box is one sample of the batch
+*/
+struct RoiRequest {
+    DecodedImage image;
+    std::vector<RoiBox> boxes;
+    RoiNormalize normalize;
+    uint64_t height;  // size every box is resized to, for dynamic HW models one of the model image sizes
+    uint64_t width;
+    ModelKey model;   // empty name means the default model, empty version its default version
+    InferPriority priority;
+    std::chrono::steady_clock::time_point deadline;  // max means none
+    RoiCallback callback;  // called once with the results in box order
+
+    RoiRequest();
+};
+
+/**
+* RoiPreprocessor: crops a box of a decoded image, resizes it bilinearly and normalizes it into
+* one sample of a model input, NCHW float16 or float32 as the sample size implies
+*/
+class RoiPreprocessor {
+public:
+    /**
+    * @brief check that a box lies within the image and the image holds all its pixels
+    * @param [in] image: decoded image
+    * @param [in] box: region of the image
+    * @return result
+    */
+    static Result Check(const DecodedImage &image, const RoiBox &box);
+
+    /**
+    * @brief write the box into one sample, used as the InputWriter of its request
+    * @param [in] image: decoded image
+    * @param [in] box: region of the image, checked already
+    * @param [in] normalize: mean and scale of each channel
+    * @param [in] height: sample height
+    * @param [in] width: sample width
+    * @param [out] sample: sample memory, 3 * height * width values of float16 or float32
+    * @param [in] size: sample size in bytes
+    * @return result, FAILED if the size fits neither element type
+    */
+    static Result Write(const DecodedImage &image, const RoiBox &box, const RoiNormalize &normalize,
+        uint64_t height, uint64_t width, uint8_t *sample, size_t size);
+};
@@ -0,0 +1,141 @@
+/**
+* @file sample_config.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include "utils.h"
+
+/**
+* ModelConfig: tunables of one model, read from its section of the sample config
+*/
+struct ModelConfig {
+    std::string name;     // defaults to the section name
+    std::string version;  // defaults to "1"
+    std::string modelPath;
+    std::vector<std::string> variantPaths;  // same network built at several batch sizes, empty uses modelPath
+    std::string cpuModelPath;               // model file of the CPU backend, empty runs the model on devices only
+    std::string cascadeModel;  // name of a lighter model run first, empty runs every sample on this model
+    float cascadeMargin;       // light results whose top 1 score leads top 2 by less than this escalate
+    uint32_t variantIdleUnloadSec;          // unload a variant not used for this long, 0 keeps all loaded
+    size_t streamNum;  // streams (execution lanes) per device, only read from the default model
+    size_t slotNum;    // in-flight execution slots per stream, only read from the default model
+    size_t maxBatchSize;       // max requests in one execution, capped by the model max batch
+    uint32_t maxBatchDelayUs;  // max time the oldest request waits for its batch to fill
+    size_t latencyTargetMs;    // p99 latency target the batch size and delay are adjusted to, 0 keeps them fixed
+    size_t warmupIterations;     // min warmup executions per slot and variant, 0 disables warmup
+    size_t warmupMaxIterations;  // warmup stops here even if the latency has not settled
+    size_t warmupStablePct;      // latency is settled when the last runs differ by no more than this
+
+    ModelConfig();
+
+    /**
+    * @brief load settings of one model, keys missing in config keep their default value
+    * @param [in] config: parsed config file
+    * @param [in] section: section name of the model
+    * @return result
+    */
+    Result Load(const ConfigMap &config, const std::string &section);
+};
+
+/**
+* PriorityConfig: how interactive and bulk requests share the devices
+*/
+struct PriorityConfig {
+    size_t interactiveStreams;     // streams per device reserved for interactive requests
+    size_t interactiveSlots;       // slots of every other stream bulk batches may not occupy
+    uint32_t bulkMaxBatchDelayUs;  // max time the oldest bulk request waits for its batch to fill
+
+    PriorityConfig();
+};
+
+/**
+* HedgeConfig: when to duplicate slow requests
+*/
+struct HedgeConfig {
+    size_t percentile;  // a request slower than this percentile of the observed latency is duplicated, 0 disables
+    size_t budgetPct;   // duplicates are capped at this percentage of the requests
+
+    HedgeConfig();
+};
+
+/**
+* AutotuneConfig: startup sweep over the stream, slot and batch size settings of the default model
+*/
+struct AutotuneConfig {
+    bool enabled;                     // sweep when no result is stored for the device type and model
+    std::string resultPath;           // file results are stored in and reused from
+    size_t trialMs;                   // duration of one timed trial
+    size_t latencyMs;                 // p99 latency a configuration must meet, 0 means no limit
+    std::vector<size_t> streamNums;   // candidates of stream_num
+    std::vector<size_t> slotNums;     // candidates of slot_num
+    std::vector<size_t> batchSizes;   // candidates of max_batch_size
+
+    AutotuneConfig();
+};
+
+/**
+* FrameGateConfig: when a video frame reuses the result of the last executed frame of its stream
+*/
+struct FrameGateConfig {
+    float threshold;       // mean absolute difference of the downscaled luma, 0 to 255, below it the result is reused
+    size_t maxReuse;       // frames in a row that may reuse one result, 0 means no limit
+    size_t maxReuseMs;     // age of the reused result, 0 means no limit
+
+    FrameGateConfig();
+};
+
+/**
+* ResultCacheConfig: results kept for inputs seen before
+*/
+struct ResultCacheConfig {
+    size_t entries;  // results kept, least recently used ones are evicted, 0 disables the cache
+    size_t ttlMs;    // a result is not reused after this, 0 means no expiry
+
+    ResultCacheConfig();
+};
+
+/**
+* NearDuplicateConfig: when an image reuses the result of an earlier image with a similar perceptual hash
+*/
+struct NearDuplicateConfig {
+    size_t entries;      // hashes kept per model version, oldest ones are dropped, 0 disables the index
+    size_t maxDistance;  // differing bits of the 64 bit hashes, 0 to 64, up to which the result is reused
+
+    NearDuplicateConfig();
+};
+
+/**
+* EngineConfig: process wide settings, read from section [engine] of the sample config
+*/
+struct EngineConfig {
+    std::vector<int32_t> deviceIds;  // devices to run on, empty means every device found
+    std::vector<int32_t> numaNodes;  // NUMA node of each device in deviceIds, idle lanes steal within a node first
+    std::vector<int32_t> laneGroups; // compute group of each stream of a device, -1 or missing means no group
+    std::vector<std::string> models; // config sections of the served models, the first one is the default
+    size_t deviceMemBudgetMb;        // model memory per device, least recently used models are evicted, 0 no limit
+    PriorityConfig priority;
+    size_t defaultDeadlineMs;        // deadline of requests that have none, from Submit, 0 means none
+    HedgeConfig hedge;
+    std::string cpuBackend;          // CPU backend library, empty disables CPU execution
+    size_t cpuThreads;               // batches the CPU backend executes at once
+    AutotuneConfig autotune;
+    FrameGateConfig frameGate;
+    ResultCacheConfig resultCache;
+    NearDuplicateConfig nearDuplicate;
+
+    EngineConfig();
+
+    /**
+    * @brief load engine settings, keys missing in config keep their default value
+    * @param [in] config: parsed config file
+    * @return result
+    */
+    Result Load(const ConfigMap &config);
+};
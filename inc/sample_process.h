@@ -8,7 +8,12 @@
 * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 */
 #pragma once
+#include <future>
+#include <string>
+#include <vector>
 #include "utils.h"
+#include "infer_engine.h"
+#include "sample_config.h"
 #include "acl/acl.h"
 
 /**
@@ -39,10 +44,12 @@ public:
     Result Process();
 
 private:
+    Result LoadConfig();     //读取engine和各模型的配置
     void DestroyResource();  //资源销毁
 
-    int32_t deviceId_;		// 初始化 此示例未做其他调用
-    aclrtContext context_; 	// 初始化 此示例未做其他调用
-    aclrtStream stream_;	// 初始化 此示例未做其他调用
+    bool aclInited_;
+    EngineConfig engineConfig_;	// 使用哪些device 从配置文件读取
+    std::vector<ModelConfig> modelConfigs_;	// 各模型的路径 stream数 slot数 从配置文件读取
+    std::future<std::vector<InferRequestPtr>> inputs_;	// 与模型加载并行读取的输入
+    InferEngine engine_;		// 每个device一个DeviceWorker 请求分发到积压最少的device
 };
-
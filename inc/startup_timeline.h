@@ -0,0 +1,88 @@
+/**
+* @file startup_timeline.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+/**
+* StartupTimeline: start and end time of each startup stage, recorded from any thread,
+* reported as one table so overlapping stages and the critical path are visible
+*/
+class StartupTimeline {
+public:
+    /**
+    * @brief get the process wide timeline
+    * @return timeline
+    */
+    static StartupTimeline &Instance();
+
+    /**
+    * @brief set time zero, forget recorded stages and start recording
+    */
+    void Start();
+
+    /**
+    * @brief record one finished stage
+    * @param [in] name: stage name
+    * @param [in] begin: stage start time
+    * @param [in] end: stage end time
+    */
+    void Record(const std::string &name, std::chrono::steady_clock::time_point begin,
+        std::chrono::steady_clock::time_point end);
+
+    /**
+    * @brief log all stages ordered by start time, with a bar showing where each one ran, and stop recording
+    */
+    void Report();
+
+private:
+    struct Stage {
+        std::string name;
+        double beginMs;
+        double endMs;
+    };
+
+    StartupTimeline();
+
+    std::mutex mutex_;
+    std::chrono::steady_clock::time_point zero_;
+    std::vector<Stage> stages_;
+    bool recording_;
+};
+
+/**
+* TimelineStage: records the lifetime of the object as one stage of the startup timeline
+*/
+class TimelineStage {
+public:
+    /**
+    * @brief Constructor, the stage starts
+    * @param [in] name: stage name
+    */
+    explicit TimelineStage(const std::string &name);
+
+    /**
+    * @brief Destructor, the stage ends
+    */
+    ~TimelineStage();
+
+    /**
+    * @brief end the stage before the object goes out of scope
+    */
+    void End();
+
+private:
+    std::string name_;
+    std::chrono::steady_clock::time_point begin_;
+    bool ended_;
+};
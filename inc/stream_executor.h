@@ -0,0 +1,208 @@
+/**
+* @file stream_executor.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "utils.h"
+#include "callback_reporter.h"
+#include "infer_request.h"
+#include "model_context.h"
+#include "model_registry.h"
+#include "work_stealer.h"
+#include "acl/acl.h"
+
+class StreamExecutor;
+
+/**
+* ExecSlot: one in-flight execution on a stream
+*/
+struct ExecSlot {
+    StreamExecutor *owner;                  // passed to the completion callback with the slot
+    std::shared_ptr<ModelFamily> family;    // model of the batch in flight, kept alive until it completes
+    std::unique_ptr<ModelContext> context;  // buffers of this slot, bound to the variant of its batch
+    bool busy;                              // guarded by the owner mutex
+    bool bulk;                              // busy with a bulk batch, guarded by the owner mutex
+    InferBatchPtr batch;
+    std::vector<size_t> cascadeSources;     // position in the light model input of each sample to escalate
+
+    ExecSlot() : owner(nullptr), busy(false), bulk(false) {}
+};
+
+/**
+* StreamExecutor: one execution lane, a stream with its own slots, request queues and worker thread.
+* H2D copy, execute and D2H copy of several slots are pipelined on the stream. Completions are
+* delivered by a host callback on the device report thread, the worker thread never waits on the stream.
+* Each priority has its own queue, interactive batches are always taken first and bulk batches
+* may occupy a limited number of slots only. Requests that cannot finish before their deadline are
+* shed, and cancelled ones dropped, before their batch is uploaded.
+* A batch of a cascade keeps its slot after the light model completes, the samples it is not confident
+* about are executed by the full model on the input already in the slot.
+*/
+class StreamExecutor {
+public:
+    /**
+    * @brief Constructor
+    */
+    StreamExecutor();
+
+    /**
+    * @brief Destructor
+    */
+    ~StreamExecutor();
+
+    /**
+    * @brief create the stream and execution slots, must be called with context set current
+    * @param [in] registry: models of the device, each batch runs on the smallest variant of its model
+    * @param [in] defaultModel: model the slot buffers are sized for, they grow for larger models
+    * @param [in] reporter: report thread of the device, runs the completion callbacks
+    * @param [in] context: context of the device, set current in the worker thread
+    * @param [in] slotNum: number of in-flight executions, at least 2
+    * @return result
+    */
+    Result Init(ModelRegistry *registry, const ModelKey &defaultModel, CallbackReporter *reporter,
+        aclrtContext context, size_t slotNum);
+
+    /**
+    * @brief run warmup executions of every variant of a model in every slot on the stream, before Start.
+    * Must be called with the context set current.
+    * @param [in] model: model to warm up
+    * @param [in] policy: number of executions and when the latency counts as settled
+    * @param [out] results: latency of each slot and variant
+    * @return result
+    */
+    Result Warmup(const ModelKey &model, const WarmupPolicy &policy, std::vector<WarmupResult> &results);
+
+    /**
+    * @brief set how much of the lane bulk batches may use, must be called after Init and before Start
+    * @param [in] reserved: the lane is reserved for interactive batches, bulk batches only run on it
+    *                       one at a time when they are stolen while it is idle
+    * @param [in] reservedSlots: slots of a shared lane bulk batches may not occupy
+    */
+    void SetPriorityPolicy(bool reserved, size_t reservedSlots);
+
+    /**
+    * @brief start the worker thread
+    * @return result
+    */
+    Result Start();
+
+    /**
+    * @brief queue one batch, request callbacks are called from the device report thread
+    * @param [in] batch: requests of one model to execute together, no more than its largest variant batch size
+    * @return result
+    */
+    Result Enqueue(const InferBatchPtr &batch);
+
+    /**
+    * @brief let the lane take queued batches of other lanes when it is idle
+    * @param [in] stealer: lanes of the process, all registered already
+    */
+    void SetStealer(WorkStealer *stealer);
+
+    /**
+    * @brief get number of queued and in-flight requests
+    * @return outstanding request number
+    */
+    size_t GetOutstanding() const;
+
+    /**
+    * @brief get number of queued batches of one priority that are not uploaded yet
+    * @param [in] priority: request class
+    * @return queued batch number
+    */
+    size_t GetQueuedBatches(InferPriority priority) const;
+
+    /**
+    * @brief get the device time spent executing batches of this lane
+    * @return busy time in milliseconds
+    */
+    double GetBusyMs() const;
+
+    /**
+    * @brief take the newest queued batch of one priority, called by the stealer for an idle lane
+    * @param [in] thief: lane the batch moves to, its outstanding count is raised
+    * @param [in] priority: request class
+    * @return batch, nullptr if the queue is empty
+    */
+    InferBatchPtr StealBatch(StreamExecutor *thief, InferPriority priority);
+
+    /**
+    * @brief wake the worker thread so it can look for work to steal
+    */
+    void Wake();
+
+    /**
+    * @brief unbind idle slots from models evicted or replaced by a reload, must be called with the context set current
+    */
+    void ReleaseRetiredModels();
+
+    /**
+    * @brief block until all queued and in-flight requests are completed
+    */
+    void WaitIdle();
+
+    /**
+    * @brief finish outstanding requests and stop the worker thread
+    */
+    void Stop();
+
+    /**
+    * @brief stop and destroy all slots and the stream
+    */
+    void Destroy();
+
+private:
+    static void SlotCallback(void *userData);
+    static void RecordLane(const InferBatchPtr &batch, StreamExecutor *lane);
+
+    void Run();
+    Result Submit(ExecSlot &slot, const InferBatchPtr &batch);
+    Result Escalate(ExecSlot &slot);
+    Result LaunchCompletion(ExecSlot &slot, const InferBatchPtr &batch);
+    void CompleteSlot(ExecSlot &slot);
+    void CompleteCascadeStage(ExecSlot &slot);
+    void ReleaseSlot(ExecSlot &slot);
+    void FinishBatch(const InferBatchPtr &batch, const ModelContext *context);
+    void DropUnneededRequests(const InferBatchPtr &batch, double latencyMs);
+    ExecSlot *FindFreeSlot();
+    bool HasFreeSlot() const;
+    bool HasBusySlot() const;
+    bool HasQueuedBatch() const;
+    bool CanRunBulk() const;
+    InferPriority GetRunnablePriority() const;
+    bool CanSteal() const;
+
+    ModelRegistry *registry_;
+    CallbackReporter *reporter_;
+    aclrtContext context_;
+    aclrtStream stream_;
+    std::vector<ExecSlot> slots_;
+    size_t nextSlot_;  // free slots are searched from here, so slots are reused round robin
+
+    std::mutex mutex_;
+    std::condition_variable cond_;      // wakes the worker thread on a new batch or a released slot
+    std::condition_variable idleCond_;  // wakes WaitIdle
+    std::deque<InferBatchPtr> queues_[PRIORITY_NUM];  // own end at the front, stolen from the back
+    std::atomic<size_t> queuedBatches_[PRIORITY_NUM];  // sizes of queues_, read by other lanes without the lock
+    std::deque<ExecSlot *> cascades_;  // slots holding samples for the full model of a cascade
+    std::atomic<size_t> outstanding_;
+    std::atomic<uint64_t> busyUs_;  // device execution time of completed batches
+    bool reserved_;         // lane reserved for interactive batches
+    size_t bulkSlotLimit_;  // slots bulk batches may occupy at once
+    size_t bulkBusy_;       // slots busy with bulk batches
+    std::atomic<WorkStealer *> stealer_;
+    bool stop_;
+    std::thread thread_;
+};
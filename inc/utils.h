@@ -8,7 +8,12 @@
 * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 */
 #pragma once
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
 #define INFO_LOG(fmt, args...) fprintf(stdout, "[INFO]  " fmt "\n", ##args)
 #define WARN_LOG(fmt, args...) fprintf(stdout, "[WARN]  " fmt "\n", ##args)
@@ -19,6 +24,10 @@ typedef enum Result {
     FAILED = 1
 } Result;
 
+// key is "section.key", keys outside of any section have no prefix
+typedef std::map<std::string, std::string> ConfigMap;
+typedef std::pair<uint64_t, uint64_t> ImageSize;  // height, width
+
 /**
 * Utils
 */
@@ -39,6 +48,29 @@ public:
     * @return buffer of pic
     */
     static void* ReadBinFile(std::string fileName, uint32_t& fileSize);
+
+    /**
+    * @brief print the top n confidence values with indexes
+    * @param [in] scores: output scores of the model
+    * @param [in] topNum: number of values to print
+    */
+    static void PrintTopResult(const std::vector<float> &scores, size_t topNum);
+
+    /**
+    * @brief read file content to host memory
+    * @param [in] fileName: file name
+    * @param [out] data: content of file
+    * @return result
+    */
+    static Result ReadFileToHost(const std::string &fileName, std::vector<uint8_t> &data);
+
+    /**
+    * @brief read ini style config file, lines are "[section]" or "key = value", '#' starts a comment
+    * @param [in] fileName: file name
+    * @param [out] config: key value pairs
+    * @return result
+    */
+    static Result ReadConfigFile(const std::string &fileName, ConfigMap &config);
 };
 
 #pragma once
@@ -0,0 +1,69 @@
+/**
+* @file work_stealer.h
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#pragma once
+#include <vector>
+#include "utils.h"
+#include "infer_request.h"
+
+class StreamExecutor;
+
+/**
+* WorkStealer: lets an idle execution lane take queued, not yet uploaded batches from the
+* other lanes of the process, lanes on the same NUMA node first.
+* Lanes are registered once after every device is ready and the list is not changed while
+* lanes are running, so lookups need no lock.
+*/
+class WorkStealer {
+public:
+    /**
+    * @brief register one lane, must be called before any lane is given this stealer
+    * @param [in] lane: execution lane
+    * @param [in] numaNode: NUMA node of the device of the lane
+    */
+    void AddLane(StreamExecutor *lane, int32_t numaNode);
+
+    /**
+    * @brief whether another lane has a queued batch the thief could take
+    * @param [in] thief: idle lane
+    * @param [in] allowBulk: the thief may take bulk batches as well as interactive ones
+    * @return true if there is work to steal
+    */
+    bool HasBacklog(const StreamExecutor *thief, bool allowBulk) const;
+
+    /**
+    * @brief take the newest queued batch of the most loaded lane, interactive batches first,
+    * same NUMA node first
+    * @param [in] thief: idle lane, the batch is counted as its outstanding work
+    * @param [in] allowBulk: the thief may take bulk batches as well as interactive ones
+    * @return batch, nullptr if nothing could be taken
+    */
+    InferBatchPtr Steal(StreamExecutor *thief, bool allowBulk);
+
+    /**
+    * @brief wake the lanes other than the busy one, so idle lanes may steal from it
+    * @param [in] busy: lane with queued work
+    */
+    void NotifyBacklog(const StreamExecutor *busy);
+
+    /**
+    * @brief forget every lane, lanes must be stopped first
+    */
+    void Clear();
+
+private:
+    struct Lane {
+        StreamExecutor *executor;
+        int32_t numaNode;
+    };
+
+    int32_t GetNumaNode(const StreamExecutor *lane) const;
+
+    std::vector<Lane> lanes_;
+};
@@ -1,17 +1,31 @@
 import numpy as np
 import os
+import sys
 from PIL import Image
 
-def process(input_path):
+def select_bucket(width, height, buckets):
+    # bucket with the closest aspect ratio, then the closest area
+    ratio = float(width) / height
+    return min(buckets, key=lambda b: (abs(float(b[1]) / b[0] - ratio), abs(b[0] * b[1] - width * height)))
+
+def process(input_path, buckets=None):
     im = Image.open(input_path)
-    im = im.resize((256,256))
+    if buckets:
+        # dynamic hw model: resize to the bucket keeping the aspect ratio, crop the rest
+        bucket_h, bucket_w = select_bucket(im.size[0], im.size[1], buckets)
+        scale = max(float(bucket_w) / im.size[0], float(bucket_h) / im.size[1])
+        im = im.resize((max(bucket_w, int(round(im.size[0] * scale))), max(bucket_h, int(round(im.size[1] * scale)))))
+        crop_h, crop_w = bucket_h, bucket_w
+    else:
+        im = im.resize((256,256))
+        crop_h, crop_w = 224, 224
     # hwc
     img = np.array(im)
     height = img.shape[0]
     width = img.shape[1]
-    h_off = int((height-224)/2)
-    w_off = int((width-224)/2)
-    crop_img = img[h_off:height-h_off, w_off:width-w_off, :]
+    h_off = int((height-crop_h)/2)
+    w_off = int((width-crop_w)/2)
+    crop_img = img[h_off:h_off+crop_h, w_off:w_off+crop_w, :]
     # rgb to bgr
     img = crop_img[:,:,::-1]
     shape = img.shape
@@ -23,13 +37,20 @@ def process(input_path):
     result = img.transpose([0, 3, 1, 2])
 
     outputName = input_path.split('.')[0] + ".bin"
+    if buckets:
+        # the bucket is part of the name, InferRequest height and width must match it
+        outputName = "{}_{}x{}.bin".format(input_path.split('.')[0], crop_h, crop_w)
     result.tofile(outputName)
 
 if __name__ == "__main__":
+    # optional argument: resolution buckets of a dynamic hw model, e.g. 224x224,192x288,288x192
+    buckets = None
+    if len(sys.argv) > 1:
+        buckets = [tuple(int(v) for v in b.split('x')) for b in sys.argv[1].split(',')]
     images = os.listdir(r'./')
     for image_name in images:
         if not image_name.endswith("jpg"):
             continue
 
         print("start to process image {}....".format(image_name))
-        process(image_name)
+        process(image_name, buckets)
@@ -0,0 +1,285 @@
+/**
+* @file autotuner.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "autotuner.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include "infer_engine.h"
+#include "model_file_cache.h"
+#include "acl/acl.h"
+using namespace std;
+
+namespace {
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+const size_t WINDOW_FACTOR = 2;  // requests in flight per slot batch, keeps every slot busy
+const size_t P99 = 99;
+const size_t PERCENT = 100;
+
+string Sanitize(const string &value)
+{
+    // 结果文件中的section名不能含有'.'
+    string sanitized = value;
+    for (size_t i = 0; i < sanitized.size(); ++i) {
+        if (!isalnum(static_cast<unsigned char>(sanitized[i])) && (sanitized[i] != '-')) {
+            sanitized[i] = '_';
+        }
+    }
+    return sanitized;
+}
+
+bool GetSizeValue(const ConfigMap &config, const string &key, size_t &value)
+{
+    auto it = config.find(key);
+    if (it == config.end()) {
+        return false;
+    }
+    char *end = nullptr;
+    unsigned long parsed = strtoul(it->second.c_str(), &end, 10);
+    if ((end == it->second.c_str()) || (*end != '\0') || (parsed == 0)) {
+        return false;
+    }
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+}
+
+Autotuner::Autotuner()
+{
+}
+
+Result Autotuner::Tune(const EngineConfig &engineConfig, vector<ModelConfig> &modelConfigs)
+{
+    if (!engineConfig.autotune.enabled || modelConfigs.empty()) {
+        return SUCCESS;
+    }
+    const string &path = engineConfig.autotune.resultPath;
+    string key = GetTuneKey(modelConfigs[0]);
+    TuneResult result;
+    if (LoadResult(path, key, result)) {
+        INFO_LOG("reuse autotune result %s from %s", key.c_str(), path.c_str());
+    } else {
+        INFO_LOG("no autotune result %s in %s, start sweep", key.c_str(), path.c_str());
+        if (Sweep(engineConfig, modelConfigs, result) != SUCCESS) {
+            WARN_LOG("autotune found no setting within %zu ms p99, keep the configured one",
+                engineConfig.autotune.latencyMs);
+            return SUCCESS;
+        }
+        if (SaveResult(path, key, result) != SUCCESS) {
+            WARN_LOG("save autotune result to %s failed, the next start sweeps again", path.c_str());
+        }
+    }
+    ModelConfig &config = modelConfigs[0];
+    config.streamNum = result.streamNum;
+    config.slotNum = result.slotNum;
+    config.maxBatchSize = result.maxBatchSize;
+    INFO_LOG("autotune: model %s runs %zu streams, %zu slots per stream, batch %zu (%.1f requests/s, p99 %.2f ms)",
+        config.name.c_str(), config.streamNum, config.slotNum, config.maxBatchSize, result.throughput,
+        result.p99Ms);
+    return SUCCESS;
+}
+
+string Autotuner::GetTuneKey(const ModelConfig &config) const
+{
+    // 结果按芯片型号和模型文件内容区分 换卡或换模型后重新调优
+    const char *socName = aclrtGetSocName();
+    vector<string> paths = config.variantPaths;
+    if (paths.empty()) {
+        paths.push_back(config.modelPath);
+    }
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        ModelFileData data = ModelFileCache::Instance().Get(paths[i]);
+        vector<uint8_t> content;
+        if ((data == nullptr) && (Utils::ReadFileToHost(paths[i], content) == SUCCESS)) {
+            data = make_shared<const vector<uint8_t>>(move(content));
+        }
+        if (data == nullptr) {
+            WARN_LOG("read model file %s failed, it is not part of the autotune key", paths[i].c_str());
+            continue;
+        }
+        for (size_t j = 0; j < data->size(); ++j) {
+            hash = (hash ^ (*data)[j]) * FNV_PRIME;
+        }
+    }
+    char hashText[17] = {0};
+    (void)snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(hash));
+    return Sanitize((socName != nullptr) ? socName : "unknown") + "_" + Sanitize(config.name) + "_" +
+        Sanitize(config.version) + "_" + hashText;
+}
+
+bool Autotuner::LoadResult(const string &path, const string &key, TuneResult &result) const
+{
+    ConfigMap config;
+    if (!ifstream(path).good() || (Utils::ReadConfigFile(path, config) != SUCCESS)) {
+        return false;
+    }
+    return GetSizeValue(config, key + ".stream_num", result.streamNum) &&
+        GetSizeValue(config, key + ".slot_num", result.slotNum) &&
+        GetSizeValue(config, key + ".max_batch_size", result.maxBatchSize);
+}
+
+Result Autotuner::SaveResult(const string &path, const string &key, const TuneResult &result) const
+{
+    // 保留文件中其他设备和模型的结果
+    ConfigMap config;
+    if (ifstream(path).good() && (Utils::ReadConfigFile(path, config) != SUCCESS)) {
+        config.clear();
+    }
+    config[key + ".stream_num"] = to_string(result.streamNum);
+    config[key + ".slot_num"] = to_string(result.slotNum);
+    config[key + ".max_batch_size"] = to_string(result.maxBatchSize);
+    config[key + ".throughput"] = to_string(result.throughput);
+    config[key + ".p99_ms"] = to_string(result.p99Ms);
+
+    ofstream file(path, ios::trunc);
+    if (!file.is_open()) {
+        ERROR_LOG("open autotune result file %s failed", path.c_str());
+        return FAILED;
+    }
+    file << "# autotune results, one section per device type, model and model file hash" << endl;
+    string section;
+    for (auto it = config.begin(); it != config.end(); ++it) {
+        size_t dot = it->first.find('.');
+        if (dot == string::npos) {
+            continue;
+        }
+        if (it->first.compare(0, dot, section) != 0) {
+            section = it->first.substr(0, dot);
+            file << endl << "[" << section << "]" << endl;
+        }
+        file << it->first.substr(dot + 1) << " = " << it->second << endl;
+    }
+    INFO_LOG("autotune result %s saved to %s", key.c_str(), path.c_str());
+    return file.good() ? SUCCESS : FAILED;
+}
+
+Result Autotuner::Sweep(const EngineConfig &engineConfig, const vector<ModelConfig> &modelConfigs,
+    TuneResult &best) const
+{
+    const AutotuneConfig &autotune = engineConfig.autotune;
+    // 依次扫描batch大小 stream数 slot数 每一项取最优值后固定 再扫描下一项
+    const vector<size_t> *candidates[] = { &autotune.batchSizes, &autotune.streamNums, &autotune.slotNums };
+    size_t TuneResult::*fields[] = { &TuneResult::maxBatchSize, &TuneResult::streamNum, &TuneResult::slotNum };
+    TuneResult current;
+    current.streamNum = modelConfigs[0].streamNum;
+    current.slotNum = modelConfigs[0].slotNum;
+    current.maxBatchSize = modelConfigs[0].maxBatchSize;
+
+    bool found = false;
+    map<vector<size_t>, TuneResult> tried;
+    for (size_t p = 0; p < sizeof(fields) / sizeof(fields[0]); ++p) {
+        size_t chosen = current.*fields[p];
+        for (size_t i = 0; i < candidates[p]->size(); ++i) {
+            TuneResult trial = current;
+            trial.*fields[p] = (*candidates[p])[i];
+            vector<size_t> setting = { trial.streamNum, trial.slotNum, trial.maxBatchSize };
+            if (tried.count(setting) > 0) {
+                trial = tried[setting];
+            } else {
+                if (RunTrial(engineConfig, modelConfigs, trial) != SUCCESS) {
+                    WARN_LOG("autotune trial of %zu streams, %zu slots, batch %zu failed", trial.streamNum,
+                        trial.slotNum, trial.maxBatchSize);
+                    continue;
+                }
+                tried[setting] = trial;
+                INFO_LOG("autotune trial: %zu streams, %zu slots, batch %zu: %.1f requests/s, p99 %.2f ms",
+                    trial.streamNum, trial.slotNum, trial.maxBatchSize, trial.throughput, trial.p99Ms);
+            }
+            bool withinLimit = (autotune.latencyMs == 0) || (trial.p99Ms <= autotune.latencyMs);
+            if (withinLimit && (!found || (trial.throughput > best.throughput))) {
+                best = trial;
+                found = true;
+                chosen = trial.*fields[p];
+            }
+        }
+        current.*fields[p] = chosen;
+    }
+    return found ? SUCCESS : FAILED;
+}
+
+Result Autotuner::RunTrial(const EngineConfig &engineConfig, vector<ModelConfig> modelConfigs,
+    TuneResult &trial) const
+{
+    modelConfigs[0].streamNum = trial.streamNum;
+    modelConfigs[0].slotNum = trial.slotNum;
+    modelConfigs[0].maxBatchSize = trial.maxBatchSize;
+    // 对冲会重复执行请求 缓存会让相同的全零输入不再执行 试运行时都关闭
+    EngineConfig config = engineConfig;
+    config.hedge.percentile = 0;
+    config.resultCache.entries = 0;
+    InferEngine engine;
+    if (engine.Init(config, modelConfigs) != SUCCESS) {
+        return FAILED;
+    }
+    ModelKey model;
+    vector<ImageSize> imageSizes = engine.GetImageSizes(model);
+    ImageSize imageSize = imageSizes.empty() ? ImageSize(0, 0) : imageSizes[0];
+    vector<uint8_t> input(engine.GetSampleInputSize(model, imageSize), 0);
+    if (input.empty()) {
+        return FAILED;
+    }
+
+    // 保持足够多的请求在途 使所有stream的所有slot都有满batch可执行
+    size_t window = WINDOW_FACTOR * max(engine.GetLaneCount(), static_cast<size_t>(1)) * trial.slotNum *
+        trial.maxBatchSize;
+    mutex latencyMutex;
+    condition_variable cond;
+    size_t inflight = 0;
+    vector<double> latencies;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point end = start + chrono::milliseconds(engineConfig.autotune.trialMs);
+    Result ret = SUCCESS;
+    while (chrono::steady_clock::now() < end) {
+        {
+            unique_lock<mutex> lock(latencyMutex);
+            if (!cond.wait_until(lock, end, [&inflight, window] { return inflight < window; })) {
+                break;
+            }
+            ++inflight;
+        }
+        InferRequestPtr request(new InferRequest());
+        request->input = input;
+        request->height = imageSize.first;
+        request->width = imageSize.second;
+        chrono::steady_clock::time_point submitTime = chrono::steady_clock::now();
+        request->callback = [&latencyMutex, &cond, &inflight, &latencies, submitTime](const InferResult &result) {
+            lock_guard<mutex> lock(latencyMutex);
+            --inflight;
+            if (result.ret == SUCCESS) {
+                latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - submitTime).count());
+            }
+            cond.notify_one();
+        };
+        if (engine.Submit(request) != SUCCESS) {
+            lock_guard<mutex> lock(latencyMutex);
+            --inflight;
+            ret = FAILED;
+            break;
+        }
+    }
+    engine.WaitIdle();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    engine.Destroy();
+    if ((ret != SUCCESS) || latencies.empty()) {
+        return FAILED;
+    }
+    trial.throughput = latencies.size() / seconds;
+    size_t index = latencies.size() * P99 / PERCENT;
+    nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+    trial.p99Ms = latencies[index];
+    return SUCCESS;
+}
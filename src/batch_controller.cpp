@@ -0,0 +1,133 @@
+/**
+* @file batch_controller.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "batch_controller.h"
+#include <algorithm>
+using namespace std;
+
+namespace {
+const chrono::milliseconds CONTROL_PERIOD(250);  // limits are adjusted at most this often
+const size_t MIN_PERIOD_SAMPLES = 20;            // and only with this many latencies measured
+const double HEADROOM = 0.2;                     // the batch grows only while p99 is this far below target
+const double RATE_SMOOTHING = 0.5;               // weight of the newest arrival rate
+const size_t P99 = 99;
+const size_t PERCENT = 100;
+const double US_PER_MS = 1000.0;
+const double US_PER_SEC = 1000000.0;
+}
+
+BatchController::BatchController()
+{
+}
+
+void BatchController::AddModel(const ModelKey &model, double targetMs, size_t maxBatchSize, uint32_t maxDelayUs,
+    const shared_ptr<const VariantSelector> &selector)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (states_.count(model) > 0) {
+        return;
+    }
+    // 先沿用静态配置 再按实测时延收缩或扩大
+    ControlState &state = states_[model];
+    state.stats.model = model;
+    state.stats.batchSize = max(maxBatchSize, static_cast<size_t>(1));
+    state.stats.delayUs = maxDelayUs;
+    state.stats.targetMs = targetMs;
+    state.maxBatchSize = state.stats.batchSize;
+    state.maxDelayUs = maxDelayUs;
+    state.selector = selector;
+    state.periodStart = chrono::steady_clock::now();
+    INFO_LOG("control batching of model %s version %s for p99 %.1f ms, batch up to %zu within %u us",
+        model.name.c_str(), model.version.c_str(), targetMs, state.maxBatchSize, maxDelayUs);
+}
+
+void BatchController::RecordArrival(const ModelKey &model)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = states_.find(model);
+    if (it != states_.end()) {
+        ++it->second.arrivals;
+    }
+}
+
+void BatchController::RecordLatency(const ModelKey &model, double ms)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = states_.find(model);
+    if (it == states_.end()) {
+        return;
+    }
+    ControlState &state = it->second;
+    state.latencies.push_back(ms);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if ((now - state.periodStart >= CONTROL_PERIOD) && (state.latencies.size() >= MIN_PERIOD_SAMPLES)) {
+        Adjust(state, now);
+    }
+}
+
+void BatchController::Adjust(ControlState &state, chrono::steady_clock::time_point now)
+{
+    BatchControlStats &stats = state.stats;
+    double seconds = chrono::duration<double>(now - state.periodStart).count();
+    double rate = state.arrivals / seconds;
+    stats.arrivalRate = (stats.arrivalRate <= 0.0) ? rate : (stats.arrivalRate +
+        RATE_SMOOTHING * (rate - stats.arrivalRate));
+    size_t index = state.latencies.size() * P99 / PERCENT;
+    nth_element(state.latencies.begin(), state.latencies.begin() + index, state.latencies.end());
+    stats.p99Ms = state.latencies[index];
+
+    // 超出目标时batch减半 有余量且更大的batch执行时间仍在目标内时加一
+    if (stats.p99Ms > stats.targetMs) {
+        if (stats.batchSize > 1) {
+            stats.batchSize /= 2;
+            ++stats.decreases;
+        }
+    } else if ((stats.p99Ms < stats.targetMs * (1.0 - HEADROOM)) && (stats.batchSize < state.maxBatchSize)) {
+        double nextExecMs = state.selector->GetLatency(stats.batchSize + 1);
+        if (nextExecMs < stats.targetMs * (1.0 - HEADROOM)) {
+            ++stats.batchSize;
+            ++stats.increases;
+        }
+    }
+
+    // 等待时间取按到达率凑满batch所需的时间 最多用掉执行之外剩余时延的一半 留给排队
+    stats.execMs = state.selector->GetLatency(stats.batchSize);
+    double delayUs = state.maxDelayUs;
+    if (stats.arrivalRate > 0.0) {
+        delayUs = min(delayUs, (stats.batchSize - 1) * US_PER_SEC / stats.arrivalRate);
+    }
+    delayUs = min(delayUs, max(0.0, (stats.targetMs - stats.execMs) * US_PER_MS / 2));
+    stats.delayUs = static_cast<uint32_t>(delayUs);
+
+    state.arrivals = 0;
+    state.latencies.clear();
+    state.periodStart = now;
+}
+
+bool BatchController::GetLimits(const ModelKey &model, size_t &batchSize, uint32_t &delayUs) const
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = states_.find(model);
+    if (it == states_.end()) {
+        return false;
+    }
+    batchSize = it->second.stats.batchSize;
+    delayUs = it->second.stats.delayUs;
+    return true;
+}
+
+vector<BatchControlStats> BatchController::GetStats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    vector<BatchControlStats> stats;
+    for (auto it = states_.begin(); it != states_.end(); ++it) {
+        stats.push_back(it->second.stats);
+    }
+    return stats;
+}
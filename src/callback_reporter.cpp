@@ -0,0 +1,78 @@
+/**
+* @file callback_reporter.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "callback_reporter.h"
+using namespace std;
+
+namespace {
+const int32_t PROCESS_REPORT_TIMEOUT_MS = 100;  // how often the stop flag is checked
+}
+
+CallbackReporter::CallbackReporter() : context_(nullptr), stop_(false)
+{
+}
+
+CallbackReporter::~CallbackReporter()
+{
+    Stop();
+}
+
+Result CallbackReporter::Start(aclrtContext context)
+{
+    if ((context == nullptr) || thread_.joinable()) {
+        ERROR_LOG("context is null or report thread already started");
+        return FAILED;
+    }
+    context_ = context;
+    stop_ = false;
+    thread_ = thread(&CallbackReporter::Run, this);
+    return SUCCESS;
+}
+
+Result CallbackReporter::Subscribe(aclrtStream stream)
+{
+    // 订阅时使用的线程id就是处理回调的线程
+    uint64_t threadId = static_cast<uint64_t>(thread_.native_handle());
+    aclError ret = aclrtSubscribeReport(threadId, stream);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("subscribe report failed, ret[%d]", ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+void CallbackReporter::Unsubscribe(aclrtStream stream)
+{
+    uint64_t threadId = static_cast<uint64_t>(thread_.native_handle());
+    aclError ret = aclrtUnSubscribeReport(threadId, stream);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("unsubscribe report failed, ret[%d]", ret);
+    }
+}
+
+void CallbackReporter::Run()
+{
+    aclError ret = aclrtSetCurrentContext(context_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("set current context failed, ret[%d]", ret);
+    }
+    while (!stop_) {
+        // 超时返回是正常情况 没有回调时只是定期检查退出标志
+        (void)aclrtProcessReport(PROCESS_REPORT_TIMEOUT_MS);
+    }
+}
+
+void CallbackReporter::Stop()
+{
+    stop_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    context_ = nullptr;
+}
@@ -0,0 +1,325 @@
+/**
+* @file cpu_executor.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "cpu_executor.h"
+#include <dlfcn.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+using namespace std;
+
+namespace {
+const double LATENCY_SMOOTHING = 0.2;  // weight of the newest measurement
+}
+
+CpuExecutor::CpuExecutor() : library_(nullptr), loadModel_(nullptr), execute_(nullptr), unloadModel_(nullptr),
+    threadNum_(0), outstanding_(0), stop_(false)
+{
+}
+
+CpuExecutor::~CpuExecutor()
+{
+    Destroy();
+}
+
+Result CpuExecutor::Init(const string &pluginPath, size_t threadNum, const shared_ptr<const ModelCatalog> &catalog)
+{
+    if ((threadNum == 0) || (catalog == nullptr) || (library_ != nullptr)) {
+        ERROR_LOG("cpu thread num is 0 or catalog is null, or cpu executor already initialized");
+        return FAILED;
+    }
+    library_ = dlopen(pluginPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library_ == nullptr) {
+        ERROR_LOG("load cpu backend %s failed, %s", pluginPath.c_str(), dlerror());
+        return FAILED;
+    }
+    CpuBackendGetVersionFunc getVersion =
+        reinterpret_cast<CpuBackendGetVersionFunc>(dlsym(library_, CPU_BACKEND_SYMBOL_GET_VERSION));
+    loadModel_ = reinterpret_cast<CpuBackendLoadModelFunc>(dlsym(library_, CPU_BACKEND_SYMBOL_LOAD_MODEL));
+    execute_ = reinterpret_cast<CpuBackendExecuteFunc>(dlsym(library_, CPU_BACKEND_SYMBOL_EXECUTE));
+    unloadModel_ = reinterpret_cast<CpuBackendUnloadModelFunc>(dlsym(library_, CPU_BACKEND_SYMBOL_UNLOAD_MODEL));
+    if ((getVersion == nullptr) || (loadModel_ == nullptr) || (execute_ == nullptr) || (unloadModel_ == nullptr)) {
+        ERROR_LOG("cpu backend %s does not export the backend functions", pluginPath.c_str());
+        Destroy();
+        return FAILED;
+    }
+    int32_t version = getVersion();
+    if (version != CPU_BACKEND_ABI_VERSION) {
+        ERROR_LOG("cpu backend %s implements version %d, %d is required", pluginPath.c_str(), version,
+            CPU_BACKEND_ABI_VERSION);
+        Destroy();
+        return FAILED;
+    }
+
+    catalog_ = catalog;
+    threadNum_ = threadNum;
+    stop_ = false;
+    for (size_t i = 0; i < threadNum_; ++i) {
+        threads_.push_back(thread(&CpuExecutor::Run, this));
+    }
+    INFO_LOG("cpu backend %s started with %zu threads", pluginPath.c_str(), threadNum_);
+    return SUCCESS;
+}
+
+bool CpuExecutor::IsEnabled() const
+{
+    return library_ != nullptr;
+}
+
+Result CpuExecutor::GetModelInfo(const ModelKey &key, CpuBackendModelInfo &info)
+{
+    shared_ptr<CpuModel> model;
+    if (LoadModel(key, model) != SUCCESS) {
+        return FAILED;
+    }
+    info = model->info;
+    return SUCCESS;
+}
+
+Result CpuExecutor::LoadModel(const ModelKey &key, shared_ptr<CpuModel> &model)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto it = models_.find(key);
+        if (it != models_.end()) {
+            model = it->second;
+            return SUCCESS;
+        }
+    }
+    if (catalog_ == nullptr) {
+        return FAILED;
+    }
+    auto entry = catalog_->find(key);
+    if ((entry == catalog_->end()) || entry->second.config.cpuModelPath.empty()) {
+        return FAILED;
+    }
+
+    lock_guard<mutex> loadLock(loadMutex_);
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto it = models_.find(key);
+        if (it != models_.end()) {
+            model = it->second;
+            return SUCCESS;
+        }
+    }
+    const string &path = entry->second.config.cpuModelPath;
+    shared_ptr<CpuModel> loaded(new CpuModel());
+    if ((loadModel_(path.c_str(), &loaded->handle, &loaded->info) != 0) || (loaded->handle == nullptr) ||
+        (loaded->info.sampleInputSize == 0)) {
+        ERROR_LOG("cpu backend load model %s failed", path.c_str());
+        return FAILED;
+    }
+    // 用一个全零的batch执行一次 得到每个样本的执行时间 用于和device分配请求
+    size_t batchSize = entry->second.config.maxBatchSize;
+    if (loaded->info.maxBatchSize > 0) {
+        batchSize = min(batchSize, loaded->info.maxBatchSize);
+    }
+    InferBatchPtr warmup(new InferBatch());
+    for (size_t i = 0; i < batchSize; ++i) {
+        warmup->requests.push_back(InferRequestPtr(new InferRequest()));
+    }
+    vector<float> output;
+    double ms = 0.0;
+    if (Execute(*loaded, warmup, output, ms) != SUCCESS) {
+        ERROR_LOG("cpu backend warmup of model %s failed", path.c_str());
+        unloadModel_(loaded->handle);
+        return FAILED;
+    }
+    INFO_LOG("cpu backend loaded model %s, batch %zu in %.2f ms per sample", path.c_str(), batchSize,
+        loaded->msPerSample);
+
+    lock_guard<mutex> lock(mutex_);
+    models_[key] = loaded;
+    model = loaded;
+    return SUCCESS;
+}
+
+double CpuExecutor::EstimateCompletionMs(const ModelKey &key, size_t batchSize) const
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = models_.find(key);
+    if ((it == models_.end()) || (threadNum_ == 0)) {
+        return 0.0;
+    }
+    // 积压的样本由所有线程分担 本batch在一个线程上执行
+    double msPerSample = it->second->msPerSample;
+    return (static_cast<double>(outstanding_) / threadNum_ + batchSize) * msPerSample;
+}
+
+Result CpuExecutor::Enqueue(const InferBatchPtr &batch)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (stop_ || threads_.empty() || (models_.count(batch->model) == 0)) {
+            ERROR_LOG("cpu executor is not running or model %s is not loaded on it", batch->model.name.c_str());
+            return FAILED;
+        }
+        queue_.push_back(batch);
+        outstanding_ += batch->requests.size();
+    }
+    cond_.notify_one();
+    return SUCCESS;
+}
+
+void CpuExecutor::Run()
+{
+    while (true) {
+        InferBatchPtr batch;
+        shared_ptr<CpuModel> model;
+        {
+            unique_lock<mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;
+            }
+            batch = queue_.front();
+            queue_.pop_front();
+            model = models_[batch->model];
+        }
+        size_t batchSize = batch->requests.size();
+        DropUnneededRequests(batch);
+        vector<float> output;
+        double ms = 0.0;
+        Result ret = batch->requests.empty() ? SUCCESS : Execute(*model, batch, output, ms);
+        FinishBatch(batch, (ret == SUCCESS) ? model.get() : nullptr, output);
+        {
+            lock_guard<mutex> lock(mutex_);
+            outstanding_ -= batchSize;
+            if ((ret == SUCCESS) && !batch->requests.empty()) {
+                ++stats_.batches;
+                stats_.samples += batch->requests.size();
+                stats_.busyMs += ms;
+            }
+        }
+        idleCond_.notify_all();
+    }
+}
+
+Result CpuExecutor::Execute(CpuModel &model, const InferBatchPtr &batch, vector<float> &output, double &ms)
+{
+    // 各样本依次放到输入的对应位置 不足一个样本的部分补零
+    size_t batchSize = batch->requests.size();
+    size_t sampleSize = model.info.sampleInputSize;
+    vector<uint8_t> input(batchSize * sampleSize, 0);
+    for (size_t i = 0; i < batchSize; ++i) {
+        if (batch->requests[i]->writer) {
+            if (batch->requests[i]->writer(input.data() + i * sampleSize, sampleSize) != SUCCESS) {
+                return FAILED;
+            }
+            continue;
+        }
+        const vector<uint8_t> &sample = batch->requests[i]->input;
+        if (sample.size() > sampleSize) {
+            ERROR_LOG("input size %zu exceeds cpu model sample input size %zu", sample.size(), sampleSize);
+            return FAILED;
+        }
+        if (!sample.empty()) {
+            memcpy(input.data() + i * sampleSize, sample.data(), sample.size());
+        }
+    }
+    output.assign(batchSize * model.info.sampleOutputNum, 0.0f);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (execute_(model.handle, input.data(), batchSize, output.data()) != 0) {
+        ERROR_LOG("cpu backend execute batch of %zu failed", batchSize);
+        return FAILED;
+    }
+    ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    lock_guard<mutex> lock(mutex_);
+    double msPerSample = ms / batchSize;
+    if (model.msPerSample <= 0.0) {
+        model.msPerSample = msPerSample;
+    } else {
+        model.msPerSample += LATENCY_SMOOTHING * (msPerSample - model.msPerSample);
+    }
+    return SUCCESS;
+}
+
+void CpuExecutor::DropUnneededRequests(const InferBatchPtr &batch)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    vector<InferRequestPtr> live;
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        if (IsCancelled(batch->requests[i])) {
+            CancelRequest(batch->requests[i]);
+        } else if (batch->requests[i]->deadline <= now) {
+            ShedRequest(batch->requests[i]);
+        } else {
+            live.push_back(batch->requests[i]);
+        }
+    }
+    batch->requests.swap(live);
+}
+
+void CpuExecutor::FinishBatch(const InferBatchPtr &batch, const CpuModel *model, const vector<float> &output)
+{
+    // model为空表示执行失败 否则按batch顺序把各样本的结果分发给对应请求
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        InferResult result;
+        if (model != nullptr) {
+            size_t outputNum = model->info.sampleOutputNum;
+            result.ret = SUCCESS;
+            result.scores.assign(output.begin() + i * outputNum, output.begin() + (i + 1) * outputNum);
+        }
+        if (batch->requests[i]->callback) {
+            batch->requests[i]->callback(result);
+        }
+    }
+}
+
+size_t CpuExecutor::GetOutstanding() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return outstanding_;
+}
+
+CpuStats CpuExecutor::GetStats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+void CpuExecutor::WaitIdle()
+{
+    unique_lock<mutex> lock(mutex_);
+    idleCond_.wait(lock, [this] { return outstanding_ == 0; });
+}
+
+void CpuExecutor::Stop()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        threads_[i].join();
+    }
+    threads_.clear();
+}
+
+void CpuExecutor::Destroy()
+{
+    Stop();
+    for (auto it = models_.begin(); it != models_.end(); ++it) {
+        unloadModel_(it->second->handle);
+    }
+    models_.clear();
+    if (library_ != nullptr) {
+        (void)dlclose(library_);
+        library_ = nullptr;
+    }
+    loadModel_ = nullptr;
+    execute_ = nullptr;
+    unloadModel_ = nullptr;
+    catalog_.reset();
+    threadNum_ = 0;
+}
@@ -0,0 +1,415 @@
+/**
+* @file device_worker.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "device_worker.h"
+#include <algorithm>
+#include <map>
+#include "startup_timeline.h"
+using namespace std;
+
+namespace {
+const int32_t NO_GROUP = -1;
+}
+
+DeviceWorker::DeviceWorker() : deviceId_(0), deviceOpened_(false), context_(nullptr), interactiveStreams_(0),
+    nextExecutor_(0)
+{
+}
+
+DeviceWorker::~DeviceWorker()
+{
+    Destroy();
+}
+
+Result DeviceWorker::Init(int32_t deviceId, const shared_ptr<const ModelCatalog> &catalog,
+    const ModelKey &defaultModel, size_t memBudget, const PriorityConfig &priority, const vector<int32_t> &laneGroups)
+{
+    deviceId_ = deviceId;
+    string stagePrefix = "device " + to_string(deviceId_) + ": ";
+    TimelineStage openStage(stagePrefix + "open device");
+    aclError ret = aclrtSetDevice(deviceId_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("acl open device %d failed", deviceId_);
+        return FAILED;
+    }
+    deviceOpened_ = true;
+    INFO_LOG("open device %d success", deviceId_);
+    openStage.End();
+
+    // 显式创建context 各个executor线程都绑定到这个context
+    ret = aclrtCreateContext(&context_, deviceId_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("acl create context failed, device is %d", deviceId_);
+        return FAILED;
+    }
+
+    // 所有stream的完成回调都在这一个线程里处理
+    if (reporter_.Start(context_) != SUCCESS) {
+        return FAILED;
+    }
+
+    // 默认模型在初始化时加载 其他模型在第一次请求时加载 淘汰模型后空闲slot解除绑定 内存才能释放
+    registry_.SetRetireHandler([this]() { ReleaseRetiredModels(); });
+    TimelineStage loadStage(stagePrefix + "load default model");
+    auto entry = catalog->find(defaultModel);
+    if ((entry == catalog->end()) || (registry_.Init(context_, catalog, memBudget) != SUCCESS) ||
+        (registry_.Acquire(defaultModel) == nullptr)) {
+        ERROR_LOG("load model on device %d failed", deviceId_);
+        return FAILED;
+    }
+    const ModelConfig &modelConfig = entry->second.config;
+    loadStage.End();
+
+    // 每个stream一个executor 各自拥有slot和输入输出 模型只加载一次
+    // 绑定了计算分组的stream在该分组的context中创建 其任务只使用该分组的AI core
+    TimelineStage executorStage(stagePrefix + "create streams and slots");
+    if (CreateGroupContexts(laneGroups, modelConfig.streamNum) != SUCCESS) {
+        return FAILED;
+    }
+    for (size_t i = 0; i < modelConfig.streamNum; ++i) {
+        unique_ptr<StreamExecutor> executor(new StreamExecutor());
+        aclrtContext laneContext = GetLaneContext(i);
+        if ((aclrtSetCurrentContext(laneContext) != ACL_ERROR_NONE) ||
+            (executor->Init(&registry_, defaultModel, &reporter_, laneContext, modelConfig.slotNum) != SUCCESS)) {
+            ERROR_LOG("create executor %zu on device %d failed", i, deviceId_);
+            return FAILED;
+        }
+        executors_.push_back(move(executor));
+    }
+    executorStage.End();
+
+    // 所有slot预热且时延稳定后 executor才开始接收请求
+    TimelineStage warmupStage(stagePrefix + "warmup");
+    vector<WarmupResult> warmup;
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        vector<WarmupResult> results;
+        (void)aclrtSetCurrentContext(GetLaneContext(i));
+        if (executors_[i]->Warmup(defaultModel, entry->second.GetWarmupPolicy(), results) != SUCCESS) {
+            ERROR_LOG("warm up executor %zu on device %d failed", i, deviceId_);
+            return FAILED;
+        }
+        warmup.insert(warmup.end(), results.begin(), results.end());
+    }
+    SetWarmupBaseline(warmup);
+    warmupStage.End();
+    (void)aclrtSetCurrentContext(context_);
+
+    // 前interactiveStreams个stream预留给交互请求 全部预留时批量请求也可以使用所有stream
+    interactiveStreams_ = min(priority.interactiveStreams, executors_.size());
+    if (interactiveStreams_ == executors_.size()) {
+        WARN_LOG("all %zu streams of device %d are reserved for interactive requests", executors_.size(),
+            deviceId_);
+    }
+    startTime_ = chrono::steady_clock::now();
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        executors_[i]->SetPriorityPolicy(i < interactiveStreams_, priority.interactiveSlots);
+        if (executors_[i]->Start() != SUCCESS) {
+            ERROR_LOG("start executor %zu on device %d failed", i, deviceId_);
+            return FAILED;
+        }
+    }
+
+    INFO_LOG("device %d ready with %zu streams", deviceId_, executors_.size());
+    return SUCCESS;
+}
+
+void DeviceWorker::SetWarmupBaseline(const vector<WarmupResult> &results)
+{
+    // 各slot的结果按变体汇总 首次时延取最大 稳定时延取平均
+    map<size_t, WarmupResult> baseline;
+    map<size_t, size_t> counts;
+    for (size_t i = 0; i < results.size(); ++i) {
+        WarmupResult &variant = baseline[results[i].batchSize];
+        bool first = (counts[results[i].batchSize]++ == 0);
+        variant.batchSize = results[i].batchSize;
+        variant.iterations += results[i].iterations;
+        variant.firstMs = max(variant.firstMs, results[i].firstMs);
+        variant.steadyMs += results[i].steadyMs;
+        variant.stable = (first || variant.stable) && results[i].stable;
+    }
+    baseline_.clear();
+    for (auto it = baseline.begin(); it != baseline.end(); ++it) {
+        it->second.steadyMs /= counts[it->first];
+        baseline_.push_back(it->second);
+        INFO_LOG("device %d warmup baseline: batch %zu, %zu runs, first %.2f ms, steady %.2f ms%s", deviceId_,
+            it->second.batchSize, it->second.iterations, it->second.firstMs, it->second.steadyMs,
+            it->second.stable ? "" : ", not settled");
+        if (!it->second.stable) {
+            WARN_LOG("device %d: latency of batch %zu did not settle within warmup_max_iterations", deviceId_,
+                it->second.batchSize);
+        }
+    }
+}
+
+Result DeviceWorker::CreateGroupContexts(const vector<int32_t> &laneGroups, size_t laneNum)
+{
+    laneGroups_.assign(laneNum, NO_GROUP);
+    bool grouped = false;
+    for (size_t i = 0; (i < laneNum) && (i < laneGroups.size()); ++i) {
+        grouped = grouped || (laneGroups[i] != NO_GROUP);
+    }
+    if (!grouped) {
+        return SUCCESS;
+    }
+    // 分组数为0表示device不支持或没有创建计算分组 此时所有stream共用设备context
+    uint32_t groupCount = 0;
+    aclError ret = aclrtGetGroupCount(&groupCount);
+    if ((ret != ACL_ERROR_NONE) || (groupCount == 0)) {
+        WARN_LOG("device %d has no compute groups, lane_groups is ignored, ret[%d]", deviceId_, ret);
+        return SUCCESS;
+    }
+    for (size_t i = 0; (i < laneNum) && (i < laneGroups.size()); ++i) {
+        int32_t groupId = laneGroups[i];
+        if (groupId == NO_GROUP) {
+            continue;
+        }
+        if ((groupId < 0) || (static_cast<uint32_t>(groupId) >= groupCount)) {
+            ERROR_LOG("group %d of stream %zu is out of range, device %d has %u groups", groupId, i, deviceId_,
+                groupCount);
+            return FAILED;
+        }
+        laneGroups_[i] = groupId;
+        if (groupContexts_.count(groupId) > 0) {
+            continue;
+        }
+        // 分组绑定在context上 每个分组单独创建一个context 新建的context即为当前context
+        aclrtContext context = nullptr;
+        ret = aclrtCreateContext(&context, deviceId_);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("create context of group %d on device %d failed, ret[%d]", groupId, deviceId_, ret);
+            return FAILED;
+        }
+        groupContexts_[groupId] = context;
+        ret = aclrtSetGroup(groupId);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("set group %d on device %d failed, ret[%d]", groupId, deviceId_, ret);
+            return FAILED;
+        }
+    }
+    LoadGroupInfo(groupCount);
+    return SUCCESS;
+}
+
+void DeviceWorker::LoadGroupInfo(uint32_t groupCount)
+{
+    aclrtGroupInfo *info = aclrtCreateGroupInfo();
+    if (info == nullptr) {
+        return;
+    }
+    if (aclrtGetAllGroupInfo(info) == ACL_ERROR_NONE) {
+        for (auto it = groupContexts_.begin(); it != groupContexts_.end(); ++it) {
+            int32_t aicoreNum = 0;
+            size_t retSize = 0;
+            if (aclrtGetGroupInfoDetail(info, it->first, ACL_GROUP_AICORE_INT, &aicoreNum, sizeof(aicoreNum),
+                &retSize) == ACL_ERROR_NONE) {
+                groupCores_[it->first] = aicoreNum;
+            }
+            INFO_LOG("device %d: group %d of %u with %d AI cores", deviceId_, it->first, groupCount, aicoreNum);
+        }
+    }
+    (void)aclrtDestroyGroupInfo(info);
+}
+
+aclrtContext DeviceWorker::GetLaneContext(size_t lane) const
+{
+    if ((lane >= laneGroups_.size()) || (laneGroups_[lane] == NO_GROUP)) {
+        return context_;
+    }
+    return groupContexts_.find(laneGroups_[lane])->second;
+}
+
+vector<GroupStats> DeviceWorker::GetGroupStats() const
+{
+    // 按分组汇总各stream的执行时间 没有分组的stream排在最后
+    map<int32_t, GroupStats> groups;
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        int32_t groupId = (i < laneGroups_.size()) ? laneGroups_[i] : NO_GROUP;
+        GroupStats &group = groups[groupId];
+        group.groupId = groupId;
+        ++group.lanes;
+        group.busyMs += executors_[i]->GetBusyMs();
+    }
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime_).count();
+    vector<GroupStats> stats;
+    for (auto it = groups.begin(); it != groups.end(); ++it) {
+        auto cores = groupCores_.find(it->first);
+        it->second.aicoreNum = (cores != groupCores_.end()) ? cores->second : 0;
+        it->second.utilization = (elapsedMs > 0.0) ? (it->second.busyMs / (elapsedMs * it->second.lanes)) : 0.0;
+        if (it->first == NO_GROUP) {
+            continue;
+        }
+        stats.push_back(it->second);
+    }
+    if (groups.count(NO_GROUP) > 0) {
+        stats.push_back(groups[NO_GROUP]);
+    }
+    return stats;
+}
+
+vector<WarmupResult> DeviceWorker::GetWarmupBaseline() const
+{
+    return baseline_;
+}
+
+Result DeviceWorker::Submit(const InferBatchPtr &batch)
+{
+    return Submit(batch, nullptr);
+}
+
+Result DeviceWorker::Submit(const InferBatchPtr &batch, const StreamExecutor *exclude)
+{
+    if (executors_.empty()) {
+        ERROR_LOG("device %d has no executor, submit failed", deviceId_);
+        return FAILED;
+    }
+    // 交互请求放到预留的stream 批量请求放到其余stream 没有预留或全部预留时使用所有stream
+    size_t first = 0;
+    size_t count = executors_.size();
+    if ((interactiveStreams_ > 0) && (interactiveStreams_ < executors_.size())) {
+        bool interactive = (batch->priority == PRIORITY_INTERACTIVE);
+        first = interactive ? 0 : interactiveStreams_;
+        count = interactive ? interactiveStreams_ : (executors_.size() - interactiveStreams_);
+    }
+    // 选择积压请求最少的stream 相同时从轮转位置开始 避免总是落到第一个
+    size_t start = nextExecutor_++ % count;
+    size_t best = executors_.size();
+    size_t bestOutstanding = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = first + (start + i) % count;
+        if (executors_[index].get() == exclude) {
+            continue;
+        }
+        size_t outstanding = executors_[index]->GetOutstanding();
+        if ((best == executors_.size()) || (outstanding < bestOutstanding)) {
+            best = index;
+            bestOutstanding = outstanding;
+        }
+        if (bestOutstanding == 0) {
+            break;
+        }
+    }
+    // 对冲副本所属优先级只有原请求所在的stream
+    if (best == executors_.size()) {
+        return FAILED;
+    }
+    return executors_[best]->Enqueue(batch);
+}
+
+shared_ptr<ModelFamily> DeviceWorker::AcquireModel(const ModelKey &key)
+{
+    return registry_.Acquire(key);
+}
+
+void DeviceWorker::ReleaseRetiredModels()
+{
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        executors_[i]->ReleaseRetiredModels();
+    }
+}
+
+Result DeviceWorker::ReloadModel(const ModelKey &key)
+{
+    aclError ret = aclrtSetCurrentContext(context_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("set current context failed, ret[%d]", ret);
+        return FAILED;
+    }
+    if (registry_.Reload(key) != SUCCESS) {
+        ERROR_LOG("reload model %s on device %d failed", key.name.c_str(), deviceId_);
+        return FAILED;
+    }
+    // 空闲slot不会再有回调 在这里解除对旧模型的绑定
+    ReleaseRetiredModels();
+    return SUCCESS;
+}
+
+RegistryStats DeviceWorker::GetRegistryStats() const
+{
+    return registry_.GetStats();
+}
+
+size_t DeviceWorker::GetLaneCount() const
+{
+    return executors_.size();
+}
+
+size_t DeviceWorker::GetOutstanding() const
+{
+    size_t outstanding = 0;
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        outstanding += executors_[i]->GetOutstanding();
+    }
+    return outstanding;
+}
+
+void DeviceWorker::WaitIdle()
+{
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        executors_[i]->WaitIdle();
+    }
+}
+
+void DeviceWorker::RegisterLanes(WorkStealer &stealer, int32_t numaNode)
+{
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        stealer.AddLane(executors_[i].get(), numaNode);
+    }
+}
+
+void DeviceWorker::EnableStealing(WorkStealer *stealer)
+{
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        executors_[i]->SetStealer(stealer);
+    }
+}
+
+void DeviceWorker::Stop()
+{
+    for (size_t i = 0; i < executors_.size(); ++i) {
+        executors_[i]->Stop();
+    }
+}
+
+void DeviceWorker::Destroy()
+{
+    if (context_ != nullptr) {
+        (void)aclrtSetCurrentContext(context_);
+    }
+    // 先停止后台加载 不再访问executor 再停止executor 保证没有任务再使用模型
+    registry_.StopLoading();
+    executors_.clear();
+    reporter_.Stop();
+    registry_.Clear();
+    for (auto it = groupContexts_.begin(); it != groupContexts_.end(); ++it) {
+        if (aclrtDestroyContext(it->second) != ACL_ERROR_NONE) {
+            ERROR_LOG("destroy context of group %d failed", it->first);
+        }
+    }
+    groupContexts_.clear();
+    groupCores_.clear();
+    laneGroups_.clear();
+
+    if (context_ != nullptr) {
+        aclError ret = aclrtDestroyContext(context_);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("destroy context failed");
+        }
+        context_ = nullptr;
+        INFO_LOG("end to destroy context");
+    }
+
+    if (deviceOpened_) {
+        aclError ret = aclrtResetDevice(deviceId_);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("reset device failed");
+        }
+        deviceOpened_ = false;
+        INFO_LOG("end to reset device is %d", deviceId_);
+    }
+}
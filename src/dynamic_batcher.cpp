@@ -0,0 +1,202 @@
+/**
+* @file dynamic_batcher.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "dynamic_batcher.h"
+#include <algorithm>
+using namespace std;
+
+DynamicBatcher::DynamicBatcher() : maxBatchSize_(1), maxDelay_(0), queued_(0), dispatching_(0), stop_(false)
+{
+}
+
+DynamicBatcher::~DynamicBatcher()
+{
+    Stop();
+}
+
+Result DynamicBatcher::Start(size_t maxBatchSize, uint32_t maxDelayUs, const DispatchFunc &dispatch)
+{
+    if ((maxBatchSize == 0) || !dispatch || thread_.joinable()) {
+        ERROR_LOG("invalid batch size or dispatch function, or batcher already started");
+        return FAILED;
+    }
+    maxBatchSize_ = maxBatchSize;
+    maxDelay_ = chrono::microseconds(maxDelayUs);
+    dispatch_ = dispatch;
+    stop_ = false;
+    thread_ = thread(&DynamicBatcher::Run, this);
+    INFO_LOG("start batcher, max batch size %zu, max delay %u us", maxBatchSize_, maxDelayUs);
+    return SUCCESS;
+}
+
+void DynamicBatcher::SetMaxDelay(InferPriority priority, uint32_t maxDelayUs)
+{
+    lock_guard<mutex> lock(mutex_);
+    priorityDelays_[priority] = chrono::microseconds(maxDelayUs);
+}
+
+void DynamicBatcher::SetBatchDelayPolicy(const BatchDelayFunc &policy)
+{
+    lock_guard<mutex> lock(mutex_);
+    batchDelayPolicy_ = policy;
+}
+
+chrono::microseconds DynamicBatcher::GetMaxDelay(const BatchKey &key) const
+{
+    if (batchDelayPolicy_) {
+        return chrono::microseconds(batchDelayPolicy_(key));
+    }
+    auto it = priorityDelays_.find(key.priority);
+    return (it != priorityDelays_.end()) ? it->second : maxDelay_;
+}
+
+void DynamicBatcher::SetBatchSizePolicy(const BatchSizeFunc &policy)
+{
+    lock_guard<mutex> lock(mutex_);
+    batchSizePolicy_ = policy;
+}
+
+size_t DynamicBatcher::GetTargetBatchSize(const BatchKey &key, size_t queued) const
+{
+    if (!batchSizePolicy_) {
+        return maxBatchSize_;
+    }
+    size_t target = batchSizePolicy_(key, queued);
+    return min(max(target, static_cast<size_t>(1)), maxBatchSize_);
+}
+
+Result DynamicBatcher::Add(const InferRequestPtr &request)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (stop_ || !thread_.joinable()) {
+            ERROR_LOG("batcher is not running, add request failed");
+            return FAILED;
+        }
+        request->enqueueTime = chrono::steady_clock::now();
+        BatchKey key;
+        key.priority = request->priority;
+        key.model = request->model;
+        key.imageSize = ImageSize(request->height, request->width);
+        queues_[key].push_back(request);
+        ++queued_;
+    }
+    cond_.notify_one();
+    return SUCCESS;
+}
+
+void DynamicBatcher::Run()
+{
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        cond_.wait(lock, [this] { return stop_ || (queued_ > 0); });
+        if (queued_ == 0) {
+            break;
+        }
+        // 每个分辨率各自成批 凑满一个batch 或者最早的请求已经等到最大时延 两者先到为准
+        // 同时有多个队列就绪时 先处理优先级高的 同优先级先处理最早请求所在的队列
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        chrono::steady_clock::time_point nextDeadline = chrono::steady_clock::time_point::max();
+        auto ready = queues_.end();
+        for (auto it = queues_.begin(); it != queues_.end(); ++it) {
+            const deque<InferRequestPtr> &queue = it->second;
+            if (queue.empty()) {
+                continue;
+            }
+            chrono::steady_clock::time_point deadline = queue.front()->enqueueTime + GetMaxDelay(it->first);
+            if (!stop_ && (queue.size() < GetTargetBatchSize(it->first, queue.size())) && (now < deadline)) {
+                nextDeadline = min(nextDeadline, deadline);
+                continue;
+            }
+            if ((ready == queues_.end()) || (it->first.priority < ready->first.priority) ||
+                ((it->first.priority == ready->first.priority) &&
+                (queue.front()->enqueueTime < ready->second.front()->enqueueTime))) {
+                ready = it;
+            }
+        }
+        if (ready == queues_.end()) {
+            cond_.wait_until(lock, nextDeadline);
+            continue;
+        }
+
+        deque<InferRequestPtr> &queue = ready->second;
+        InferBatchPtr batch(new InferBatch());
+        batch->priority = ready->first.priority;
+        batch->model = ready->first.model;
+        batch->height = ready->first.imageSize.first;
+        batch->width = ready->first.imageSize.second;
+        size_t batchSize = min(queue.size(), GetTargetBatchSize(ready->first, queue.size()));
+        batch->requests.assign(queue.begin(), queue.begin() + batchSize);
+        queue.erase(queue.begin(), queue.begin() + batchSize);
+        queued_ -= batchSize;
+        dispatching_ += batchSize;
+
+        lock.unlock();
+        // 在队列中已经超过截止时间 或者对冲副本已经先完成的请求不再下发
+        vector<InferRequestPtr> expired;
+        vector<InferRequestPtr> cancelled;
+        DropUnneeded(batch, now, expired, cancelled);
+        for (size_t i = 0; i < expired.size(); ++i) {
+            ShedRequest(expired[i]);
+        }
+        for (size_t i = 0; i < cancelled.size(); ++i) {
+            CancelRequest(cancelled[i]);
+        }
+        if (!batch->requests.empty() && (dispatch_(batch) != SUCCESS)) {
+            FailBatch(batch);
+        }
+        lock.lock();
+        dispatching_ -= batchSize;
+        idleCond_.notify_all();
+    }
+}
+
+void DynamicBatcher::DropUnneeded(const InferBatchPtr &batch, chrono::steady_clock::time_point now,
+    vector<InferRequestPtr> &expired, vector<InferRequestPtr> &cancelled)
+{
+    vector<InferRequestPtr> live;
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        if (IsCancelled(batch->requests[i])) {
+            cancelled.push_back(batch->requests[i]);
+        } else if (batch->requests[i]->deadline <= now) {
+            expired.push_back(batch->requests[i]);
+        } else {
+            live.push_back(batch->requests[i]);
+        }
+    }
+    batch->requests.swap(live);
+}
+
+void DynamicBatcher::FailBatch(const InferBatchPtr &batch)
+{
+    InferResult result;
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        if (batch->requests[i]->callback) {
+            batch->requests[i]->callback(result);
+        }
+    }
+}
+
+void DynamicBatcher::WaitIdle()
+{
+    unique_lock<mutex> lock(mutex_);
+    idleCond_.wait(lock, [this] { return (queued_ == 0) && (dispatching_ == 0); });
+}
+
+void DynamicBatcher::Stop()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
@@ -0,0 +1,175 @@
+/**
+* @file frame_gate.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "frame_gate.h"
+#include <algorithm>
+#include <cstdlib>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+using namespace std;
+
+namespace {
+const size_t THUMBNAIL_SIZE = 32;  // thumbnail is 32x32 luma
+const size_t CELL_SAMPLES = 4;     // each thumbnail pixel averages 4x4 points of its cell
+const size_t CHANNEL_NUM = 3;
+const uint32_t LUMA_R = 77;        // BT.601 weights scaled by 256
+const uint32_t LUMA_G = 150;
+const uint32_t LUMA_B = 29;
+const uint32_t LUMA_SHIFT = 8;
+const size_t SIMD_WIDTH = 16;
+}
+
+FrameGate::FrameGate()
+{
+}
+
+void FrameGate::SetConfig(const FrameGateConfig &config)
+{
+    lock_guard<mutex> lock(mutex_);
+    config_ = config;
+}
+
+bool FrameGate::IsEnabled() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return config_.threshold > 0.0f;
+}
+
+void FrameGate::MakeThumbnail(const DecodedImage &frame, vector<uint8_t> &thumbnail)
+{
+    // 每个格子取均匀分布的几个点求平均 比逐像素缩放省得多 对噪声也足够稳定
+    const uint8_t *pixels = frame.pixels->data();
+    thumbnail.assign(THUMBNAIL_SIZE * THUMBNAIL_SIZE, 0);
+    for (size_t ty = 0; ty < THUMBNAIL_SIZE; ++ty) {
+        size_t y0 = ty * frame.height / THUMBNAIL_SIZE;
+        size_t y1 = max((ty + 1) * frame.height / THUMBNAIL_SIZE, y0 + 1);
+        for (size_t tx = 0; tx < THUMBNAIL_SIZE; ++tx) {
+            size_t x0 = tx * frame.width / THUMBNAIL_SIZE;
+            size_t x1 = max((tx + 1) * frame.width / THUMBNAIL_SIZE, x0 + 1);
+            uint32_t sum = 0;
+            for (size_t sy = 0; sy < CELL_SAMPLES; ++sy) {
+                size_t y = y0 + (y1 - y0) * (2 * sy + 1) / (2 * CELL_SAMPLES);
+                for (size_t sx = 0; sx < CELL_SAMPLES; ++sx) {
+                    size_t x = x0 + (x1 - x0) * (2 * sx + 1) / (2 * CELL_SAMPLES);
+                    const uint8_t *p = pixels + (y * frame.width + x) * CHANNEL_NUM;
+                    sum += (LUMA_R * p[0] + LUMA_G * p[1] + LUMA_B * p[2]) >> LUMA_SHIFT;
+                }
+            }
+            thumbnail[ty * THUMBNAIL_SIZE + tx] = static_cast<uint8_t>(sum / (CELL_SAMPLES * CELL_SAMPLES));
+        }
+    }
+}
+
+uint32_t FrameGate::SumAbsDiff(const uint8_t *first, const uint8_t *second, size_t size)
+{
+    uint32_t sum = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // psadbw每16字节得到两个64位的部分和
+    __m128i acc = _mm_setzero_si128();
+    for (; i + SIMD_WIDTH <= size; i += SIMD_WIDTH) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(second + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+    }
+    sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#elif defined(__ARM_NEON)
+    // 逐字节差的绝对值 再两两累加到32位
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + SIMD_WIDTH <= size; i += SIMD_WIDTH) {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(first + i), vld1q_u8(second + i));
+        acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+    }
+    uint64x2_t pairs = vpaddlq_u32(acc);
+    sum = static_cast<uint32_t>(vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+#endif
+    for (; i < size; ++i) {
+        sum += static_cast<uint32_t>(abs(static_cast<int>(first[i]) - static_cast<int>(second[i])));
+    }
+    return sum;
+}
+
+bool FrameGate::Reuse(uint64_t streamId, const ModelKey &model, const DecodedImage &frame, InferResult &result,
+    FrameTicket &ticket)
+{
+    MakeThumbnail(frame, ticket.thumbnail);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    lock_guard<mutex> lock(mutex_);
+    ++stats_.frames;
+    StreamState &state = streams_[make_pair(streamId, model)];
+    ticket.sequence = state.next++;
+    if (state.thumbnail.empty()) {
+        return false;
+    }
+    // 连续复用的帧数和结果的时间都有上限 缓慢的变化累积起来也会重新执行
+    if (((config_.maxReuse > 0) && (state.reuseCount >= config_.maxReuse)) ||
+        ((config_.maxReuseMs > 0) && (now - state.time >= chrono::milliseconds(config_.maxReuseMs)))) {
+        return false;
+    }
+    // 与最近一次执行的帧比较 而不是与上一帧比较 逐帧的小变化不会被忽略
+    float diff = static_cast<float>(SumAbsDiff(ticket.thumbnail.data(), state.thumbnail.data(),
+        ticket.thumbnail.size())) / ticket.thumbnail.size();
+    if (diff >= config_.threshold) {
+        return false;
+    }
+    ++state.reuseCount;
+    ++stats_.reused;
+    result = state.result;
+    return true;
+}
+
+void FrameGate::Update(uint64_t streamId, const ModelKey &model, FrameTicket &ticket, const InferResult &result)
+{
+    if ((result.ret != SUCCESS) || ticket.thumbnail.empty()) {
+        return;
+    }
+    lock_guard<mutex> lock(mutex_);
+    auto it = streams_.find(make_pair(streamId, model));
+    // 帧可能乱序完成 只接受比当前参考帧更新的帧
+    if ((it == streams_.end()) || (ticket.sequence <= it->second.sequence)) {
+        return;
+    }
+    StreamState &state = it->second;
+    state.thumbnail.swap(ticket.thumbnail);
+    state.result = result;
+    state.time = chrono::steady_clock::now();
+    state.sequence = ticket.sequence;
+    state.reuseCount = 0;
+}
+
+void FrameGate::EndStream(uint64_t streamId)
+{
+    lock_guard<mutex> lock(mutex_);
+    // 空的ModelKey排在最前 从它开始是该stream的全部模型
+    auto it = streams_.lower_bound(make_pair(streamId, ModelKey()));
+    while ((it != streams_.end()) && (it->first.first == streamId)) {
+        it = streams_.erase(it);
+    }
+}
+
+void FrameGate::Invalidate(const ModelKey &model)
+{
+    lock_guard<mutex> lock(mutex_);
+    for (auto it = streams_.begin(); it != streams_.end();) {
+        if (!(it->first.second < model) && !(model < it->first.second)) {
+            it = streams_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+FrameGateStats FrameGate::GetStats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
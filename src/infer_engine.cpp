@@ -0,0 +1,987 @@
+/**
+* @file infer_engine.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "infer_engine.h"
+#include <algorithm>
+#include <thread>
+#include "acl/acl.h"
+using namespace std;
+
+namespace {
+const size_t BYTES_PER_MB = 1024 * 1024;
+
+/**
+* RoiResults: results of the boxes of one RoiRequest, delivered together once the last one completes
+*/
+struct RoiResults {
+    mutex resultMutex;
+    vector<InferResult> results;
+    size_t remaining;
+    RoiCallback callback;
+
+    RoiResults() : remaining(0) {}
+};
+}
+
+InferEngine::InferEngine() : ready_(false), admitted_(0), rejected_(0), expired_(0), laneCount_(0),
+    defaultDeadline_(0), nextWorker_(0)
+{
+    for (size_t i = 0; i < PRIORITY_NUM; ++i) {
+        pending_[i] = 0;
+        batchDelayUs_[i] = 0;
+    }
+}
+
+InferEngine::~InferEngine()
+{
+    Destroy();
+}
+
+Result InferEngine::Init(const EngineConfig &engineConfig, const vector<ModelConfig> &modelConfigs)
+{
+    if (modelConfigs.empty()) {
+        ERROR_LOG("no model configured");
+        return FAILED;
+    }
+    // 每个模型一个选择器 各device共享 第一个模型为默认模型
+    catalog_.reset(new ModelCatalog());
+    size_t maxBatchSize = 1;
+    for (size_t i = 0; i < modelConfigs.size(); ++i) {
+        ModelKey key(modelConfigs[i].name, modelConfigs[i].version);
+        if (catalog_->count(key) > 0) {
+            ERROR_LOG("model %s version %s is configured twice", key.name.c_str(), key.version.c_str());
+            return FAILED;
+        }
+        ModelCatalogEntry &entry = (*catalog_)[key];
+        entry.config = modelConfigs[i];
+        entry.selector.reset(new VariantSelector());
+        if (defaultVersions_.count(key.name) == 0) {
+            defaultVersions_[key.name] = key.version;
+        }
+        maxBatchSize = max(maxBatchSize, modelConfigs[i].maxBatchSize);
+    }
+    defaultModel_ = ModelKey(modelConfigs[0].name, modelConfigs[0].version);
+
+    uint32_t deviceCount = 0;
+    aclError ret = aclrtGetDeviceCount(&deviceCount);
+    if ((ret != ACL_ERROR_NONE) || (deviceCount == 0)) {
+        if (engineConfig.cpuBackend.empty()) {
+            ERROR_LOG("get device count failed or no device found, ret[%d]", ret);
+            return FAILED;
+        }
+        // 没有device时全部请求由CPU后端执行
+        WARN_LOG("no device found, ret[%d], every request runs on the cpu backend", ret);
+        deviceCount = 0;
+    }
+    INFO_LOG("found %u devices", deviceCount);
+
+    vector<int32_t> deviceIds = engineConfig.deviceIds;
+    if (deviceIds.empty()) {
+        for (uint32_t i = 0; i < deviceCount; ++i) {
+            deviceIds.push_back(static_cast<int32_t>(i));
+        }
+    }
+    for (size_t i = 0; i < deviceIds.size(); ++i) {
+        if ((deviceIds[i] < 0) || (static_cast<uint32_t>(deviceIds[i]) >= deviceCount)) {
+            ERROR_LOG("device %d is out of range, device count is %u", deviceIds[i], deviceCount);
+            return FAILED;
+        }
+    }
+
+    // 各device互不依赖 并行打开device并加载默认模型
+    shared_ptr<const ModelCatalog> catalog = catalog_;
+    size_t memBudget = engineConfig.deviceMemBudgetMb * BYTES_PER_MB;
+    vector<unique_ptr<DeviceWorker>> workers(deviceIds.size());
+    vector<Result> results(deviceIds.size(), FAILED);
+    vector<thread> initThreads;
+    for (size_t i = 0; i < deviceIds.size(); ++i) {
+        workers[i].reset(new DeviceWorker());
+        initThreads.push_back(thread([this, &workers, &results, &deviceIds, &catalog, &engineConfig, memBudget, i] {
+            results[i] = workers[i]->Init(deviceIds[i], catalog, defaultModel_, memBudget, engineConfig.priority,
+                engineConfig.laneGroups);
+        }));
+    }
+    for (size_t i = 0; i < initThreads.size(); ++i) {
+        initThreads[i].join();
+    }
+
+    Result result = SUCCESS;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        if (results[i] != SUCCESS) {
+            ERROR_LOG("init device %d failed", deviceIds[i]);
+            result = FAILED;
+        }
+        workers_.push_back(move(workers[i]));
+    }
+    if (result != SUCCESS) {
+        return FAILED;
+    }
+
+    // 所有lane登记完成后才开启窃取 此后lane列表不再变化
+    if (!engineConfig.numaNodes.empty() && (engineConfig.numaNodes.size() != deviceIds.size())) {
+        WARN_LOG("%zu numa nodes given for %zu devices, missing ones are node 0", engineConfig.numaNodes.size(),
+            deviceIds.size());
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        int32_t numaNode = (i < engineConfig.numaNodes.size()) ? engineConfig.numaNodes[i] : 0;
+        workers_[i]->RegisterLanes(stealer_, numaNode);
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->EnableStealing(&stealer_);
+        laneCount_ += workers_[i]->GetLaneCount();
+    }
+
+    if (!engineConfig.cpuBackend.empty() &&
+        (cpuExecutor_.Init(engineConfig.cpuBackend, engineConfig.cpuThreads, catalog) != SUCCESS)) {
+        return FAILED;
+    }
+    if (LoadModelInfo(defaultModel_) != SUCCESS) {
+        return FAILED;
+    }
+    // 每个batch的大小按模型各自的上限 以及有多个变体时按积压请求数和实测时延选择
+    // 有时延目标的模型由控制器调整batch大小和等待时间
+    batcher_.SetBatchSizePolicy([this](const BatchKey &key, size_t queued) {
+        return GetTargetBatchSize(key, queued);
+    });
+    batcher_.SetBatchDelayPolicy([this](const BatchKey &key) { return GetBatchDelayUs(key.model, key.priority); });
+    batchDelayUs_[PRIORITY_INTERACTIVE] = modelConfigs[0].maxBatchDelayUs;
+    batchDelayUs_[PRIORITY_BULK] = engineConfig.priority.bulkMaxBatchDelayUs;
+    defaultDeadline_ = chrono::milliseconds(engineConfig.defaultDeadlineMs);
+    frameGate_.SetConfig(engineConfig.frameGate);
+    resultCache_.SetConfig(engineConfig.resultCache);
+    duplicates_.SetConfig(engineConfig.nearDuplicate);
+    if (batcher_.Start(maxBatchSize, modelConfigs[0].maxBatchDelayUs,
+        [this](const InferBatchPtr &batch) { return DispatchBatch(batch); }) != SUCCESS) {
+        return FAILED;
+    }
+    if (hedger_.Start(engineConfig.hedge, [this](const InferRequestPtr &duplicate, const StreamExecutor *exclude) {
+        return DispatchDuplicate(duplicate, exclude); }) != SUCCESS) {
+        return FAILED;
+    }
+
+    // 每个device的所有slot都已预热 此时才接收请求
+    ready_ = true;
+    INFO_LOG("inference engine ready on %zu devices with %zu models", workers_.size(), catalog_->size());
+    return SUCCESS;
+}
+
+ModelKey InferEngine::ResolveModel(const ModelKey &model) const
+{
+    ModelKey key = model;
+    if (key.name.empty()) {
+        key.name = defaultModel_.name;
+    }
+    if (key.version.empty()) {
+        auto it = defaultVersions_.find(key.name);
+        if (it != defaultVersions_.end()) {
+            key.version = it->second;
+        }
+    }
+    return key;
+}
+
+Result InferEngine::LoadModelInfo(const ModelKey &key)
+{
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        if (models_.count(key) > 0) {
+            return SUCCESS;
+        }
+    }
+    auto entry = catalog_->find(key);
+    if (entry == catalog_->end()) {
+        ERROR_LOG("model %s version %s is not configured", key.name.c_str(), key.version.c_str());
+        return FAILED;
+    }
+    // 级联的轻量模型先于本模型加载 轻量模型自己不能再级联
+    const ModelConfig &config = entry->second.config;
+    if (!config.cascadeModel.empty() && !workers_.empty()) {
+        auto light = catalog_->find(ResolveModel(ModelKey(config.cascadeModel, "")));
+        if ((light != catalog_->end()) && light->second.config.cascadeModel.empty()) {
+            (void)LoadModelInfo(light->first);
+        }
+    }
+
+    // 第一次请求某个模型时 在积压最少的device上加载 得到输入大小和batch上限
+    lock_guard<mutex> loadLock(loadMutex_);
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        if (models_.count(key) > 0) {
+            return SUCCESS;
+        }
+    }
+    ModelInfo info;
+    if (workers_.empty()) {
+        if (LoadCpuModelInfo(key, config, info) != SUCCESS) {
+            return FAILED;
+        }
+        lock_guard<mutex> lock(modelsMutex_);
+        models_[key] = info;
+        return SUCCESS;
+    }
+    shared_ptr<ModelFamily> family = workers_[SelectWorker()]->AcquireModel(key);
+    if (family == nullptr) {
+        return FAILED;
+    }
+    shared_ptr<const ModelProcess> model = family->GetModel();
+
+    // 动态分辨率模型每个档位是一个桶 固定shape模型只有一个尺寸为0的桶
+    const vector<ImageSize> &imageSizes = model->GetImageSizes();
+    for (size_t i = 0; i < imageSizes.size(); ++i) {
+        info.sampleInputSizes[imageSizes[i]] = model->GetSampleInputSize(imageSizes[i].first, imageSizes[i].second);
+    }
+    if (imageSizes.empty()) {
+        info.sampleInputSizes[ImageSize(0, 0)] = model->GetSampleInputSize();
+    }
+    // batch上限取最大变体和配置中的较小值
+    info.maxBatchSize = min(config.maxBatchSize, model->GetMaxBatchSize());
+    if (info.maxBatchSize < config.maxBatchSize) {
+        WARN_LOG("model %s supports batch %zu only, max_batch_size %zu is reduced", key.name.c_str(),
+            model->GetMaxBatchSize(), config.maxBatchSize);
+    }
+    vector<size_t> batchSizes = family->GetBatchSizes();
+    entry->second.selector->SetBatchSizes(batchSizes);
+    info.selectBatchSize = (batchSizes.size() > 1);
+    if (config.latencyTargetMs > 0) {
+        batchController_.AddModel(key, static_cast<double>(config.latencyTargetMs), info.maxBatchSize,
+            config.maxBatchDelayUs, entry->second.selector);
+    }
+    if (cpuExecutor_.IsEnabled() && !config.cpuModelPath.empty()) {
+        (void)LoadCpuModelInfo(key, config, info);
+    }
+    if (!config.cascadeModel.empty()) {
+        LoadCascade(key, config, info);
+    }
+
+    lock_guard<mutex> lock(modelsMutex_);
+    models_[key] = info;
+    return SUCCESS;
+}
+
+Result InferEngine::LoadCpuModelInfo(const ModelKey &key, const ModelConfig &config, ModelInfo &info)
+{
+    CpuBackendModelInfo cpuInfo;
+    if (!cpuExecutor_.IsEnabled() || (cpuExecutor_.GetModelInfo(key, cpuInfo) != SUCCESS)) {
+        ERROR_LOG("model %s version %s cannot run on the cpu backend", key.name.c_str(), key.version.c_str());
+        return FAILED;
+    }
+    size_t cpuMaxBatchSize = (cpuInfo.maxBatchSize > 0) ? cpuInfo.maxBatchSize : config.maxBatchSize;
+    // 没有device时输入大小和batch上限都取自CPU模型
+    if (info.sampleInputSizes.empty()) {
+        info.sampleInputSizes[ImageSize(0, 0)] = cpuInfo.sampleInputSize;
+        info.maxBatchSize = min(config.maxBatchSize, cpuMaxBatchSize);
+        info.onCpu = true;
+        return SUCCESS;
+    }
+    // 两个后端的输入相同且CPU能容纳最大的batch时 batch才能交给任意一方执行
+    auto it = info.sampleInputSizes.find(ImageSize(0, 0));
+    if ((info.sampleInputSizes.size() > 1) || (it == info.sampleInputSizes.end()) ||
+        (it->second != cpuInfo.sampleInputSize) || (cpuMaxBatchSize < info.maxBatchSize)) {
+        WARN_LOG("cpu model of %s does not match its device model, it runs on devices only", key.name.c_str());
+        return FAILED;
+    }
+    info.onCpu = true;
+    return SUCCESS;
+}
+
+void InferEngine::LoadCascade(const ModelKey &key, const ModelConfig &config, ModelInfo &info)
+{
+    ModelKey light = ResolveModel(ModelKey(config.cascadeModel, ""));
+    ModelInfo lightInfo;
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        auto it = models_.find(light);
+        if ((it == models_.end()) || (it->second.cascade != nullptr)) {
+            WARN_LOG("cascade model %s of %s is not loaded or has a cascade itself, every sample runs on %s",
+                config.cascadeModel.c_str(), key.name.c_str(), key.name.c_str());
+            return;
+        }
+        lightInfo = it->second;
+    }
+    // 同一个batch先交给轻量模型 输入必须相同 且轻量模型能容纳本模型最大的batch
+    if ((lightInfo.sampleInputSizes != info.sampleInputSizes) || (lightInfo.maxBatchSize < info.maxBatchSize)) {
+        WARN_LOG("cascade model %s does not take the inputs or batch size of %s, every sample runs on %s",
+            light.name.c_str(), key.name.c_str(), key.name.c_str());
+        return;
+    }
+    info.cascade = make_shared<CascadePlan>();
+    info.cascade->light = light;
+    info.cascade->full = key;
+    info.cascade->margin = config.cascadeMargin;
+    INFO_LOG("model %s runs %s first, samples with a top 1 margin below %.3f escalate", key.name.c_str(),
+        light.name.c_str(), config.cascadeMargin);
+}
+
+size_t InferEngine::GetTargetBatchSize(const BatchKey &key, size_t queued)
+{
+    size_t maxBatchSize = 1;
+    bool selectBatchSize = false;
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        auto it = models_.find(key.model);
+        if (it != models_.end()) {
+            maxBatchSize = it->second.maxBatchSize;
+            selectBatchSize = it->second.selectBatchSize;
+        }
+    }
+    // 批量请求追求吞吐 总是凑满最大batch
+    if (key.priority == PRIORITY_BULK) {
+        return maxBatchSize;
+    }
+    size_t target = maxBatchSize;
+    if (selectBatchSize) {
+        target = min(catalog_->find(key.model)->second.selector->Select(queued), maxBatchSize);
+    }
+    // 有时延目标的模型 batch不超过控制器当前给出的大小
+    size_t limit = 0;
+    uint32_t delayUs = 0;
+    if (batchController_.GetLimits(key.model, limit, delayUs)) {
+        target = min(target, limit);
+    }
+    return target;
+}
+
+uint32_t InferEngine::GetBatchDelayUs(const ModelKey &key, InferPriority priority) const
+{
+    size_t batchSize = 0;
+    uint32_t delayUs = 0;
+    if ((priority == PRIORITY_INTERACTIVE) && batchController_.GetLimits(key, batchSize, delayUs)) {
+        return delayUs;
+    }
+    return batchDelayUs_[priority];
+}
+
+Result InferEngine::Submit(const InferRequestPtr &request)
+{
+    // writer生成的输入在提交时还不存在 不经过缓存
+    if (!resultCache_.IsEnabled() || request->writer || !ready_) {
+        return Admit(request);
+    }
+    ResultCacheKey cacheKey;
+    cacheKey.model = ResolveModel(request->model);
+    cacheKey.imageSize = ImageSize(request->height, request->width);
+    cacheKey.hash = ResultCache::Hash(request->input.data(), request->input.size());
+    cacheKey.size = request->input.size();
+    // 只有截止时间不晚于本请求的同样请求才能代为执行 先确定生效的截止时间
+    if ((request->deadline == chrono::steady_clock::time_point::max()) && (defaultDeadline_.count() > 0)) {
+        request->deadline = chrono::steady_clock::now() + defaultDeadline_;
+    }
+    InferResult cached;
+    CacheLookup lookup = resultCache_.Lookup(cacheKey, request, cached);
+    if (lookup == CACHE_HIT) {
+        if (request->callback) {
+            request->callback(cached);
+        }
+        return SUCCESS;
+    }
+    if (lookup == CACHE_COALESCED) {
+        return SUCCESS;
+    }
+    if (lookup == CACHE_BYPASS) {
+        return Admit(request);
+    }
+    // 第一个请求照常执行 结果交给等待同样输入的请求并缓存
+    InferCallback callback = request->callback;
+    request->callback = [this, callback, cacheKey](const InferResult &result) {
+        vector<InferRequestPtr> readmit;
+        resultCache_.Complete(cacheKey, result, readmit);
+        Readmit(readmit);
+        if (callback) {
+            callback(result);
+        }
+    };
+    if (Admit(request) != SUCCESS) {
+        request->callback = callback;
+        vector<InferRequestPtr> readmit;
+        resultCache_.Complete(cacheKey, InferResult(), readmit);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+void InferEngine::Readmit(const vector<InferRequestPtr> &requests)
+{
+    // 等待的请求各自重新准入 赶不上截止时间的在准入时被丢弃
+    for (size_t i = 0; i < requests.size(); ++i) {
+        if ((Admit(requests[i]) != SUCCESS) && requests[i]->callback) {
+            requests[i]->callback(InferResult());
+        }
+    }
+}
+
+Result InferEngine::Admit(const InferRequestPtr &request)
+{
+    if (!ready_) {
+        ERROR_LOG("inference engine is not ready, submit failed");
+        return FAILED;
+    }
+    if ((request->priority < PRIORITY_INTERACTIVE) || (request->priority >= PRIORITY_NUM)) {
+        ERROR_LOG("invalid request priority %d", request->priority);
+        return FAILED;
+    }
+    ModelKey key = ResolveModel(request->model);
+    if (LoadModelInfo(key) != SUCCESS) {
+        return FAILED;
+    }
+    size_t sampleInputSize = 0;
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        const map<ImageSize, size_t> &sizes = models_[key].sampleInputSizes;
+        auto it = sizes.find(ImageSize(request->height, request->width));
+        if (it == sizes.end()) {
+            ERROR_LOG("image size %lux%lu is not a resolution bucket of model %s", request->height, request->width,
+                key.name.c_str());
+            return FAILED;
+        }
+        sampleInputSize = it->second;
+    }
+    if (request->input.size() > sampleInputSize) {
+        ERROR_LOG("input size %zu exceeds sample input size %zu", request->input.size(), sampleInputSize);
+        return FAILED;
+    }
+    request->model = key;
+
+    // 按前面排队的请求和实测执行时延估计完成时间 赶不上截止时间的请求立即拒绝
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if ((request->deadline == chrono::steady_clock::time_point::max()) && (defaultDeadline_.count() > 0)) {
+        request->deadline = now + defaultDeadline_;
+    }
+    if (request->deadline != chrono::steady_clock::time_point::max()) {
+        chrono::duration<double, milli> estimate(EstimateCompletionMs(key, request->priority));
+        if (now + chrono::duration_cast<chrono::steady_clock::duration>(estimate) > request->deadline) {
+            ++rejected_;
+            ShedRequest(request);
+            return SUCCESS;
+        }
+    }
+
+    // 完成时更新积压计数 被丢弃的请求计入超时
+    InferCallback callback = request->callback;
+    InferPriority priority = request->priority;
+    request->callback = [this, callback, priority, key, now](const InferResult &result) {
+        expired_ += result.shed ? 1 : 0;
+        --pending_[priority];
+        if ((priority == PRIORITY_INTERACTIVE) && (result.ret == SUCCESS)) {
+            batchController_.RecordLatency(key,
+                chrono::duration<double, milli>(chrono::steady_clock::now() - now).count());
+        }
+        if (callback) {
+            callback(result);
+        }
+    };
+    // 对冲时原请求和副本先完成的一方调用上面的回调
+    hedger_.Track(request);
+    if (priority == PRIORITY_INTERACTIVE) {
+        batchController_.RecordArrival(key);
+    }
+    ++pending_[priority];
+    if (batcher_.Add(request) != SUCCESS) {
+        --pending_[priority];
+        request->callback = callback;
+        request->cancel.reset();
+        request->lane.reset();
+        return FAILED;
+    }
+    ++admitted_;
+    return SUCCESS;
+}
+
+Result InferEngine::SubmitFrame(uint64_t streamId, const DecodedImage &frame, const InferRequestPtr &request)
+{
+    if (!frameGate_.IsEnabled()) {
+        return Submit(request);
+    }
+    if (!ready_ || (RoiPreprocessor::Check(frame, RoiBox(0, 0, frame.width, frame.height)) != SUCCESS)) {
+        ERROR_LOG("inference engine is not ready or the frame is invalid, submit failed");
+        return FAILED;
+    }
+    // 与该stream最近一次由同一模型执行的帧几乎相同时 直接返回那一帧的结果 不再执行
+    ModelKey model = ResolveModel(request->model);
+    InferResult reused;
+    shared_ptr<FrameTicket> ticket(new FrameTicket());
+    if (frameGate_.Reuse(streamId, model, frame, reused, *ticket)) {
+        if (request->callback) {
+            request->callback(reused);
+        }
+        return SUCCESS;
+    }
+    // 执行完成的帧成为该stream新的参考帧
+    InferCallback callback = request->callback;
+    request->callback = [this, callback, streamId, model, ticket](const InferResult &result) {
+        frameGate_.Update(streamId, model, *ticket, result);
+        if (callback) {
+            callback(result);
+        }
+    };
+    if (Submit(request) != SUCCESS) {
+        request->callback = callback;
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+void InferEngine::EndStream(uint64_t streamId)
+{
+    frameGate_.EndStream(streamId);
+}
+
+Result InferEngine::SubmitImage(const DecodedImage &image, const InferRequestPtr &request)
+{
+    if (!duplicates_.IsEnabled()) {
+        return Submit(request);
+    }
+    if (!ready_ || (RoiPreprocessor::Check(image, RoiBox(0, 0, image.width, image.height)) != SUCCESS)) {
+        ERROR_LOG("inference engine is not ready or the image is invalid, submit failed");
+        return FAILED;
+    }
+    // 与执行过的图片感知哈希足够接近时 直接返回那张图片的结果 不再执行
+    ModelKey model = ResolveModel(request->model);
+    uint64_t hash = NearDuplicateIndex::Hash(image);
+    InferResult reused;
+    if (duplicates_.Find(model, hash, reused)) {
+        if (request->callback) {
+            request->callback(reused);
+        }
+        return SUCCESS;
+    }
+    InferCallback callback = request->callback;
+    request->callback = [this, callback, model, hash](const InferResult &result) {
+        duplicates_.Insert(model, hash, result);
+        if (callback) {
+            callback(result);
+        }
+    };
+    if (Submit(request) != SUCCESS) {
+        request->callback = callback;
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result InferEngine::SubmitRois(const RoiRequest &roi)
+{
+    if (!ready_ || roi.boxes.empty() || (roi.priority < PRIORITY_INTERACTIVE) || (roi.priority >= PRIORITY_NUM)) {
+        ERROR_LOG("inference engine is not ready, or the roi request has no boxes or an invalid priority");
+        return FAILED;
+    }
+    for (size_t i = 0; i < roi.boxes.size(); ++i) {
+        if (RoiPreprocessor::Check(roi.image, roi.boxes[i]) != SUCCESS) {
+            return FAILED;
+        }
+    }
+    ModelKey key = ResolveModel(roi.model);
+    if (LoadModelInfo(key) != SUCCESS) {
+        return FAILED;
+    }
+    // 动态分辨率模型按box缩放到的尺寸选桶 固定shape模型只有一个尺寸为0的桶
+    ImageSize bucket(roi.height, roi.width);
+    size_t maxBatchSize = 1;
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        const ModelInfo &info = models_[key];
+        if (info.sampleInputSizes.count(bucket) == 0) {
+            bucket = ImageSize(0, 0);
+        }
+        if (info.sampleInputSizes.count(bucket) == 0) {
+            ERROR_LOG("image size %lux%lu is not a resolution bucket of model %s", roi.height, roi.width,
+                key.name.c_str());
+            return FAILED;
+        }
+        maxBatchSize = info.maxBatchSize;
+    }
+    chrono::steady_clock::time_point deadline = roi.deadline;
+    if ((deadline == chrono::steady_clock::time_point::max()) && (defaultDeadline_.count() > 0)) {
+        deadline = chrono::steady_clock::now() + defaultDeadline_;
+    }
+
+    // 每个box一个请求 样本在上传前由writer直接写入batch的输入 不经过中间的buffer
+    shared_ptr<RoiResults> results(new RoiResults());
+    results->results.resize(roi.boxes.size());
+    results->remaining = roi.boxes.size();
+    results->callback = roi.callback;
+    InferPriority priority = roi.priority;
+    vector<InferRequestPtr> requests;
+    for (size_t i = 0; i < roi.boxes.size(); ++i) {
+        InferRequestPtr request(new InferRequest());
+        request->model = key;
+        request->height = bucket.first;
+        request->width = bucket.second;
+        request->priority = priority;
+        request->deadline = deadline;
+        DecodedImage image = roi.image;
+        RoiBox box = roi.boxes[i];
+        RoiNormalize normalize = roi.normalize;
+        uint64_t height = roi.height;
+        uint64_t width = roi.width;
+        request->writer = [image, box, normalize, height, width](uint8_t *sample, size_t size) {
+            return RoiPreprocessor::Write(image, box, normalize, height, width, sample, size);
+        };
+        request->callback = [this, results, priority, i](const InferResult &result) {
+            expired_ += result.shed ? 1 : 0;
+            --pending_[priority];
+            bool done = false;
+            {
+                lock_guard<mutex> lock(results->resultMutex);
+                results->results[i] = result;
+                done = (--results->remaining == 0);
+            }
+            if (done && results->callback) {
+                results->callback(results->results);
+            }
+        };
+        requests.push_back(request);
+    }
+    pending_[priority] += requests.size();
+    admitted_ += requests.size();
+
+    // 已经是一个batch 不再等待凑batch 超过batch上限时按上限拆分
+    for (size_t start = 0; start < requests.size(); start += maxBatchSize) {
+        InferBatchPtr batch(new InferBatch());
+        batch->requests.assign(requests.begin() + start,
+            requests.begin() + min(start + maxBatchSize, requests.size()));
+        batch->model = key;
+        batch->height = bucket.first;
+        batch->width = bucket.second;
+        batch->priority = priority;
+        if (DispatchBatch(batch) != SUCCESS) {
+            ERROR_LOG("dispatch %zu boxes of model %s failed", batch->requests.size(), key.name.c_str());
+            for (size_t i = 0; i < batch->requests.size(); ++i) {
+                batch->requests[i]->callback(InferResult());
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+double InferEngine::EstimateCompletionMs(const ModelKey &key, InferPriority priority) const
+{
+    size_t maxBatchSize = 1;
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        auto it = models_.find(key);
+        if (it != models_.end()) {
+            maxBatchSize = it->second.maxBatchSize;
+        }
+    }
+    // 还没有测量到执行时延时不做估计 全部接收
+    double latency = catalog_->find(key)->second.selector->GetLatency(maxBatchSize);
+    if ((latency <= 0.0) || (laneCount_ == 0)) {
+        return 0.0;
+    }
+    // 交互请求只排在交互请求之后 批量请求排在所有请求之后
+    size_t ahead = pending_[PRIORITY_INTERACTIVE].load();
+    if (priority == PRIORITY_BULK) {
+        ahead += pending_[PRIORITY_BULK].load();
+    }
+    size_t batches = ahead / maxBatchSize + 1;
+    size_t rounds = (batches + laneCount_ - 1) / laneCount_;
+    double estimate = rounds * latency;
+    // 积压不足一个batch时 还要等待凑batch的时间
+    if (ahead < maxBatchSize) {
+        estimate += GetBatchDelayUs(key, priority) / 1000.0;
+    }
+    return estimate;
+}
+
+ResultCacheStats InferEngine::GetResultCacheStats() const
+{
+    return resultCache_.GetStats();
+}
+
+NearDuplicateStats InferEngine::GetNearDuplicateStats() const
+{
+    return duplicates_.GetStats();
+}
+
+vector<BatchControlStats> InferEngine::GetBatchControlStats() const
+{
+    return batchController_.GetStats();
+}
+
+ShedStats InferEngine::GetShedStats() const
+{
+    ShedStats stats;
+    stats.admitted = admitted_.load();
+    stats.rejected = rejected_.load();
+    stats.expired = expired_.load();
+    return stats;
+}
+
+vector<ImageSize> InferEngine::GetImageSizes(const ModelKey &model)
+{
+    vector<ImageSize> imageSizes;
+    ModelKey key = ResolveModel(model);
+    if (LoadModelInfo(key) != SUCCESS) {
+        return imageSizes;
+    }
+    lock_guard<mutex> lock(modelsMutex_);
+    const map<ImageSize, size_t> &sizes = models_[key].sampleInputSizes;
+    for (auto it = sizes.begin(); it != sizes.end(); ++it) {
+        if (it->first.first > 0) {
+            imageSizes.push_back(it->first);
+        }
+    }
+    return imageSizes;
+}
+
+size_t InferEngine::GetSampleInputSize(const ModelKey &model, const ImageSize &imageSize)
+{
+    ModelKey key = ResolveModel(model);
+    if (LoadModelInfo(key) != SUCCESS) {
+        return 0;
+    }
+    lock_guard<mutex> lock(modelsMutex_);
+    const map<ImageSize, size_t> &sizes = models_[key].sampleInputSizes;
+    auto it = sizes.find(imageSize);
+    return (it != sizes.end()) ? it->second : 0;
+}
+
+size_t InferEngine::GetLaneCount() const
+{
+    return laneCount_;
+}
+
+bool InferEngine::IsReady() const
+{
+    return ready_.load();
+}
+
+Result InferEngine::ReloadModel(const ModelKey &model)
+{
+    ModelKey key = ResolveModel(model);
+    if ((catalog_ == nullptr) || (catalog_->count(key) == 0)) {
+        ERROR_LOG("model %s version %s is not configured", key.name.c_str(), key.version.c_str());
+        return FAILED;
+    }
+    // 各device并行重新加载 加载期间各device照常处理请求
+    vector<Result> results(workers_.size(), FAILED);
+    vector<thread> reloadThreads;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        reloadThreads.push_back(thread([this, &results, &key, i] {
+            results[i] = workers_[i]->ReloadModel(key);
+        }));
+    }
+    for (size_t i = 0; i < reloadThreads.size(); ++i) {
+        reloadThreads[i].join();
+    }
+    Result result = SUCCESS;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i] != SUCCESS) {
+            ERROR_LOG("device worker %zu keeps the old copy of model %s", i, key.name.c_str());
+            result = FAILED;
+        }
+    }
+    // 重新加载后的模型可能给出不同的结果
+    resultCache_.Invalidate(key);
+    duplicates_.Invalidate(key);
+    frameGate_.Invalidate(key);
+    INFO_LOG("reload of model %s version %s %s", key.name.c_str(), key.version.c_str(),
+        (result == SUCCESS) ? "done" : "incomplete");
+    return result;
+}
+
+size_t InferEngine::SelectWorker()
+{
+    size_t start = nextWorker_++ % workers_.size();
+    size_t best = start;
+    size_t bestOutstanding = workers_[start]->GetOutstanding();
+    for (size_t i = 1; i < workers_.size() && bestOutstanding > 0; ++i) {
+        size_t index = (start + i) % workers_.size();
+        size_t outstanding = workers_[index]->GetOutstanding();
+        if (outstanding < bestOutstanding) {
+            best = index;
+            bestOutstanding = outstanding;
+        }
+    }
+    return best;
+}
+
+Result InferEngine::DispatchBatch(const InferBatchPtr &batch)
+{
+    if (RunOnCpu(batch)) {
+        return cpuExecutor_.Enqueue(batch);
+    }
+    if (workers_.empty()) {
+        ERROR_LOG("model %s cannot run on the cpu backend and there is no device", batch->model.name.c_str());
+        return FAILED;
+    }
+    // 有级联的模型在device上先执行轻量模型 置信度不足的样本由lane转给本模型
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        auto it = models_.find(batch->model);
+        if ((it != models_.end()) && (it->second.cascade != nullptr)) {
+            batch->cascade = it->second.cascade;
+            batch->model = batch->cascade->light;
+        }
+    }
+    return workers_[SelectWorker()]->Submit(batch);
+}
+
+bool InferEngine::RunOnCpu(const InferBatchPtr &batch) const
+{
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        auto it = models_.find(batch->model);
+        if ((it == models_.end()) || !it->second.onCpu) {
+            return false;
+        }
+    }
+    if (workers_.empty()) {
+        return true;
+    }
+    // 按各自实测的吞吐估计两边完成这个batch的时间 交给先完成的一方 两边的完成时间因此保持均衡
+    size_t batchSize = batch->requests.size();
+    double cpuMs = cpuExecutor_.EstimateCompletionMs(batch->model, batchSize);
+    double deviceMs = EstimateDeviceCompletionMs(batch->model, batchSize);
+    return (cpuMs > 0.0) && (deviceMs > 0.0) && (cpuMs < deviceMs);
+}
+
+double InferEngine::EstimateDeviceCompletionMs(const ModelKey &key, size_t batchSize) const
+{
+    size_t maxBatchSize = 1;
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        auto it = models_.find(key);
+        if (it != models_.end()) {
+            maxBatchSize = it->second.maxBatchSize;
+        }
+    }
+    const VariantSelector &selector = *catalog_->find(key)->second.selector;
+    double latency = selector.GetLatency(batchSize);
+    double fullLatency = selector.GetLatency(maxBatchSize);
+    if ((latency <= 0.0) || (laneCount_ == 0)) {
+        return 0.0;
+    }
+    // 积压的请求按满batch由所有stream并行消化 再加上这个batch的执行时间
+    size_t outstanding = 0;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        outstanding += workers_[i]->GetOutstanding();
+    }
+    return static_cast<double>(outstanding) / (maxBatchSize * laneCount_) * fullLatency + latency;
+}
+
+Result InferEngine::DispatchDuplicate(const InferRequestPtr &duplicate, const StreamExecutor *exclude)
+{
+    // 副本不再等待凑batch 单独作为一个batch交给积压最少的device 该device只有原请求的lane时换下一个device
+    InferBatchPtr batch(new InferBatch());
+    batch->requests.push_back(duplicate);
+    batch->model = duplicate->model;
+    batch->height = duplicate->height;
+    batch->width = duplicate->width;
+    batch->priority = duplicate->priority;
+    // CPU后端估计先完成时交给它 原请求不会在CPU后端上
+    if (RunOnCpu(batch)) {
+        return cpuExecutor_.Enqueue(batch);
+    }
+    size_t first = SelectWorker();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        if (workers_[(first + i) % workers_.size()]->Submit(batch, exclude) == SUCCESS) {
+            return SUCCESS;
+        }
+    }
+    return FAILED;
+}
+
+void InferEngine::WaitIdle()
+{
+    batcher_.WaitIdle();
+    cpuExecutor_.WaitIdle();
+    // batch可能被窃取到已经等待过的device上 全部为0才算空闲
+    bool idle = false;
+    while (!idle) {
+        idle = true;
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            workers_[i]->WaitIdle();
+        }
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            idle = idle && (workers_[i]->GetOutstanding() == 0);
+        }
+    }
+}
+
+void InferEngine::LogStats() const
+{
+    ShedStats shed = GetShedStats();
+    INFO_LOG("admission: %zu admitted, %zu rejected for their deadline, %zu expired in queue", shed.admitted,
+        shed.rejected, shed.expired);
+    if (hedger_.IsEnabled()) {
+        HedgeStats hedge = hedger_.GetStats();
+        INFO_LOG("hedging: %zu of %zu requests duplicated after %.2f ms, %zu duplicates won", hedge.hedged,
+            hedge.tracked, hedge.delayMs, hedge.won);
+    }
+    if (resultCache_.IsEnabled()) {
+        ResultCacheStats cache = GetResultCacheStats();
+        INFO_LOG("result cache: %zu hits, %zu misses, %zu coalesced (%zu readmitted), %zu entries, %zu evictions, "
+            "%zu expired", cache.hits, cache.misses, cache.coalesced, cache.readmitted, cache.entries, cache.evictions,
+            cache.expired);
+    }
+    if (duplicates_.IsEnabled()) {
+        NearDuplicateStats duplicates = GetNearDuplicateStats();
+        INFO_LOG("near duplicates: %zu of %zu images reused a result, %zu hashes kept", duplicates.reused,
+            duplicates.images, duplicates.entries);
+    }
+    if (frameGate_.IsEnabled()) {
+        FrameGateStats frames = frameGate_.GetStats();
+        INFO_LOG("frame gate: %zu of %zu frames reused the result of an earlier frame", frames.reused, frames.frames);
+    }
+    if (cpuExecutor_.IsEnabled()) {
+        CpuStats cpu = cpuExecutor_.GetStats();
+        INFO_LOG("cpu backend: %zu batches, %zu requests, busy %.1f ms", cpu.batches, cpu.samples, cpu.busyMs);
+    }
+    {
+        lock_guard<mutex> lock(modelsMutex_);
+        for (auto it = models_.begin(); it != models_.end(); ++it) {
+            const shared_ptr<CascadePlan> &cascade = it->second.cascade;
+            if (cascade != nullptr) {
+                INFO_LOG("cascade of model %s: %zu of %zu samples run on %s escalated", it->first.name.c_str(),
+                    cascade->escalated.load(), cascade->samples.load(), cascade->light.name.c_str());
+            }
+        }
+    }
+    vector<BatchControlStats> control = GetBatchControlStats();
+    for (size_t i = 0; i < control.size(); ++i) {
+        INFO_LOG("batch control of model %s: batch %zu, delay %u us at %.1f requests/s, execution %.2f ms, "
+            "p99 %.2f ms of %.1f ms target, %zu increases, %zu decreases", control[i].model.name.c_str(),
+            control[i].batchSize, control[i].delayUs, control[i].arrivalRate, control[i].execMs, control[i].p99Ms,
+            control[i].targetMs, control[i].increases, control[i].decreases);
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        RegistryStats stats = workers_[i]->GetRegistryStats();
+        size_t lookups = stats.hits + stats.misses;
+        double hitRate = (lookups > 0) ? (100.0 * stats.hits / lookups) : 0.0;
+        INFO_LOG("device worker %zu: %zu models loaded (%zu MB), hit rate %.1f%%, %zu misses, load time %.1f ms, "
+            "%zu evictions, %zu reloads", i, stats.loadedModels, stats.memUsed / BYTES_PER_MB, hitRate, stats.misses,
+            stats.totalLoadMs, stats.evictions, stats.reloads);
+        vector<GroupStats> groups = workers_[i]->GetGroupStats();
+        for (size_t j = 0; j < groups.size(); ++j) {
+            INFO_LOG("device worker %zu: group %d, %zu streams, %d AI cores, busy %.1f ms, utilization %.1f%%", i,
+                groups[j].groupId, groups[j].lanes, groups[j].aicoreNum, groups[j].busyMs,
+                100.0 * groups[j].utilization);
+        }
+    }
+}
+
+void InferEngine::Destroy()
+{
+    ready_ = false;
+    hedger_.Stop();
+    // 先把还在排队的请求送到device 所有lane都停止后才能销毁 否则可能被其他lane窃取
+    batcher_.Stop();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->Stop();
+    }
+    cpuExecutor_.Stop();
+    LogStats();
+    cpuExecutor_.Destroy();
+    stealer_.Clear();
+    workers_.clear();
+    laneCount_ = 0;
+    lock_guard<mutex> lock(modelsMutex_);
+    models_.clear();
+}
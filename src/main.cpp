@@ -33,7 +33,3 @@ int main()
     return SUCCESS;
 }
 
-、
-
-// 初始化：
-// 
\ No newline at end of file
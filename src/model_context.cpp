@@ -0,0 +1,554 @@
+/**
+* @file model_context.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "model_context.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+using namespace std;
+extern bool g_isDevice;
+
+namespace {
+const size_t WARMUP_STABLE_WINDOW = 3;  // runs compared to decide the latency has settled
+}
+
+ModelContext::ModelContext() : inputHostBuffer_(nullptr), inputSize_(0), batchSize_(0), input_(nullptr),
+    output_(nullptr), startEvent_(nullptr), event_(nullptr)
+{
+}
+
+ModelContext::~ModelContext()
+{
+    Destroy();
+}
+
+Result ModelContext::Init(const shared_ptr<const ModelProcess> &model)
+{
+    if ((model == nullptr) || (model->GetModelDesc() == nullptr)) {
+        ERROR_LOG("no model description, init model context failed");
+        return FAILED;
+    }
+    return Init(model, model->GetIoSizes());
+}
+
+Result ModelContext::Init(const shared_ptr<const ModelProcess> &model, const ModelIoSizes &capacity)
+{
+    if ((model == nullptr) || (model->GetModelDesc() == nullptr)) {
+        ERROR_LOG("no model description, init model context failed");
+        return FAILED;
+    }
+	// buffer按容量申请 容量内的其他模型(如不同batch的同一网络)可以直接复用
+    capacity_ = capacity;
+    capacity_.Merge(model->GetIoSizes());
+    if (CreateBuffers() != SUCCESS) {
+        return FAILED;
+    }
+    aclError ret = aclrtCreateEvent(&startEvent_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("create event failed");
+        return FAILED;
+    }
+    ret = aclrtCreateEvent(&event_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("create event failed");
+        return FAILED;
+    }
+    return Bind(model);
+}
+
+Result ModelContext::Bind(const shared_ptr<const ModelProcess> &model)
+{
+    if (model == model_) {
+        return SUCCESS;
+    }
+    if ((model == nullptr) || (model->GetModelDesc() == nullptr)) {
+        ERROR_LOG("model is not ready, bind failed");
+        return FAILED;
+    }
+    // 通常只重建dataset 底层buffer不变 放不下其他模型时才重新申请更大的buffer
+    DestroyDatasets();
+    if (!capacity_.Fits(model->GetIoSizes())) {
+        INFO_LOG("grow buffers of model context for a larger model");
+        DestroyBuffers();
+        capacity_.Merge(model->GetIoSizes());
+        if (CreateBuffers() != SUCCESS) {
+            return FAILED;
+        }
+    }
+    model_ = model;
+    batchSize_ = model_->GetMaxBatchSize();
+    inputSize_ = aclmdlGetInputSizeByIndex(model_->GetModelDesc(), 0);
+    return CreateDatasets();
+}
+
+bool ModelContext::CanBind(const shared_ptr<const ModelProcess> &model) const
+{
+    return (model != nullptr) && ((model == model_) || capacity_.Fits(model->GetIoSizes()));
+}
+
+void ModelContext::Unbind()
+{
+    // 最后一个引用释放时模型在这里卸载
+    DestroyDatasets();
+    model_.reset();
+}
+
+Result ModelContext::Warmup(aclrtStream stream, const WarmupPolicy &policy, WarmupResult &result)
+{
+    result = WarmupResult();
+    result.batchSize = model_->GetMaxBatchSize();
+    if (policy.minIterations == 0) {
+        return SUCCESS;
+    }
+    for (size_t i = 0; i < aclmdlGetDatasetNumBuffers(input_); ++i) {
+        size_t len = aclGetDataBufferSizeV2(aclmdlGetDatasetBuffer(input_, i));
+        aclError ret = aclrtMemset(inputDevBuffers_[i], len, 0, len);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("memset input %zu failed, ret[%d]", i, ret);
+            return FAILED;
+        }
+    }
+    // 档位tensor在清零之后设置
+    const vector<ImageSize> &imageSizes = model_->GetImageSizes();
+    ImageSize imageSize = imageSizes.empty() ? ImageSize(0, 0) : imageSizes.back();
+    if ((SetBatchSize(model_->GetMaxBatchSize()) != SUCCESS) ||
+        (SetImageSize(imageSize.first, imageSize.second) != SUCCESS)) {
+        return FAILED;
+    }
+
+    size_t window = min(WARMUP_STABLE_WINDOW, policy.minIterations);
+    vector<float> times;
+    while (times.size() < max(policy.minIterations, policy.maxIterations)) {
+        float ms = 0.0f;
+        if ((ExecuteAsync(stream) != SUCCESS) || (Synchronize() != SUCCESS) || (GetElapsedTime(ms) != SUCCESS)) {
+            return FAILED;
+        }
+        times.push_back(ms);
+        if (times.size() < policy.minIterations) {
+            continue;
+        }
+        // 最近几次执行的时延差距在阈值内 认为已经稳定
+        vector<float>::const_iterator last = times.end() - window;
+        float fastest = *min_element(last, times.cend());
+        float slowest = *max_element(last, times.cend());
+        result.steadyMs = accumulate(last, times.cend(), 0.0f) / window;
+        if (slowest <= fastest * (1.0 + policy.stableRatio)) {
+            result.stable = true;
+            break;
+        }
+    }
+    result.firstMs = times.front();
+    result.iterations = times.size();
+    return SUCCESS;
+}
+
+Result ModelContext::CreateBuffers()
+{
+	// 每个输入都要有buffer 输入0是图片数据 其余如动态batch的档位tensor只在device上
+    for (size_t i = 0; i < capacity_.inputSizes.size(); ++i) {
+        void *inputBuffer = nullptr;
+        aclError ret = aclrtMalloc(&inputBuffer, capacity_.inputSizes[i], ACL_MEM_MALLOC_NORMAL_ONLY);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("can't malloc input device buffer, size is %zu", capacity_.inputSizes[i]);
+            return FAILED;
+        }
+        inputDevBuffers_.push_back(inputBuffer);
+    }
+	// 每个输出申请device内存 host 模式下还需要回传用的锁页内存
+    for (size_t i = 0; i < capacity_.outputSizes.size(); ++i) {
+        void *outputBuffer = nullptr;
+        aclError ret = aclrtMalloc(&outputBuffer, capacity_.outputSizes[i], ACL_MEM_MALLOC_NORMAL_ONLY);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("can't malloc buffer, size is %zu, create output failed", capacity_.outputSizes[i]);
+            return FAILED;
+        }
+        outputDevBuffers_.push_back(outputBuffer);
+        if (!g_isDevice) {
+            void *outputHostBuffer = nullptr;
+            ret = aclrtMallocHost(&outputHostBuffer, capacity_.outputSizes[i]);
+            if (ret != ACL_ERROR_NONE) {
+                ERROR_LOG("can't malloc output host buffer, size is %zu", capacity_.outputSizes[i]);
+                return FAILED;
+            }
+            outputHostBuffers_.push_back(outputHostBuffer);
+        }
+    }
+    if (!g_isDevice && !capacity_.inputSizes.empty()) {
+        aclError ret = aclrtMallocHost(&inputHostBuffer_, capacity_.inputSizes[0]);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("can't malloc input host buffer, size is %zu", capacity_.inputSizes[0]);
+            return FAILED;
+        }
+    }
+    return SUCCESS;
+}
+
+Result ModelContext::CreateDatasets()
+{
+    aclmdlDesc *modelDesc = model_->GetModelDesc();
+    input_ = aclmdlCreateDataset();
+    output_ = aclmdlCreateDataset();
+    if ((input_ == nullptr) || (output_ == nullptr)) {
+        ERROR_LOG("can't create dataset, create input and output failed");
+        return FAILED;
+    }
+    size_t inputNum = aclmdlGetNumInputs(modelDesc);
+    for (size_t i = 0; i < inputNum; ++i) {
+        aclDataBuffer *inputData = aclCreateDataBuffer(inputDevBuffers_[i], aclmdlGetInputSizeByIndex(modelDesc, i));
+        if (inputData == nullptr) {
+            ERROR_LOG("can't create data buffer, create input failed");
+            return FAILED;
+        }
+        aclError ret = aclmdlAddDatasetBuffer(input_, inputData);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("add input dataset buffer failed");
+            (void)aclDestroyDataBuffer(inputData);
+            return FAILED;
+        }
+    }
+    size_t outputNum = aclmdlGetNumOutputs(modelDesc);
+    for (size_t i = 0; i < outputNum; ++i) {
+        aclDataBuffer *outputData = aclCreateDataBuffer(outputDevBuffers_[i], aclmdlGetOutputSizeByIndex(modelDesc, i));
+        if (outputData == nullptr) {
+            ERROR_LOG("can't create data buffer, create output failed");
+            return FAILED;
+        }
+        aclError ret = aclmdlAddDatasetBuffer(output_, outputData);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("can't add data buffer, create output failed");
+            (void)aclDestroyDataBuffer(outputData);
+            return FAILED;
+        }
+    }
+    return SUCCESS;
+}
+
+void ModelContext::DestroyDatasets()
+{
+    aclmdlDataset *datasets[] = { input_, output_ };
+    for (size_t n = 0; n < sizeof(datasets) / sizeof(datasets[0]); ++n) {
+        if (datasets[n] == nullptr) {
+            continue;
+        }
+        for (size_t i = 0; i < aclmdlGetDatasetNumBuffers(datasets[n]); ++i) {
+            (void)aclDestroyDataBuffer(aclmdlGetDatasetBuffer(datasets[n], i));
+        }
+        (void)aclmdlDestroyDataset(datasets[n]);
+    }
+    input_ = nullptr;
+    output_ = nullptr;
+}
+
+void ModelContext::Destroy()
+{
+    aclrtEvent *events[] = { &startEvent_, &event_ };
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); ++i) {
+        if (*events[i] != nullptr) {
+            (void)aclrtDestroyEvent(*events[i]);
+            *events[i] = nullptr;
+        }
+    }
+    DestroyDatasets();
+    DestroyBuffers();
+    inputSize_ = 0;
+    capacity_ = ModelIoSizes();
+    // 最后释放对模型的引用 模型在所有context都释放后才会卸载
+    model_.reset();
+}
+
+void ModelContext::DestroyBuffers()
+{
+    for (size_t i = 0; i < inputDevBuffers_.size(); ++i) {
+        (void)aclrtFree(inputDevBuffers_[i]);
+    }
+    inputDevBuffers_.clear();
+    for (size_t i = 0; i < outputDevBuffers_.size(); ++i) {
+        (void)aclrtFree(outputDevBuffers_[i]);
+    }
+    outputDevBuffers_.clear();
+    for (size_t i = 0; i < outputHostBuffers_.size(); ++i) {
+        (void)aclrtFreeHost(outputHostBuffers_[i]);
+    }
+    outputHostBuffers_.clear();
+    if (inputHostBuffer_ != nullptr) {
+        (void)aclrtFreeHost(inputHostBuffer_);
+        inputHostBuffer_ = nullptr;
+    }
+}
+
+Result ModelContext::Execute(const void *inputData, size_t dataSize, InferResult &result)
+{
+    if (dataSize > inputSize_) {
+        ERROR_LOG("input size %zu exceeds model input size %zu", dataSize, inputSize_);
+        return FAILED;
+    }
+    aclError ret = aclrtMemcpy(inputDevBuffers_[0], inputSize_, inputData, dataSize,
+        g_isDevice ? ACL_MEMCPY_DEVICE_TO_DEVICE : ACL_MEMCPY_HOST_TO_DEVICE);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("memcpy input failed, ret[%d]", ret);
+        return FAILED;
+    }
+    if ((SetBatchSize(1) != SUCCESS) || (model_->Execute(input_, output_) != SUCCESS)) {
+        return FAILED;
+    }
+    for (size_t i = 0; i < outputHostBuffers_.size(); ++i) {
+        size_t len = aclmdlGetOutputSizeByIndex(model_->GetModelDesc(), i);
+        ret = aclrtMemcpy(outputHostBuffers_[i], len, outputDevBuffers_[i], len, ACL_MEMCPY_DEVICE_TO_HOST);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("memcpy output failed, ret[%d]", ret);
+            return FAILED;
+        }
+    }
+    return GetResult(result);
+}
+
+Result ModelContext::CopyInputAsync(const void *inputData, size_t dataSize, aclrtStream stream)
+{
+    if ((StageInput(0, inputData, dataSize) != SUCCESS) || (SetBatchSize(1) != SUCCESS)) {
+        return FAILED;
+    }
+    return UploadInputAsync(dataSize, stream);
+}
+
+Result ModelContext::StageInput(size_t offset, const void *inputData, size_t dataSize)
+{
+    if ((offset > inputSize_) || (dataSize > inputSize_ - offset)) {
+        ERROR_LOG("input offset %zu size %zu exceeds model input size %zu", offset, dataSize, inputSize_);
+        return FAILED;
+    }
+    if (g_isDevice) {
+        // device 模式下直接同步拷贝到device 不依赖调用方buffer的生命周期
+        aclError ret = aclrtMemcpy(static_cast<uint8_t *>(inputDevBuffers_[0]) + offset, inputSize_ - offset,
+            inputData, dataSize, ACL_MEMCPY_DEVICE_TO_DEVICE);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("memcpy input failed, ret[%d]", ret);
+            return FAILED;
+        }
+        return SUCCESS;
+    }
+    // 先拷贝到自己的锁页内存 再整体异步上传
+    memcpy(static_cast<uint8_t *>(inputHostBuffer_) + offset, inputData, dataSize);
+    return SUCCESS;
+}
+
+Result ModelContext::StageInput(size_t offset, size_t dataSize, const InputWriter &writer)
+{
+    if ((offset > inputSize_) || (dataSize > inputSize_ - offset)) {
+        ERROR_LOG("input offset %zu size %zu exceeds model input size %zu", offset, dataSize, inputSize_);
+        return FAILED;
+    }
+    if (g_isDevice) {
+        // device 模式下输入buffer不能直接写 先写到临时内存
+        vector<uint8_t> sample(dataSize);
+        if (writer(sample.data(), dataSize) != SUCCESS) {
+            return FAILED;
+        }
+        return StageInput(offset, sample.data(), dataSize);
+    }
+    // 直接写到自己的锁页内存 省去一次拷贝
+    return writer(static_cast<uint8_t *>(inputHostBuffer_) + offset, dataSize);
+}
+
+Result ModelContext::UploadInputAsync(size_t dataSize, aclrtStream stream)
+{
+    if (g_isDevice) {
+        return SUCCESS;
+    }
+    aclError ret = aclrtMemcpyAsync(inputDevBuffers_[0], inputSize_, inputHostBuffer_, dataSize,
+        ACL_MEMCPY_HOST_TO_DEVICE, stream);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("memcpy input async failed, ret[%d]", ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result ModelContext::MoveInputAsync(size_t srcOffset, size_t dstOffset, size_t size, aclrtStream stream)
+{
+    // 按buffer的实际大小检查 数据可能是绑定前一个模型时写入的
+    size_t capacity = inputDevBuffers_.empty() ? 0 : capacity_.inputSizes[0];
+    if ((srcOffset > capacity) || (size > capacity - srcOffset) || (dstOffset > capacity) ||
+        (size > capacity - dstOffset)) {
+        ERROR_LOG("move of %zu bytes from %zu to %zu exceeds input buffer size %zu", size, srcOffset, dstOffset,
+            capacity);
+        return FAILED;
+    }
+    uint8_t *input = static_cast<uint8_t *>(inputDevBuffers_[0]);
+    aclError ret = aclrtMemcpyAsync(input + dstOffset, capacity - dstOffset, input + srcOffset, size,
+        ACL_MEMCPY_DEVICE_TO_DEVICE, stream);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("memcpy input on device async failed, ret[%d]", ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result ModelContext::SetBatchSize(size_t batchSize)
+{
+    if (batchSize > model_->GetMaxBatchSize()) {
+        ERROR_LOG("batch size %zu exceeds max batch size %zu", batchSize, model_->GetMaxBatchSize());
+        return FAILED;
+    }
+    // 静态batch模型不足的部分照常计算 只是不回传
+    batchSize_ = batchSize;
+    if (!model_->IsDynamicBatch()) {
+        return SUCCESS;
+    }
+    size_t gear = model_->SelectBatchSize(batchSize);
+    aclError ret = aclmdlSetDynamicBatchSize(model_->GetModelId(), input_, model_->GetDynamicTensorIndex(), gear);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("set dynamic batch size %zu failed, ret[%d]", gear, ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result ModelContext::SetImageSize(uint64_t height, uint64_t width)
+{
+    if (!model_->IsDynamicHW() || (height == 0) || (width == 0)) {
+        return SUCCESS;
+    }
+    aclError ret = aclmdlSetDynamicHWSize(model_->GetModelId(), input_, model_->GetDynamicTensorIndex(),
+        height, width);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("set dynamic hw size %lux%lu failed, ret[%d]", height, width, ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result ModelContext::ExecuteAsync(aclrtStream stream)
+{
+    // 执行前后各记录一个event 用于统计device上执行和回传的耗时
+    aclError ret = aclrtRecordEvent(startEvent_, stream);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("record event failed, ret[%d]", ret);
+        return FAILED;
+    }
+    if (model_->ExecuteAsync(input_, output_, stream) != SUCCESS) {
+        return FAILED;
+    }
+    size_t outputNum = aclmdlGetDatasetNumBuffers(output_);
+    for (size_t i = 0; (i < outputNum) && !g_isDevice; ++i) {
+        size_t len = aclGetDataBufferSizeV2(aclmdlGetDatasetBuffer(output_, i));
+        size_t copyLen = min(len, model_->GetSampleOutputSize(i) * batchSize_);
+        ret = aclrtMemcpyAsync(outputHostBuffers_[i], len, outputDevBuffers_[i], copyLen,
+            ACL_MEMCPY_DEVICE_TO_HOST, stream);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("memcpy output async failed, ret[%d]", ret);
+            return FAILED;
+        }
+    }
+    // event 在回传之后记录 event完成即表示结果已经可读
+    ret = aclrtRecordEvent(event_, stream);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("record event failed, ret[%d]", ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result ModelContext::Synchronize()
+{
+    aclError ret = aclrtSynchronizeEvent(event_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("synchronize event failed, ret[%d]", ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result ModelContext::GetElapsedTime(float &ms) const
+{
+    aclError ret = aclrtEventElapsedTime(&ms, startEvent_, event_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("get event elapsed time failed, ret[%d]", ret);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+const void *ModelContext::GetOutputData(size_t index, size_t &len) const
+{
+    aclDataBuffer *dataBuffer = aclmdlGetDatasetBuffer(output_, index);
+    len = aclGetDataBufferSizeV2(dataBuffer);
+    // device 模式下直接读device内存 host 模式下读回传后的锁页内存
+    return g_isDevice ? aclGetDataBufferAddr(dataBuffer) : outputHostBuffers_[index];
+}
+
+Result ModelContext::GetResult(InferResult &result) const
+{
+    return GetResult(0, result);
+}
+
+Result ModelContext::GetResult(size_t index, InferResult &result) const
+{
+    if ((output_ == nullptr) || (aclmdlGetDatasetNumBuffers(output_) == 0)) {
+        ERROR_LOG("model context has no output");
+        return FAILED;
+    }
+    if (index >= model_->GetMaxBatchSize()) {
+        ERROR_LOG("sample index %zu exceeds max batch size %zu", index, model_->GetMaxBatchSize());
+        return FAILED;
+    }
+	// 输出按batch顺序排列 第index个样本的结果位于index * 单样本大小处
+    size_t len = 0;
+    size_t sampleLen = model_->GetSampleOutputSize(0);
+    const uint8_t *outData = static_cast<const uint8_t *>(GetOutputData(0, len)) + index * sampleLen;
+    const float *scores = reinterpret_cast<const float *>(outData);
+    result.scores.assign(scores, scores + sampleLen / sizeof(float));
+    result.ret = SUCCESS;
+    return SUCCESS;
+}
+
+void ModelContext::DumpModelOutputResult() const
+{
+    static int executeNum = 0;
+    ++executeNum;
+    size_t outputNum = aclmdlGetDatasetNumBuffers(output_);
+    for (size_t i = 0; i < outputNum; ++i) {
+        stringstream ss;
+        ss << "output" << executeNum << "_" << i << ".bin";
+        string outputFileName = ss.str();
+        FILE *outputFile = fopen(outputFileName.c_str(), "wb");
+        if (outputFile == nullptr) {
+            ERROR_LOG("create output file [%s] failed", outputFileName.c_str());
+            return;
+        }
+        size_t len = 0;
+        const void *data = GetOutputData(i, len);
+        fwrite(data, len, sizeof(char), outputFile);
+        fclose(outputFile);
+    }
+
+    INFO_LOG("dump data success");
+}
+
+void ModelContext::OutputModelResult() const
+{
+    const size_t topNum = 5;
+    for (size_t i = 0; i < aclmdlGetDatasetNumBuffers(output_); ++i) {
+        size_t len = 0;
+        const float *outData = reinterpret_cast<const float *>(GetOutputData(i, len));
+        Utils::PrintTopResult(vector<float>(outData, outData + len / sizeof(float)), topNum);
+    }
+
+    INFO_LOG("output data success");
+}
+
+size_t ModelContext::GetInputSize() const
+{
+    return inputSize_;
+}
+
+const shared_ptr<const ModelProcess> &ModelContext::GetModel() const
+{
+    return model_;
+}
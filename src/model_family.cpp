@@ -0,0 +1,472 @@
+/**
+* @file model_family.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "model_family.h"
+#include <algorithm>
+#include "model_context.h"
+#include "model_file_cache.h"
+#include "startup_timeline.h"
+#include "acl/acl.h"
+using namespace std;
+
+namespace {
+const double LATENCY_SMOOTHING = 0.2;  // weight of the newest measurement
+const chrono::seconds IDLE_CHECK_INTERVAL(1);
+
+bool LessBatch(const ModelVariant &a, const ModelVariant &b)
+{
+    return a.batchSize < b.batchSize;
+}
+}
+
+ModelFamily::ModelFamily() : idleUnload_(0)
+{
+}
+
+ModelFamily::~ModelFamily()
+{
+    Unload();
+}
+
+Result ModelFamily::LoadVariant(ModelVariant &variant)
+{
+    // 已卸载但仍被某个slot绑定的模型直接复用 不重复加载
+    variant.model = variant.released.lock();
+    if (variant.model != nullptr) {
+        return SUCCESS;
+    }
+    TimelineStage stage("load model " + variant.path);
+    shared_ptr<ModelProcess> model(new ModelProcess());
+    // 启动时预读过的模型文件直接从内存加载
+    ModelFileData data = ModelFileCache::Instance().Get(variant.path);
+    Result ret = (data != nullptr) ?
+        model->LoadModelFromMemWithMem(data->data(), data->size(), variant.path.c_str()) :
+        model->LoadModelFromFileWithMem(variant.path.c_str());
+    if ((ret != SUCCESS) || (model->CreateDesc() != SUCCESS)) {
+        ERROR_LOG("load model variant %s failed", variant.path.c_str());
+        return FAILED;
+    }
+    variant.model = model;
+    return SUCCESS;
+}
+
+Result ModelFamily::Load(const vector<string> &paths, uint32_t idleUnloadSec)
+{
+    if (paths.empty()) {
+        ERROR_LOG("no model path, load model family failed");
+        return FAILED;
+    }
+    lock_guard<mutex> lock(mutex_);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        ModelVariant variant;
+        variant.path = paths[i];
+        if (LoadVariant(variant) != SUCCESS) {
+            return FAILED;
+        }
+        variant.batchSize = variant.model->GetMaxBatchSize();
+        variant.lastUsed = chrono::steady_clock::now();
+        variants_.push_back(variant);
+    }
+    sort(variants_.begin(), variants_.end(), LessBatch);
+
+    // 各变体的单样本输入必须一致 请求才能在变体之间任意调度
+    size_t sampleSize = variants_[0].model->GetSampleInputSize();
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        if ((variants_[i].model->GetSampleInputSize() != sampleSize) ||
+            (variants_[i].model->GetImageSizes() != variants_[0].model->GetImageSizes())) {
+            ERROR_LOG("sample input size or image sizes of %s differ from %s", variants_[i].path.c_str(),
+                variants_[0].path.c_str());
+            return FAILED;
+        }
+        if ((i > 0) && (variants_[i].batchSize == variants_[i - 1].batchSize)) {
+            WARN_LOG("%s and %s have the same batch size %zu", variants_[i - 1].path.c_str(),
+                variants_[i].path.c_str(), variants_[i].batchSize);
+        }
+        capacity_.Merge(variants_[i].model->GetIoSizes());
+        INFO_LOG("model variant %s, batch %zu", variants_[i].path.c_str(), variants_[i].batchSize);
+    }
+    idleUnload_ = chrono::seconds(idleUnloadSec);
+    lastIdleCheck_ = chrono::steady_clock::now();
+    return SUCCESS;
+}
+
+shared_ptr<const ModelProcess> ModelFamily::Acquire(size_t batchSize)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (variants_.empty()) {
+        return nullptr;
+    }
+    size_t index = variants_.size() - 1;
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        if (variants_[i].batchSize >= batchSize) {
+            index = i;
+            break;
+        }
+    }
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    // 已卸载但仍被某个slot绑定的模型直接复用
+    if (variants_[index].model == nullptr) {
+        variants_[index].model = variants_[index].released.lock();
+    }
+    // 已卸载的变体由registry在锁外加载和预热 加载完成前由更大的已加载变体执行 最大的变体始终保留
+    if (variants_[index].model == nullptr) {
+        variants_[index].wanted = true;
+        while ((index + 1 < variants_.size()) && (variants_[index].model == nullptr)) {
+            ++index;
+        }
+    }
+    ModelVariant &variant = variants_[index];
+    variant.lastUsed = now;
+    if ((idleUnload_.count() > 0) && (now - lastIdleCheck_ >= IDLE_CHECK_INTERVAL)) {
+        UnloadIdleVariants(now);
+    }
+    return variant.model;
+}
+
+bool ModelFamily::TakeWantedVariant(size_t &index, string &path)
+{
+    lock_guard<mutex> lock(mutex_);
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        ModelVariant &variant = variants_[i];
+        if (!variant.wanted || variant.loading) {
+            continue;
+        }
+        variant.wanted = false;
+        if (variant.model != nullptr) {
+            continue;
+        }
+        variant.loading = true;
+        index = i;
+        path = variant.path;
+        return true;
+    }
+    return false;
+}
+
+Result ModelFamily::LoadIdleVariant(size_t index, const WarmupPolicy &policy)
+{
+    ModelVariant loaded;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if ((index >= variants_.size()) || !variants_[index].loading) {
+            return FAILED;
+        }
+        loaded.path = variants_[index].path;
+    }
+    // 加载和预热时不持锁 其他lane继续使用已加载的变体
+    Result ret = LoadVariant(loaded);
+    WarmupResult result;
+    if ((ret == SUCCESS) && (policy.minIterations > 0)) {
+        aclrtStream stream = nullptr;
+        aclError aclRet = aclrtCreateStream(&stream);
+        if (aclRet != ACL_ERROR_NONE) {
+            ERROR_LOG("create warmup stream failed, ret[%d]", aclRet);
+            ret = FAILED;
+        } else {
+            ret = WarmupModel(loaded.model, stream, policy, result);
+            (void)aclrtDestroyStream(stream);
+        }
+    }
+    lock_guard<mutex> lock(mutex_);
+    if (index >= variants_.size()) {
+        return FAILED;
+    }
+    ModelVariant &variant = variants_[index];
+    variant.loading = false;
+    if (ret != SUCCESS) {
+        ERROR_LOG("load idle model variant %s failed", variant.path.c_str());
+        return FAILED;
+    }
+    variant.model = loaded.model;
+    variant.lastUsed = chrono::steady_clock::now();
+    if ((selector_ != nullptr) && (result.steadyMs > 0.0f)) {
+        selector_->Record(result.batchSize, result.steadyMs);
+    }
+    INFO_LOG("load idle model variant %s again", variant.path.c_str());
+    return SUCCESS;
+}
+
+void ModelFamily::CancelVariantLoad(size_t index)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (index < variants_.size()) {
+        variants_[index].loading = false;
+    }
+}
+
+void ModelFamily::UnloadIdleVariants(chrono::steady_clock::time_point now)
+{
+    lastIdleCheck_ = now;
+    // 最大的变体始终保留 保证任何batch都有模型可用
+    for (size_t i = 0; i + 1 < variants_.size(); ++i) {
+        ModelVariant &variant = variants_[i];
+        if ((variant.model != nullptr) && (now - variant.lastUsed >= idleUnload_)) {
+            INFO_LOG("unload idle model variant %s", variant.path.c_str());
+            variant.released = variant.model;
+            variant.model.reset();
+        }
+    }
+}
+
+Result ModelFamily::Warmup(const WarmupPolicy &policy, vector<WarmupResult> &results)
+{
+    results.clear();
+    if (policy.minIterations == 0) {
+        return SUCCESS;
+    }
+    aclrtStream stream = nullptr;
+    aclError aclRet = aclrtCreateStream(&stream);
+    if (aclRet != ACL_ERROR_NONE) {
+        ERROR_LOG("create warmup stream failed, ret[%d]", aclRet);
+        return FAILED;
+    }
+    Result ret = SUCCESS;
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (size_t i = 0; (i < variants_.size()) && (ret == SUCCESS); ++i) {
+            if (variants_[i].model == nullptr) {
+                continue;
+            }
+            WarmupResult result;
+            ret = WarmupModel(variants_[i].model, stream, policy, result);
+            if (ret != SUCCESS) {
+                ERROR_LOG("warm up model variant %s failed", variants_[i].path.c_str());
+                break;
+            }
+            results.push_back(result);
+            // 预热的稳定时延作为选择batch大小的初始值
+            if ((selector_ != nullptr) && (result.steadyMs > 0.0f)) {
+                selector_->Record(result.batchSize, result.steadyMs);
+            }
+        }
+    }
+    (void)aclrtDestroyStream(stream);
+    return ret;
+}
+
+Result ModelFamily::WarmupModel(const shared_ptr<ModelProcess> &model, aclrtStream stream,
+    const WarmupPolicy &policy, WarmupResult &result)
+{
+    ModelContext context;
+    Result ret = context.Init(model);
+    if (ret == SUCCESS) {
+        ret = context.Warmup(stream, policy, result);
+    }
+    return ret;
+}
+
+bool ModelFamily::IsCompatible(const ModelFamily &other) const
+{
+    if (&other == this) {
+        return true;
+    }
+    // 两个锁按地址顺序获取 避免互相等待
+    unique_lock<mutex> first(this < &other ? mutex_ : other.mutex_);
+    unique_lock<mutex> second(this < &other ? other.mutex_ : mutex_);
+    if ((variants_.size() != other.variants_.size()) || variants_.empty()) {
+        return false;
+    }
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        if (variants_[i].batchSize != other.variants_[i].batchSize) {
+            return false;
+        }
+    }
+    shared_ptr<const ModelProcess> a = variants_.back().model;
+    shared_ptr<const ModelProcess> b = other.variants_.back().model;
+    return (a->GetSampleInputSize() == b->GetSampleInputSize()) && (a->GetImageSizes() == b->GetImageSizes()) &&
+        (a->GetIoSizes().outputSizes == b->GetIoSizes().outputSizes);
+}
+
+void ModelFamily::Retire()
+{
+    lock_guard<mutex> lock(mutex_);
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        if (variants_[i].model != nullptr) {
+            variants_[i].model->Retire();
+        }
+        shared_ptr<ModelProcess> released = variants_[i].released.lock();
+        if (released != nullptr) {
+            released->Retire();
+        }
+    }
+}
+
+shared_ptr<const ModelProcess> ModelFamily::GetModel() const
+{
+    lock_guard<mutex> lock(mutex_);
+    if (variants_.empty()) {
+        return nullptr;
+    }
+    return variants_.back().model;
+}
+
+ModelIoSizes ModelFamily::GetIoCapacity() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return capacity_;
+}
+
+vector<size_t> ModelFamily::GetBatchSizes() const
+{
+    lock_guard<mutex> lock(mutex_);
+    vector<size_t> batchSizes;
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        batchSizes.push_back(variants_[i].batchSize);
+    }
+    return batchSizes;
+}
+
+size_t ModelFamily::GetDeviceMemSize() const
+{
+    lock_guard<mutex> lock(mutex_);
+    size_t size = 0;
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        if (variants_[i].model != nullptr) {
+            size += variants_[i].model->GetDeviceMemSize();
+        }
+    }
+    return size;
+}
+
+Result ModelFamily::QueryDeviceMemSize(const vector<string> &paths, size_t &size)
+{
+    size = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        size_t workSize = 0;
+        size_t weightSize = 0;
+        aclError ret = aclmdlQuerySize(paths[i].c_str(), &workSize, &weightSize);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("query model failed, model file is %s", paths[i].c_str());
+            return FAILED;
+        }
+        size += workSize + weightSize;
+    }
+    return SUCCESS;
+}
+
+void ModelFamily::SetSelector(const shared_ptr<VariantSelector> &selector)
+{
+    vector<size_t> batchSizes = GetBatchSizes();
+    if (selector != nullptr) {
+        selector->SetBatchSizes(batchSizes);
+    }
+    lock_guard<mutex> lock(mutex_);
+    selector_ = selector;
+}
+
+shared_ptr<VariantSelector> ModelFamily::GetSelector() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return selector_;
+}
+
+void ModelFamily::Unload()
+{
+    lock_guard<mutex> lock(mutex_);
+    variants_.clear();
+    capacity_ = ModelIoSizes();
+}
+
+VariantSelector::VariantSelector()
+{
+}
+
+void VariantSelector::SetBatchSizes(const vector<size_t> &batchSizes)
+{
+    lock_guard<mutex> lock(mutex_);
+    // 每个device加载时都会设置 变体不变时保留已测得的时延
+    if (batchSizes == batchSizes_) {
+        return;
+    }
+    batchSizes_ = batchSizes;
+    latencyMs_.assign(batchSizes_.size(), 0.0);
+}
+
+void VariantSelector::Record(size_t batchSize, float ms)
+{
+    lock_guard<mutex> lock(mutex_);
+    for (size_t i = 0; i < batchSizes_.size(); ++i) {
+        if (batchSizes_[i] != batchSize) {
+            continue;
+        }
+        if (latencyMs_[i] <= 0.0) {
+            latencyMs_[i] = ms;
+        } else {
+            latencyMs_[i] += LATENCY_SMOOTHING * (ms - latencyMs_[i]);
+        }
+        return;
+    }
+}
+
+double VariantSelector::EstimateLatency(size_t index) const
+{
+    if (latencyMs_[index] > 0.0) {
+        return latencyMs_[index];
+    }
+    // 未测量的变体按最近的已测变体估计 估计偏乐观 使其有机会被选中并测量
+    for (size_t distance = 1; distance < batchSizes_.size(); ++distance) {
+        if ((index >= distance) && (latencyMs_[index - distance] > 0.0)) {
+            return latencyMs_[index - distance];
+        }
+        if ((index + distance < batchSizes_.size()) && (latencyMs_[index + distance] > 0.0)) {
+            return latencyMs_[index + distance];
+        }
+    }
+    return 0.0;
+}
+
+double VariantSelector::GetLatency(size_t batchSize) const
+{
+    lock_guard<mutex> lock(mutex_);
+    if (batchSizes_.empty()) {
+        return 0.0;
+    }
+    size_t index = batchSizes_.size() - 1;
+    for (size_t i = 0; i < batchSizes_.size(); ++i) {
+        if (batchSizes_[i] >= batchSize) {
+            index = i;
+            break;
+        }
+    }
+    return EstimateLatency(index);
+}
+
+size_t VariantSelector::Select(size_t pending) const
+{
+    lock_guard<mutex> lock(mutex_);
+    if (batchSizes_.empty()) {
+        return 0;
+    }
+    pending = max(pending, static_cast<size_t>(1));
+    size_t best = batchSizes_.size();
+    double bestCost = 0.0;
+    for (size_t i = 0; i < batchSizes_.size(); ++i) {
+        double latency = EstimateLatency(i);
+        if (latency <= 0.0) {
+            continue;
+        }
+        // 排空当前积压所需的时间 执行次数乘以单次时延
+        size_t rounds = (pending + batchSizes_[i] - 1) / batchSizes_[i];
+        double cost = rounds * latency;
+        if ((best == batchSizes_.size()) || (cost < bestCost)) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+    if (best < batchSizes_.size()) {
+        return batchSizes_[best];
+    }
+    // 还没有任何测量 选能容纳全部积压的最小变体
+    for (size_t i = 0; i < batchSizes_.size(); ++i) {
+        if (batchSizes_[i] >= pending) {
+            return batchSizes_[i];
+        }
+    }
+    return batchSizes_.back();
+}
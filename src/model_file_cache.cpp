@@ -0,0 +1,66 @@
+/**
+* @file model_file_cache.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "model_file_cache.h"
+#include "startup_timeline.h"
+using namespace std;
+
+namespace {
+ModelFileData ReadModelFile(const string &path)
+{
+    TimelineStage stage("read model file " + path);
+    shared_ptr<vector<uint8_t>> data(new vector<uint8_t>());
+    if (Utils::ReadFileToHost(path, *data) != SUCCESS) {
+        return nullptr;
+    }
+    return data;
+}
+}
+
+ModelFileCache &ModelFileCache::Instance()
+{
+    static ModelFileCache cache;
+    return cache;
+}
+
+void ModelFileCache::Prefetch(const string &path)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (files_.count(path) > 0) {
+        return;
+    }
+    files_[path] = async(launch::async, ReadModelFile, path).share();
+}
+
+ModelFileData ModelFileCache::Get(const string &path)
+{
+    shared_future<ModelFileData> file;
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto it = files_.find(path);
+        if (it == files_.end()) {
+            return nullptr;
+        }
+        file = it->second;
+    }
+    return file.get();
+}
+
+void ModelFileCache::Clear()
+{
+    // 等读取线程结束后再释放 避免析构时阻塞在其他地方
+    map<string, shared_future<ModelFileData>> files;
+    {
+        lock_guard<mutex> lock(mutex_);
+        files.swap(files_);
+    }
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        it->second.wait();
+    }
+}
@@ -9,24 +9,52 @@
 */
 #include "model_process.h"
 #include <iostream>
-#include <map>
-#include <sstream>
 #include <algorithm>
 #include "utils.h"
 using namespace std;
-extern bool g_isDevice;
-//构造函数中初始化了参数的初始值 包括了模型ID 内存大小 Model权值，模型内存指针 模型权值指针，加载标识，模型描述信息 输入信息 ，输出信息
+void ModelIoSizes::Merge(const ModelIoSizes &other)
+{
+    inputSizes.resize(max(inputSizes.size(), other.inputSizes.size()), 0);
+    outputSizes.resize(max(outputSizes.size(), other.outputSizes.size()), 0);
+    for (size_t i = 0; i < other.inputSizes.size(); ++i) {
+        inputSizes[i] = max(inputSizes[i], other.inputSizes[i]);
+    }
+    for (size_t i = 0; i < other.outputSizes.size(); ++i) {
+        outputSizes[i] = max(outputSizes[i], other.outputSizes[i]);
+    }
+}
+
+bool ModelIoSizes::Fits(const ModelIoSizes &other) const
+{
+    if ((other.inputSizes.size() > inputSizes.size()) || (other.outputSizes.size() > outputSizes.size())) {
+        return false;
+    }
+    for (size_t i = 0; i < other.inputSizes.size(); ++i) {
+        if (other.inputSizes[i] > inputSizes[i]) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < other.outputSizes.size(); ++i) {
+        if (other.outputSizes[i] > outputSizes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//构造函数中初始化了参数的初始值 包括了模型ID 内存大小 Model权值，模型内存指针 模型权值指针，加载标识，模型描述信息
 ModelProcess::ModelProcess() :modelId_(0), modelMemSize_(0), modelWeightSize_(0), modelMemPtr_(nullptr),
-modelWeightPtr_(nullptr), loadFlag_(false), modelDesc_(nullptr), input_(nullptr), output_(nullptr)
+modelWeightPtr_(nullptr), loadFlag_(false), retired_(false), modelDesc_(nullptr), maxBatchSize_(1),
+dynamicTensorIndex_(0), maxImageArea_(0)
 {
 }
 
 ModelProcess::~ModelProcess()
 {
-    Unload();
+    if (loadFlag_) {
+        Unload();
+    }
     DestroyDesc();
-    DestroyInput();
-    DestroyOutput();
 }
 
 // 主要是分配内存 加载模型
@@ -45,17 +73,7 @@ Result ModelProcess::LoadModelFromFileWithMem(const char *modelPath)
         ERROR_LOG("query model failed, model file is %s", modelPath);
         return FAILED;
     }
-	// 查询后。在Device申请modelMemSize_大小的线性内存，modelMemPtr_ 返回已分配内存的指针
-
-    ret = aclrtMalloc(&modelMemPtr_, modelMemSize_, ACL_MEM_MALLOC_HUGE_FIRST); //大页内存
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("malloc buffer for mem failed, require size is %zu", modelMemSize_);
-        return FAILED;
-    }
-	// 与上述相同 分配权值内存大小的内存块给到modelWeightPtr_
-    ret = aclrtMalloc(&modelWeightPtr_, modelWeightSize_, ACL_MEM_MALLOC_HUGE_FIRST);
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("malloc buffer for weight failed, require size is %zu", modelWeightSize_);
+    if (MallocModelMem() != SUCCESS) {
         return FAILED;
     }
 	// 从文件加载离线模型数据（适配昇腾AI处理器的离线模型） 
@@ -66,6 +84,7 @@ Result ModelProcess::LoadModelFromFileWithMem(const char *modelPath)
         modelMemSize_, modelWeightPtr_, modelWeightSize_);
     if (ret != ACL_ERROR_NONE) {
         ERROR_LOG("load model from file failed, model file is %s", modelPath);
+        FreeModelMem();
         return FAILED;
     }
 
@@ -73,6 +92,70 @@ Result ModelProcess::LoadModelFromFileWithMem(const char *modelPath)
     INFO_LOG("load model %s success", modelPath);
     return SUCCESS;
 }
+// 模型文件已经读到内存中 从内存加载 省去加载时读文件的时间
+Result ModelProcess::LoadModelFromMemWithMem(const void *model, size_t modelSize, const char *modelName)
+{
+    if (loadFlag_) {
+        ERROR_LOG("has already loaded a model");
+        return FAILED;
+    }
+    aclError ret = aclmdlQuerySizeFromMem(model, modelSize, &modelMemSize_, &modelWeightSize_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("query model from mem failed, model is %s", modelName);
+        return FAILED;
+    }
+    if (MallocModelMem() != SUCCESS) {
+        return FAILED;
+    }
+    ret = aclmdlLoadFromMemWithMem(model, modelSize, &modelId_, modelMemPtr_,
+        modelMemSize_, modelWeightPtr_, modelWeightSize_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("load model from mem failed, model is %s", modelName);
+        FreeModelMem();
+        return FAILED;
+    }
+
+    loadFlag_ = true;
+    INFO_LOG("load model %s from mem success", modelName);
+    return SUCCESS;
+}
+
+Result ModelProcess::MallocModelMem()
+{
+	// 查询后。在Device申请modelMemSize_大小的线性内存，modelMemPtr_ 返回已分配内存的指针
+    aclError ret = aclrtMalloc(&modelMemPtr_, modelMemSize_, ACL_MEM_MALLOC_HUGE_FIRST); //大页内存
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("malloc buffer for mem failed, require size is %zu", modelMemSize_);
+        modelMemPtr_ = nullptr;
+        return FAILED;
+    }
+	// 与上述相同 分配权值内存大小的内存块给到modelWeightPtr_
+    ret = aclrtMalloc(&modelWeightPtr_, modelWeightSize_, ACL_MEM_MALLOC_HUGE_FIRST);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("malloc buffer for weight failed, require size is %zu", modelWeightSize_);
+        modelWeightPtr_ = nullptr;
+        FreeModelMem();
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+void ModelProcess::FreeModelMem()
+{
+    //释放内存资源
+    if (modelMemPtr_ != nullptr) {
+        aclrtFree(modelMemPtr_);
+        modelMemPtr_ = nullptr;
+    }
+    //释放权值内存资源
+    if (modelWeightPtr_ != nullptr) {
+        aclrtFree(modelWeightPtr_);
+        modelWeightPtr_ = nullptr;
+    }
+    modelMemSize_ = 0;
+    modelWeightSize_ = 0;
+}
+
 //模型文件加载进来以后，进行描述
 // 初始化模型描述信息
 Result ModelProcess::CreateDesc()
@@ -90,12 +173,69 @@ Result ModelProcess::CreateDesc()
         ERROR_LOG("get model description failed");
         return FAILED;
     }
+	// 从描述信息中获取batch档位 决定一次执行最多能放多少个样本
+    if ((InitBatchInfo() != SUCCESS) || (InitImageSizeInfo() != SUCCESS)) {
+        return FAILED;
+    }
 
     INFO_LOG("create model description success");
 
     return SUCCESS;
 }
 
+Result ModelProcess::InitBatchInfo()
+{
+    batchGears_.clear();
+    maxBatchSize_ = 1;
+    aclmdlBatch batch;
+    aclError ret = aclmdlGetDynamicBatch(modelDesc_, &batch);
+    if ((ret == ACL_ERROR_NONE) && (batch.batchCount > 0)) {
+        ret = aclmdlGetInputIndexByName(modelDesc_, ACL_DYNAMIC_TENSOR_NAME, &dynamicTensorIndex_);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("get dynamic batch tensor index failed");
+            return FAILED;
+        }
+        batchGears_.assign(batch.batch, batch.batch + batch.batchCount);
+        sort(batchGears_.begin(), batchGears_.end());
+        maxBatchSize_ = batchGears_.back();
+        INFO_LOG("model has %zu dynamic batch gears, max batch is %zu", batchGears_.size(), maxBatchSize_);
+        return SUCCESS;
+    }
+
+	// 静态模型 batch为输入0的第一维
+    aclmdlIODims dims;
+    ret = aclmdlGetInputDims(modelDesc_, 0, &dims);
+    if ((ret == ACL_ERROR_NONE) && (dims.dimCount > 0) && (dims.dims[0] > 0)) {
+        maxBatchSize_ = static_cast<size_t>(dims.dims[0]);
+    }
+    INFO_LOG("model has static batch %zu", maxBatchSize_);
+    return SUCCESS;
+}
+
+Result ModelProcess::InitImageSizeInfo()
+{
+    imageSizes_.clear();
+    maxImageArea_ = 0;
+    aclmdlHW hw;
+	// index为预留参数 固定填-1
+    aclError ret = aclmdlGetDynamicHW(modelDesc_, static_cast<size_t>(-1), &hw);
+    if ((ret != ACL_ERROR_NONE) || (hw.hwCount == 0)) {
+        return SUCCESS;
+    }
+    ret = aclmdlGetInputIndexByName(modelDesc_, ACL_DYNAMIC_TENSOR_NAME, &dynamicTensorIndex_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("get dynamic hw tensor index failed");
+        return FAILED;
+    }
+    for (size_t i = 0; i < hw.hwCount; ++i) {
+        imageSizes_.push_back(ImageSize(hw.hw[i][0], hw.hw[i][1]));
+        maxImageArea_ = max(maxImageArea_, hw.hw[i][0] * hw.hw[i][1]);
+    }
+    sort(imageSizes_.begin(), imageSizes_.end());
+    INFO_LOG("model has %zu dynamic image size gears", imageSizes_.size());
+    return SUCCESS;
+}
+
 void ModelProcess::DestroyDesc()
 {
     if (modelDesc_ != nullptr) {
@@ -104,233 +244,119 @@ void ModelProcess::DestroyDesc()
     }
 }
 
-// 
-Result ModelProcess::CreateInput(void *inputDataBuffer, size_t bufferSize)
+Result ModelProcess::Execute(const aclmdlDataset *input, aclmdlDataset *output) const
 {
-	// 创建一个用于描述模型推理时的输入数据、输出数据的结构（aclmdlDataset类型）
-    input_ = aclmdlCreateDataset();// 此input_只存放输入
-    if (input_ == nullptr) {
-        ERROR_LOG("can't create dataset, create input failed");
-        return FAILED;
-    }
-	// 通过输入参数的内存 来初始化inputData（aclDataBuffer类型）
-    aclDataBuffer* inputData = aclCreateDataBuffer(inputDataBuffer, bufferSize);
-    if (inputData == nullptr) {
-        ERROR_LOG("can't create data buffer, create input failed");
+	// 执行模型推理，直到返回推理结果 输入输出由调用方的ModelContext提供
+    aclError ret = aclmdlExecute(modelId_, input, output);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("execute model failed, modelId is %u", modelId_);
         return FAILED;
     }
-	// 将数据保存到input_ （把inputData，放到input_ 中（aclmdlDataset类型））
-    aclError ret = aclmdlAddDatasetBuffer(input_, inputData);
+    return SUCCESS;
+}
+
+Result ModelProcess::ExecuteAsync(const aclmdlDataset *input, aclmdlDataset *output, aclrtStream stream) const
+{
+	// 异步下发推理任务到stream 结果需要通过event或stream同步后才可读
+    aclError ret = aclmdlExecuteAsync(modelId_, input, output, stream);
     if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("add input dataset buffer failed");
-        aclDestroyDataBuffer(inputData);
-        inputData = nullptr;
+        ERROR_LOG("execute model async failed, modelId is %u", modelId_);
         return FAILED;
     }
-
     return SUCCESS;
 }
 
-void ModelProcess::DestroyInput()
+uint32_t ModelProcess::GetModelId() const
 {
-    if (input_ == nullptr) {
-        return;
-    }
+    return modelId_;
+}
 
-    for (size_t i = 0; i < aclmdlGetDatasetNumBuffers(input_); ++i) {
-        aclDataBuffer* dataBuffer = aclmdlGetDatasetBuffer(input_, i);
-        aclDestroyDataBuffer(dataBuffer);
-    }
-    aclmdlDestroyDataset(input_);
-    input_ = nullptr;
+aclmdlDesc *ModelProcess::GetModelDesc() const
+{
+    return modelDesc_;
 }
 
-Result ModelProcess::CreateOutput()
+size_t ModelProcess::GetMaxBatchSize() const
 {
-	// 需要有模型描述信息
-    if (modelDesc_ == nullptr) {
-        ERROR_LOG("no model description, create ouput failed");
-        return FAILED;
-    }
-	// 创建一个用于描述模型推理时的输入数据、输出数据的结构（aclmdlDataset类型）
-    output_ = aclmdlCreateDataset(); // 此output_只存放输出
-    if (output_ == nullptr) {
-        ERROR_LOG("can't create dataset, create output failed");
-        return FAILED;
-    }
-	// 通过模型描述信息获取模型的输出个数。
-    size_t outputSize = aclmdlGetNumOutputs(modelDesc_);
-	
-    for (size_t i = 0; i < outputSize; ++i) {
-		// 根据模型描述信息获取第i个输出的字节数
-        size_t buffer_size = aclmdlGetOutputSizeByIndex(modelDesc_, i);
+    return maxBatchSize_;
+}
 
-        void *outputBuffer = nullptr;
-		// 申请内存
-        aclError ret = aclrtMalloc(&outputBuffer, buffer_size, ACL_MEM_MALLOC_NORMAL_ONLY);//申请了普通页内存
-        if (ret != ACL_ERROR_NONE) {
-            ERROR_LOG("can't malloc buffer, size is %zu, create output failed", buffer_size);
-            return FAILED;
-        }
-		// 通过申请的内存 来初始化outputData（aclDataBuffer类型）
-        aclDataBuffer* outputData = aclCreateDataBuffer(outputBuffer, buffer_size);
-        if (ret != ACL_ERROR_NONE) {
-            ERROR_LOG("can't create data buffer, create output failed");
-            aclrtFree(outputBuffer);
-            return FAILED;
-        }
-		// 将数据保存到output_ （把outputData，放到output_中（aclmdlDataset类型））
-        ret = aclmdlAddDatasetBuffer(output_, outputData);
-        if (ret != ACL_ERROR_NONE) {
-            ERROR_LOG("can't add data buffer, create output failed");
-            aclrtFree(outputBuffer);
-            aclDestroyDataBuffer(outputData);
-            return FAILED;
-        }
-    }
+bool ModelProcess::IsDynamicBatch() const
+{
+    return !batchGears_.empty();
+}
 
-    INFO_LOG("create model output success");
-    return SUCCESS;
+size_t ModelProcess::GetDynamicTensorIndex() const
+{
+    return dynamicTensorIndex_;
 }
 
-void ModelProcess::DumpModelOutputResult()
+size_t ModelProcess::SelectBatchSize(size_t batchSize) const
 {
-    stringstream ss;
-    size_t outputNum = aclmdlGetDatasetNumBuffers(output_);
-    static int executeNum = 0;
-    for (size_t i = 0; i < outputNum; ++i) {
-        ss << "output" << ++executeNum << "_" << i << ".bin";
-        string outputFileName = ss.str();
-        FILE *outputFile = fopen(outputFileName.c_str(), "wb");
-        if (outputFile) {
-            aclDataBuffer* dataBuffer = aclmdlGetDatasetBuffer(output_, i);
-            void* data = aclGetDataBufferAddr(dataBuffer);
-            uint32_t len = aclGetDataBufferSize(dataBuffer);
-
-            void* outHostData = NULL;
-            aclError ret = ACL_ERROR_NONE;
-            if (!g_isDevice) {
-                ret = aclrtMallocHost(&outHostData, len);
-                if (ret != ACL_ERROR_NONE) {
-                    ERROR_LOG("aclrtMallocHost failed, ret[%d]", ret);
-                    return;
-                }
-
-                ret = aclrtMemcpy(outHostData, len, data, len, ACL_MEMCPY_DEVICE_TO_HOST);
-                if (ret != ACL_ERROR_NONE) {
-                    ERROR_LOG("aclrtMemcpy failed, ret[%d]", ret);
-                    (void)aclrtFreeHost(outHostData);
-                    return;
-                }
-
-                fwrite(outHostData, len, sizeof(char), outputFile);
-
-                ret = aclrtFreeHost(outHostData);
-                if (ret != ACL_ERROR_NONE) {
-                    ERROR_LOG("aclrtFreeHost failed, ret[%d]", ret);
-                    return;
-                }
-            } else {
-                fwrite(data, len, sizeof(char), outputFile);
-            }
-            fclose(outputFile);
-            outputFile = nullptr;
-        } else {
-            ERROR_LOG("create output file [%s] failed", outputFileName.c_str());
-            return;
+    for (size_t i = 0; i < batchGears_.size(); ++i) {
+        if (batchGears_[i] >= batchSize) {
+            return batchGears_[i];
         }
     }
+    return maxBatchSize_;
+}
 
-    INFO_LOG("dump data success");
-    return;
+bool ModelProcess::IsDynamicHW() const
+{
+    return !imageSizes_.empty();
 }
 
-void ModelProcess::OutputModelResult()
+const vector<ImageSize> &ModelProcess::GetImageSizes() const
 {
-	// 遍历Output 获取结果 类似与数组遍历 
-    for (size_t i = 0; i < aclmdlGetDatasetNumBuffers(output_); ++i) {
-		// 结果保存在dataBuffer中
-        aclDataBuffer* dataBuffer = aclmdlGetDatasetBuffer(output_, i);
-        void* data = aclGetDataBufferAddr(dataBuffer);
-        uint32_t len = aclGetDataBufferSize(dataBuffer);
-
-        void *outHostData = NULL;
-        aclError ret = ACL_ERROR_NONE;
-        float *outData = NULL;
-        if (!g_isDevice) {
-            aclError ret = aclrtMallocHost(&outHostData, len);
-            if (ret != ACL_ERROR_NONE) {
-                ERROR_LOG("aclrtMallocHost failed, ret[%d]", ret);
-                return;
-            }
-			// 将结果拷贝出来
-            ret = aclrtMemcpy(outHostData, len, data, len, ACL_MEMCPY_DEVICE_TO_HOST);
-            if (ret != ACL_ERROR_NONE) {
-                ERROR_LOG("aclrtMemcpy failed, ret[%d]", ret);
-                return;
-            }
-
-            outData = reinterpret_cast<float*>(outHostData);
-        } else {
-            outData = reinterpret_cast<float*>(data);
-        }
-		// 拿着所有的结果保存在resultMap中 
-        map<float, unsigned int, greater<float> > resultMap;
-        for (unsigned int j = 0; j < len / sizeof(float); ++j) {
-            resultMap[*outData] = j;
-            outData++;
-        }
-		// 输出前五个最大的值
-        int cnt = 0;
-        for (auto it = resultMap.begin(); it != resultMap.end(); ++it) {
-            // print top 5
-            if (++cnt > 5) {
-                break;
-            }
-
-            INFO_LOG("top %d: index[%d] value[%lf]", cnt, it->second, it->first);
-        }
-        if (!g_isDevice) {
-            ret = aclrtFreeHost(outHostData);
-            if (ret != ACL_ERROR_NONE) {
-                ERROR_LOG("aclrtFreeHost failed, ret[%d]", ret);
-                return;
-            }
-        }
+    return imageSizes_;
+}
+
+size_t ModelProcess::GetSampleInputSize() const
+{
+    return aclmdlGetInputSizeByIndex(modelDesc_, 0) / maxBatchSize_;
+}
+
+size_t ModelProcess::GetSampleInputSize(uint64_t height, uint64_t width) const
+{
+    // 动态分辨率模型的输入大小按最大档位计算 其他档位按面积比例缩小
+    if (!IsDynamicHW() || (height == 0) || (width == 0)) {
+        return GetSampleInputSize();
     }
+    return GetSampleInputSize() / maxImageArea_ * height * width;
+}
 
-    INFO_LOG("output data success");
-    return;
+size_t ModelProcess::GetSampleOutputSize(size_t index) const
+{
+    return aclmdlGetOutputSizeByIndex(modelDesc_, index) / maxBatchSize_;
 }
 
-void ModelProcess::DestroyOutput()
+ModelIoSizes ModelProcess::GetIoSizes() const
 {
-    if (output_ == nullptr) {
-        return;
+    ModelIoSizes sizes;
+    size_t inputNum = aclmdlGetNumInputs(modelDesc_);
+    for (size_t i = 0; i < inputNum; ++i) {
+        sizes.inputSizes.push_back(aclmdlGetInputSizeByIndex(modelDesc_, i));
     }
-    // 推理用模型的内存资源进行释放
-    for (size_t i = 0; i < aclmdlGetDatasetNumBuffers(output_); ++i) {
-        aclDataBuffer* dataBuffer = aclmdlGetDatasetBuffer(output_, i);
-        void* data = aclGetDataBufferAddr(dataBuffer);
-        (void)aclrtFree(data);
-        (void)aclDestroyDataBuffer(dataBuffer);
+    size_t outputNum = aclmdlGetNumOutputs(modelDesc_);
+    for (size_t i = 0; i < outputNum; ++i) {
+        sizes.outputSizes.push_back(aclmdlGetOutputSizeByIndex(modelDesc_, i));
     }
+    return sizes;
+}
 
-    (void)aclmdlDestroyDataset(output_);
-    output_ = nullptr;
+size_t ModelProcess::GetDeviceMemSize() const
+{
+    return loadFlag_ ? (modelMemSize_ + modelWeightSize_) : 0;
 }
 
-Result ModelProcess::Execute()
+void ModelProcess::Retire()
 {
-	// 执行模型推理，直到返回推理结果
-    aclError ret = aclmdlExecute(modelId_, input_, output_);
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("execute model failed, modelId is %u", modelId_);
-        return FAILED;
-    }
+    retired_ = true;
+}
 
-    INFO_LOG("model execute success");
-    return SUCCESS;
+bool ModelProcess::IsRetired() const
+{
+    return retired_.load();
 }
 
 void ModelProcess::Unload()
@@ -349,18 +375,7 @@ void ModelProcess::Unload()
         (void)aclmdlDestroyDesc(modelDesc_);
         modelDesc_ = nullptr;
     }
-    //释放内存资源
-    if (modelMemPtr_ != nullptr) {
-        aclrtFree(modelMemPtr_);
-        modelMemPtr_ = nullptr;
-        modelMemSize_ = 0;
-    }
-    //释放权值内存资源
-    if (modelWeightPtr_ != nullptr) {
-        aclrtFree(modelWeightPtr_);
-        modelWeightPtr_ = nullptr;
-        modelWeightSize_ = 0;
-    }
+    FreeModelMem();
 
     loadFlag_ = false;
     INFO_LOG("unload model success, modelId is %u", modelId_);
@@ -0,0 +1,450 @@
+/**
+* @file model_registry.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "model_registry.h"
+#include <algorithm>
+#include <set>
+using namespace std;
+
+namespace {
+const size_t BYTES_PER_MB = 1024 * 1024;
+
+void RestoreContext(aclrtContext context)
+{
+    if (context != nullptr) {
+        (void)aclrtSetCurrentContext(context);
+    }
+}
+}
+
+vector<string> ModelCatalogEntry::GetPaths() const
+{
+    if (!config.variantPaths.empty()) {
+        return config.variantPaths;
+    }
+    return vector<string>(1, config.modelPath);
+}
+
+WarmupPolicy ModelCatalogEntry::GetWarmupPolicy() const
+{
+    WarmupPolicy policy;
+    policy.minIterations = config.warmupIterations;
+    policy.maxIterations = config.warmupMaxIterations;
+    policy.stableRatio = config.warmupStablePct / 100.0;
+    return policy;
+}
+
+ModelRegistry::ModelRegistry() : context_(nullptr), memBudget_(0), stopLoader_(false)
+{
+}
+
+ModelRegistry::~ModelRegistry()
+{
+    Clear();
+}
+
+Result ModelRegistry::Init(aclrtContext context, const shared_ptr<const ModelCatalog> &catalog, size_t memBudget)
+{
+    if ((context == nullptr) || (catalog == nullptr) || catalog->empty()) {
+        ERROR_LOG("context is null or no model configured, init model registry failed");
+        return FAILED;
+    }
+    context_ = context;
+    catalog_ = catalog;
+    memBudget_ = memBudget;
+    stopLoader_ = false;
+    loader_ = thread(&ModelRegistry::RunLoader, this);
+    return SUCCESS;
+}
+
+void ModelRegistry::SetRetireHandler(const function<void()> &handler)
+{
+    retireHandler_ = handler;
+}
+
+string ModelRegistry::GetPathsKey(const vector<string> &paths)
+{
+    string key;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        key += paths[i] + ";";
+    }
+    return key;
+}
+
+size_t ModelRegistry::GetMemUsed() const
+{
+    // 多个key共享同一份模型时只计算一次
+    set<const ModelFamily *> counted;
+    size_t used = 0;
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        used += it->second.reservedMem;
+        if ((it->second.family != nullptr) && counted.insert(it->second.family.get()).second) {
+            used += it->second.family->GetDeviceMemSize();
+        }
+    }
+    return used;
+}
+
+Result ModelRegistry::MakeRoom(size_t size, const ModelKey &key)
+{
+    if (memBudget_ == 0) {
+        return SUCCESS;
+    }
+    if (size > memBudget_) {
+        ERROR_LOG("model %s needs %zu MB, more than the budget of %zu MB", key.name.c_str(),
+            size / BYTES_PER_MB, memBudget_ / BYTES_PER_MB);
+        return FAILED;
+    }
+    // 正在重新加载的模型 key自己和与key级联的模型不淘汰 与它们共享的模型也不淘汰
+    set<const ModelFamily *> pinned;
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if ((it->second.family != nullptr) && ((it->second.reservedMem > 0) ||
+            (!(it->first < key) && !(key < it->first)) || IsCascadePair(it->first, key))) {
+            pinned.insert(it->second.family.get());
+        }
+    }
+    // 按最近最少使用的顺序淘汰 正在加载的模型不淘汰
+    while (GetMemUsed() + size > memBudget_) {
+        auto victim = entries_.end();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if ((it->second.family != nullptr) && (pinned.count(it->second.family.get()) == 0) &&
+                ((victim == entries_.end()) || (it->second.lastUsed < victim->second.lastUsed))) {
+                victim = it;
+            }
+        }
+        if (victim == entries_.end()) {
+            ERROR_LOG("no model left to evict, %zu MB of %zu MB in use", GetMemUsed() / BYTES_PER_MB,
+                memBudget_ / BYTES_PER_MB);
+            return FAILED;
+        }
+        // 共享同一份模型的key一起淘汰 模型标记为淘汰后不再被复用 slot解除绑定后卸载
+        shared_ptr<ModelFamily> family = victim->second.family;
+        family->Retire();
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it->second.family != family) {
+                ++it;
+                continue;
+            }
+            INFO_LOG("evict model %s version %s", it->first.name.c_str(), it->first.version.c_str());
+            it = entries_.erase(it);
+            ++stats_.evictions;
+        }
+        for (auto it = families_.begin(); it != families_.end();) {
+            it = (it->second.lock() == family) ? families_.erase(it) : ++it;
+        }
+    }
+    return SUCCESS;
+}
+
+bool ModelRegistry::IsCascadePair(const ModelKey &first, const ModelKey &second) const
+{
+    // 级联的两个模型总是一起使用 一个在用时另一个也要常驻
+    auto it = catalog_->find(first);
+    if ((it != catalog_->end()) && (it->second.config.cascadeModel == second.name)) {
+        return true;
+    }
+    it = catalog_->find(second);
+    return (it != catalog_->end()) && (it->second.config.cascadeModel == first.name);
+}
+
+shared_ptr<ModelFamily> ModelRegistry::Acquire(const ModelKey &key)
+{
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            break;
+        }
+        if (!it->second.loading) {
+            ++stats_.hits;
+            it->second.lastUsed = chrono::steady_clock::now();
+            QueueWantedVariant(key, it->second.family);
+            return it->second.family;
+        }
+        loadCond_.wait(lock);
+    }
+
+    ++stats_.misses;
+    auto entry = catalog_->find(key);
+    if (entry == catalog_->end()) {
+        ERROR_LOG("model %s version %s is not configured", key.name.c_str(), key.version.c_str());
+        return nullptr;
+    }
+    vector<string> paths = entry->second.GetPaths();
+    string pathsKey = GetPathsKey(paths);
+
+    // 同一组.om文件已经被其他key加载 直接共享权值和工作内存
+    shared_ptr<ModelFamily> family = families_[pathsKey].lock();
+    if (family != nullptr) {
+        Entry &shared = entries_[key];
+        shared.family = family;
+        shared.lastUsed = chrono::steady_clock::now();
+        return family;
+    }
+
+    size_t memSize = 0;
+    size_t evictions = stats_.evictions;
+    Result ret = ModelFamily::QueryDeviceMemSize(paths, memSize);
+    if (ret == SUCCESS) {
+        ret = MakeRoom(memSize, key);
+    }
+    bool evicted = (stats_.evictions != evictions);
+    if (ret == SUCCESS) {
+        Entry &loading = entries_[key];
+        loading.loading = true;
+        loading.reservedMem = memSize;
+    }
+
+    // 加载时不持锁 其他模型的请求不受影响
+    lock.unlock();
+    // lane线程运行在计算组的context中 加载完成后切换回去
+    aclrtContext callerContext = nullptr;
+    (void)aclrtGetCurrentContext(&callerContext);
+    (void)aclrtSetCurrentContext(context_);
+    // 空闲slot仍绑定着被淘汰的模型 先解除绑定释放内存 再加载
+    if (evicted && retireHandler_) {
+        retireHandler_();
+    }
+    if (ret != SUCCESS) {
+        RestoreContext(callerContext);
+        return nullptr;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    family.reset(new ModelFamily());
+    ret = family->Load(paths, entry->second.config.variantIdleUnloadSec);
+    vector<WarmupResult> warmup;
+    if (ret == SUCCESS) {
+        // 预热后再交给请求使用 首批请求不承担冷启动的时延
+        family->SetSelector(entry->second.selector);
+        ret = family->Warmup(entry->second.GetWarmupPolicy(), warmup);
+    }
+    RestoreContext(callerContext);
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    lock.lock();
+
+    if (ret != SUCCESS) {
+        ERROR_LOG("load model %s version %s failed", key.name.c_str(), key.version.c_str());
+        entries_.erase(key);
+        family.reset();
+    } else {
+        INFO_LOG("load model %s version %s in %.1f ms", key.name.c_str(), key.version.c_str(), loadMs);
+        Entry &loaded = entries_[key];
+        loaded.family = family;
+        loaded.loading = false;
+        loaded.reservedMem = 0;
+        loaded.lastUsed = chrono::steady_clock::now();
+        families_[pathsKey] = family;
+        stats_.totalLoadMs += loadMs;
+    }
+    loadCond_.notify_all();
+    return family;
+}
+
+void ModelRegistry::QueueWantedVariant(const ModelKey &key, const shared_ptr<ModelFamily> &family)
+{
+    VariantLoad load;
+    if (!family->TakeWantedVariant(load.index, load.path)) {
+        return;
+    }
+    load.key = key;
+    load.family = family;
+    variantLoads_.push_back(load);
+    loaderCond_.notify_one();
+}
+
+void ModelRegistry::RunLoader()
+{
+    // 空闲时卸载的变体在这个线程加载和预热 lane线程不等待
+    (void)aclrtSetCurrentContext(context_);
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        loaderCond_.wait(lock, [this] { return stopLoader_ || !variantLoads_.empty(); });
+        if (stopLoader_) {
+            break;
+        }
+        VariantLoad load = variantLoads_.front();
+        variantLoads_.pop_front();
+        LoadWantedVariant(lock, load);
+    }
+    for (size_t i = 0; i < variantLoads_.size(); ++i) {
+        shared_ptr<ModelFamily> family = variantLoads_[i].family.lock();
+        if (family != nullptr) {
+            family->CancelVariantLoad(variantLoads_[i].index);
+        }
+    }
+    variantLoads_.clear();
+}
+
+void ModelRegistry::LoadWantedVariant(unique_lock<mutex> &lock, const VariantLoad &load)
+{
+    shared_ptr<ModelFamily> family = load.family.lock();
+    auto it = entries_.find(load.key);
+    auto entry = catalog_->find(load.key);
+    // 排队期间模型被淘汰或重新加载 不再需要这个变体
+    if ((family == nullptr) || (it == entries_.end()) || (it->second.family != family) ||
+        (entry == catalog_->end())) {
+        if (family != nullptr) {
+            family->CancelVariantLoad(load.index);
+        }
+        return;
+    }
+    // 重新加载的变体同样计入显存预算
+    size_t memSize = 0;
+    size_t evictions = stats_.evictions;
+    Result ret = ModelFamily::QueryDeviceMemSize(vector<string>(1, load.path), memSize);
+    if (ret == SUCCESS) {
+        ret = MakeRoom(memSize, load.key);
+    }
+    bool evicted = (stats_.evictions != evictions);
+    size_t reserved = (ret == SUCCESS) ? memSize : 0;
+    it->second.reservedMem += reserved;
+
+    lock.unlock();
+    if (evicted && retireHandler_) {
+        retireHandler_();
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (ret == SUCCESS) {
+        ret = family->LoadIdleVariant(load.index, entry->second.GetWarmupPolicy());
+    } else {
+        family->CancelVariantLoad(load.index);
+    }
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    lock.lock();
+
+    it = entries_.find(load.key);
+    if (it != entries_.end()) {
+        it->second.reservedMem -= min(it->second.reservedMem, reserved);
+    }
+    if (ret == SUCCESS) {
+        stats_.totalLoadMs += loadMs;
+    }
+}
+
+Result ModelRegistry::Reload(const ModelKey &key)
+{
+    unique_lock<mutex> lock(mutex_);
+    auto entry = catalog_->find(key);
+    if (entry == catalog_->end()) {
+        ERROR_LOG("model %s version %s is not configured", key.name.c_str(), key.version.c_str());
+        return FAILED;
+    }
+    vector<string> paths = entry->second.GetPaths();
+    string pathsKey = GetPathsKey(paths);
+    auto it = entries_.find(key);
+    if ((it == entries_.end()) || (it->second.family == nullptr)) {
+        // 本device没有加载该模型 下次加载时直接读取新文件
+        families_.erase(pathsKey);
+        return SUCCESS;
+    }
+    if (it->second.reservedMem > 0) {
+        ERROR_LOG("model %s version %s is already being loaded", key.name.c_str(), key.version.c_str());
+        return FAILED;
+    }
+    shared_ptr<ModelFamily> oldFamily = it->second.family;
+    size_t memSize = 0;
+    size_t evictions = stats_.evictions;
+    Result ret = ModelFamily::QueryDeviceMemSize(paths, memSize);
+    if (ret == SUCCESS) {
+        ret = MakeRoom(memSize, key);
+    }
+    bool evicted = (stats_.evictions != evictions);
+    if (ret == SUCCESS) {
+        it->second.reservedMem = memSize;
+    }
+
+    // 新模型在后台加载和预热 期间请求继续使用旧模型
+    lock.unlock();
+    aclrtContext callerContext = nullptr;
+    (void)aclrtGetCurrentContext(&callerContext);
+    (void)aclrtSetCurrentContext(context_);
+    if (evicted && retireHandler_) {
+        retireHandler_();
+    }
+    if (ret != SUCCESS) {
+        RestoreContext(callerContext);
+        return FAILED;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    shared_ptr<ModelFamily> family(new ModelFamily());
+    ret = family->Load(paths, entry->second.config.variantIdleUnloadSec);
+    if ((ret == SUCCESS) && !family->IsCompatible(*oldFamily)) {
+        ERROR_LOG("reloaded model %s has different input or output sizes, register it as a new version instead",
+            key.name.c_str());
+        ret = FAILED;
+    }
+    if (ret == SUCCESS) {
+        vector<WarmupResult> warmup;
+        family->SetSelector(entry->second.selector);
+        ret = family->Warmup(entry->second.GetWarmupPolicy(), warmup);
+    }
+    RestoreContext(callerContext);
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    lock.lock();
+
+    it = entries_.find(key);
+    if (it != entries_.end()) {
+        it->second.reservedMem = 0;
+    } else if (ret == SUCCESS) {
+        // 加载期间模型已被清除 没有key可以切换到新模型
+        ERROR_LOG("model %s version %s was removed while reloading", key.name.c_str(), key.version.c_str());
+        ret = FAILED;
+    }
+    if (ret != SUCCESS) {
+        // 失败时在锁外释放新模型 旧模型继续服务
+        lock.unlock();
+        family.reset();
+        return FAILED;
+    }
+    // 所有使用旧模型的key一起切换 之后的请求都使用新模型
+    for (auto e = entries_.begin(); e != entries_.end(); ++e) {
+        if (e->second.family == oldFamily) {
+            e->second.family = family;
+        }
+    }
+    families_[pathsKey] = family;
+    stats_.totalLoadMs += loadMs;
+    ++stats_.reloads;
+    // 旧模型等在执行中的batch完成后 由各slot解除绑定时卸载
+    oldFamily->Retire();
+    INFO_LOG("reload model %s version %s in %.1f ms", key.name.c_str(), key.version.c_str(), loadMs);
+    lock.unlock();
+    return SUCCESS;
+}
+
+RegistryStats ModelRegistry::GetStats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    RegistryStats stats = stats_;
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        stats.loadedModels += (it->second.family != nullptr) ? 1 : 0;
+    }
+    stats.memUsed = GetMemUsed();
+    return stats;
+}
+
+void ModelRegistry::StopLoading()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopLoader_ = true;
+    }
+    loaderCond_.notify_all();
+    if (loader_.joinable()) {
+        loader_.join();
+    }
+}
+
+void ModelRegistry::Clear()
+{
+    StopLoading();
+    lock_guard<mutex> lock(mutex_);
+    entries_.clear();
+    families_.clear();
+}
@@ -0,0 +1,266 @@
+/**
+* @file near_duplicate_index.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "near_duplicate_index.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "frame_gate.h"
+using namespace std;
+
+namespace {
+const size_t THUMBNAIL_SIZE = 32;  // the hash is computed on the 32x32 luma thumbnail of the frame gate
+const size_t DCT_SIZE = 8;         // lowest 8x8 frequencies give the 64 bits
+const size_t COEFFICIENT_NUM = DCT_SIZE * DCT_SIZE;
+const size_t HASH_BITS = 64;
+const size_t CHUNK_BITS = 16;
+const uint64_t CHUNK_MASK = 0xFFFF;
+const size_t MAX_PROBE_RADIUS = 2;  // beyond it probing the chunk tables costs more than comparing every hash
+const double PI = 3.14159265358979323846;
+
+/**
+* DctBasis: cos((2x + 1) * u * pi / 64) of the lowest 8 frequencies u, in both layouts Project reads
+*/
+struct DctBasis {
+    float byPosition[THUMBNAIL_SIZE * DCT_SIZE];   // [x][u], the 8 frequencies of one position are contiguous
+    float byFrequency[DCT_SIZE * THUMBNAIL_SIZE];  // [u][x]
+
+    DctBasis()
+    {
+        for (size_t x = 0; x < THUMBNAIL_SIZE; ++x) {
+            for (size_t u = 0; u < DCT_SIZE; ++u) {
+                float value = static_cast<float>(cos((2 * x + 1) * u * PI / (2 * THUMBNAIL_SIZE)));
+                byPosition[x * DCT_SIZE + u] = value;
+                byFrequency[u * THUMBNAIL_SIZE + x] = value;
+            }
+        }
+    }
+};
+
+const DctBasis &GetBasis()
+{
+    static const DctBasis basis;
+    return basis;
+}
+
+/**
+* @brief out[0..7] = sum of weights[i] * rows[i][0..7] over the 32 rows of 8 values
+*/
+void Project(const float *weights, const float *rows, float *out)
+{
+#if defined(__SSE2__)
+    __m128 low = _mm_setzero_ps();
+    __m128 high = _mm_setzero_ps();
+    for (size_t i = 0; i < THUMBNAIL_SIZE; ++i) {
+        __m128 weight = _mm_set1_ps(weights[i]);
+        low = _mm_add_ps(low, _mm_mul_ps(weight, _mm_loadu_ps(rows + i * DCT_SIZE)));
+        high = _mm_add_ps(high, _mm_mul_ps(weight, _mm_loadu_ps(rows + i * DCT_SIZE + 4)));
+    }
+    _mm_storeu_ps(out, low);
+    _mm_storeu_ps(out + 4, high);
+#elif defined(__ARM_NEON)
+    float32x4_t low = vdupq_n_f32(0.0f);
+    float32x4_t high = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < THUMBNAIL_SIZE; ++i) {
+        low = vmlaq_n_f32(low, vld1q_f32(rows + i * DCT_SIZE), weights[i]);
+        high = vmlaq_n_f32(high, vld1q_f32(rows + i * DCT_SIZE + 4), weights[i]);
+    }
+    vst1q_f32(out, low);
+    vst1q_f32(out + 4, high);
+#else
+    for (size_t j = 0; j < DCT_SIZE; ++j) {
+        out[j] = 0.0f;
+    }
+    for (size_t i = 0; i < THUMBNAIL_SIZE; ++i) {
+        for (size_t j = 0; j < DCT_SIZE; ++j) {
+            out[j] += weights[i] * rows[i * DCT_SIZE + j];
+        }
+    }
+#endif
+}
+
+inline uint32_t GetChunk(uint64_t hash, size_t chunk)
+{
+    return static_cast<uint32_t>((hash >> (chunk * CHUNK_BITS)) & CHUNK_MASK);
+}
+}
+
+NearDuplicateIndex::NearDuplicateIndex()
+{
+}
+
+void NearDuplicateIndex::SetConfig(const NearDuplicateConfig &config)
+{
+    lock_guard<mutex> lock(mutex_);
+    config_ = config;
+    // 距离超过哈希位数时等同于任意两张图片都相同
+    config_.maxDistance = min(config_.maxDistance, HASH_BITS);
+}
+
+bool NearDuplicateIndex::IsEnabled() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return config_.entries > 0;
+}
+
+uint64_t NearDuplicateIndex::Hash(const DecodedImage &image)
+{
+    vector<uint8_t> thumbnail;
+    FrameGate::MakeThumbnail(image, thumbnail);
+    // 二维DCT可分离 先求每行的8个最低频率 再沿列求 只算用到的64个系数
+    const DctBasis &basis = GetBasis();
+    float pixels[THUMBNAIL_SIZE];
+    float rows[THUMBNAIL_SIZE * DCT_SIZE];
+    for (size_t y = 0; y < THUMBNAIL_SIZE; ++y) {
+        for (size_t x = 0; x < THUMBNAIL_SIZE; ++x) {
+            pixels[x] = thumbnail[y * THUMBNAIL_SIZE + x];
+        }
+        Project(pixels, basis.byPosition, rows + y * DCT_SIZE);
+    }
+    float coefficients[COEFFICIENT_NUM];
+    for (size_t v = 0; v < DCT_SIZE; ++v) {
+        Project(basis.byFrequency + v * THUMBNAIL_SIZE, rows, coefficients + v * DCT_SIZE);
+    }
+    // 直流分量只反映整体亮度 不参与中位数
+    vector<float> sorted(coefficients + 1, coefficients + COEFFICIENT_NUM);
+    nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    float median = sorted[sorted.size() / 2];
+    uint64_t hash = 0;
+    for (size_t i = 0; i < COEFFICIENT_NUM; ++i) {
+        if (coefficients[i] > median) {
+            hash |= (1ULL << i);
+        }
+    }
+    return hash;
+}
+
+uint32_t NearDuplicateIndex::Distance(uint64_t first, uint64_t second)
+{
+    // 目标支持时编译为popcnt指令
+    return static_cast<uint32_t>(__builtin_popcountll(first ^ second));
+}
+
+void NearDuplicateIndex::Probe(const ModelIndex &index, size_t chunk, uint32_t value, size_t firstBit,
+    size_t radius, uint64_t hash, Match &best)
+{
+    auto it = index.chunks[chunk].find(value);
+    if (it != index.chunks[chunk].end()) {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            uint32_t distance = Distance(it->second[i].first, hash);
+            if (distance < best.distance) {
+                best.id = it->second[i].second;
+                best.distance = distance;
+            }
+        }
+    }
+    // 每次只翻转更高的位 每个值只访问一次
+    if (radius == 0) {
+        return;
+    }
+    for (size_t bit = firstBit; bit < CHUNK_BITS; ++bit) {
+        Probe(index, chunk, value ^ (1U << bit), bit + 1, radius - 1, hash, best);
+    }
+}
+
+bool NearDuplicateIndex::Find(const ModelKey &model, uint64_t hash, InferResult &result)
+{
+    lock_guard<mutex> lock(mutex_);
+    ++stats_.images;
+    auto it = models_.find(model);
+    if (it == models_.end()) {
+        return false;
+    }
+    const ModelIndex &index = it->second;
+    Match best;
+    best.id = 0;
+    best.distance = static_cast<uint32_t>(config_.maxDistance) + 1;
+    // 距离不超过d的哈希至少有一块的距离不超过d/4
+    size_t radius = config_.maxDistance / CHUNK_NUM;
+    if (radius > MAX_PROBE_RADIUS) {
+        for (auto entry = index.entries.begin(); entry != index.entries.end(); ++entry) {
+            uint32_t distance = Distance(entry->second.hash, hash);
+            if (distance < best.distance) {
+                best.id = entry->first;
+                best.distance = distance;
+            }
+        }
+    } else {
+        for (size_t chunk = 0; chunk < CHUNK_NUM; ++chunk) {
+            Probe(index, chunk, GetChunk(hash, chunk), 0, radius, hash, best);
+        }
+    }
+    if (best.distance > config_.maxDistance) {
+        return false;
+    }
+    result = index.entries.find(best.id)->second.result;
+    ++stats_.reused;
+    return true;
+}
+
+void NearDuplicateIndex::EraseOldest(ModelIndex &index)
+{
+    auto oldest = index.entries.begin();
+    for (size_t chunk = 0; chunk < CHUNK_NUM; ++chunk) {
+        auto bucket = index.chunks[chunk].find(GetChunk(oldest->second.hash, chunk));
+        if (bucket == index.chunks[chunk].end()) {
+            continue;
+        }
+        ChunkBucket &entries = bucket->second;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].second == oldest->first) {
+                entries[i] = entries.back();
+                entries.pop_back();
+                break;
+            }
+        }
+        if (entries.empty()) {
+            index.chunks[chunk].erase(bucket);
+        }
+    }
+    index.entries.erase(oldest);
+}
+
+void NearDuplicateIndex::Insert(const ModelKey &model, uint64_t hash, const InferResult &result)
+{
+    if (result.ret != SUCCESS) {
+        return;
+    }
+    lock_guard<mutex> lock(mutex_);
+    ModelIndex &index = models_[model];
+    uint64_t id = index.nextId++;
+    Entry &entry = index.entries[id];
+    entry.hash = hash;
+    entry.result = result;
+    for (size_t chunk = 0; chunk < CHUNK_NUM; ++chunk) {
+        index.chunks[chunk][GetChunk(hash, chunk)].push_back(make_pair(hash, id));
+    }
+    while (index.entries.size() > config_.entries) {
+        EraseOldest(index);
+    }
+}
+
+void NearDuplicateIndex::Invalidate(const ModelKey &model)
+{
+    lock_guard<mutex> lock(mutex_);
+    models_.erase(model);
+}
+
+NearDuplicateStats NearDuplicateIndex::GetStats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    NearDuplicateStats stats = stats_;
+    for (auto it = models_.begin(); it != models_.end(); ++it) {
+        stats.entries += it->second.entries.size();
+    }
+    return stats;
+}
@@ -0,0 +1,208 @@
+/**
+* @file request_hedger.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "request_hedger.h"
+#include <algorithm>
+using namespace std;
+
+namespace {
+const size_t LATENCY_WINDOW = 1024;     // latest latencies the percentile is taken from
+const size_t MIN_LATENCY_SAMPLES = 100; // no hedging before this many requests completed
+const size_t RECOMPUTE_INTERVAL = 64;   // new latencies between two computations of the delay
+const size_t PERCENT = 100;
+}
+
+RequestHedger::RequestHedger() : enabled_(false), nextLatency_(0), newLatencies_(0), delay_(0), stop_(false)
+{
+}
+
+RequestHedger::~RequestHedger()
+{
+    Stop();
+}
+
+Result RequestHedger::Start(const HedgeConfig &config, const DispatchFunc &dispatch)
+{
+    if (config.percentile == 0) {
+        return SUCCESS;
+    }
+    if ((config.percentile >= PERCENT) || !dispatch || thread_.joinable()) {
+        ERROR_LOG("hedge percentile %zu must be below 100, or hedger already started", config.percentile);
+        return FAILED;
+    }
+    config_ = config;
+    dispatch_ = dispatch;
+    stop_ = false;
+    thread_ = thread(&RequestHedger::Run, this);
+    enabled_ = true;
+    INFO_LOG("hedge requests slower than p%zu, at most %zu%% extra requests", config_.percentile,
+        config_.budgetPct);
+    return SUCCESS;
+}
+
+bool RequestHedger::IsEnabled() const
+{
+    return enabled_.load();
+}
+
+void RequestHedger::Track(const InferRequestPtr &request)
+{
+    if (!enabled_) {
+        return;
+    }
+    shared_ptr<HedgeState> state(new HedgeState());
+    state->callback = request->callback;
+    state->request = request;
+    state->cancel.reset(new atomic<bool>(false));
+    state->start = chrono::steady_clock::now();
+    request->cancel = state->cancel;
+    request->lane.reset(new atomic<StreamExecutor *>(nullptr));
+    // 请求与其副本共用一个状态 先完成的结果交给原回调
+    request->callback = [this, state](const InferResult &result) { Complete(state, result, false); };
+
+    bool earliest = false;
+    {
+        lock_guard<mutex> lock(mutex_);
+        ++stats_.tracked;
+        // 时延样本不足时不知道该等多久 暂不对冲
+        if (delay_.count() == 0) {
+            return;
+        }
+        auto it = timers_.insert(make_pair(state->start + delay_, weak_ptr<HedgeState>(state)));
+        earliest = (it == timers_.begin());
+    }
+    if (earliest) {
+        cond_.notify_one();
+    }
+}
+
+void RequestHedger::Complete(shared_ptr<HedgeState> state, const InferResult &result, bool duplicate)
+{
+    // 后完成的一方直接丢弃
+    if (state->done.exchange(true)) {
+        return;
+    }
+    state->cancel->store(true);
+    InferCallback callback;
+    {
+        lock_guard<mutex> lock(mutex_);
+        callback.swap(state->callback);
+        state->request.reset();
+        stats_.won += (duplicate && (result.ret == SUCCESS)) ? 1 : 0;
+    }
+    if (result.ret == SUCCESS) {
+        RecordLatency(chrono::duration<double, milli>(chrono::steady_clock::now() - state->start).count());
+    }
+    if (callback) {
+        callback(result);
+    }
+}
+
+void RequestHedger::RecordLatency(double ms)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (latencies_.size() < LATENCY_WINDOW) {
+        latencies_.push_back(ms);
+    } else {
+        latencies_[nextLatency_] = ms;
+        nextLatency_ = (nextLatency_ + 1) % LATENCY_WINDOW;
+    }
+    if ((latencies_.size() < MIN_LATENCY_SAMPLES) || (++newLatencies_ < RECOMPUTE_INTERVAL)) {
+        return;
+    }
+    newLatencies_ = 0;
+    vector<double> sorted = latencies_;
+    size_t index = sorted.size() * config_.percentile / PERCENT;
+    nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    delay_ = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(sorted[index]));
+}
+
+bool RequestHedger::TakeBudget()
+{
+    // 副本数不超过被跟踪请求数的budgetPct
+    if ((stats_.hedged + 1) * PERCENT > config_.budgetPct * stats_.tracked) {
+        return false;
+    }
+    ++stats_.hedged;
+    return true;
+}
+
+InferRequestPtr RequestHedger::CreateDuplicate(const shared_ptr<HedgeState> &state, const InferRequestPtr &original)
+{
+    // 只复制提交后不再改变的字段
+    InferRequestPtr duplicate(new InferRequest());
+    duplicate->input = original->input;
+    duplicate->writer = original->writer;  // writer只读取提交时的图片 可以再执行一次
+    duplicate->model = original->model;
+    duplicate->height = original->height;
+    duplicate->width = original->width;
+    duplicate->priority = original->priority;
+    duplicate->deadline = original->deadline;
+    duplicate->cancel = state->cancel;
+    duplicate->callback = [this, state](const InferResult &result) { Complete(state, result, true); };
+    return duplicate;
+}
+
+void RequestHedger::Run()
+{
+    unique_lock<mutex> lock(mutex_);
+    while (!stop_) {
+        if (timers_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+        auto it = timers_.begin();
+        if (chrono::steady_clock::now() < it->first) {
+            cond_.wait_until(lock, it->first);
+            continue;
+        }
+        shared_ptr<HedgeState> state = it->second.lock();
+        timers_.erase(it);
+        InferRequestPtr original = (state != nullptr) ? state->request : nullptr;
+        // 原请求还在batcher中时不知道它会去哪个lane 不对冲
+        StreamExecutor *lane = nullptr;
+        if ((original != nullptr) && (original->lane != nullptr)) {
+            lane = original->lane->load();
+        }
+        if ((lane == nullptr) || !TakeBudget()) {
+            continue;
+        }
+        // 超过时延分位数仍未完成 复制一份交给原请求所在lane以外最空闲的lane
+        lock.unlock();
+        InferRequestPtr duplicate = CreateDuplicate(state, original);
+        Result ret = dispatch_(duplicate, lane);
+        lock.lock();
+        // 没有其他lane可用 副本未执行 不占用预算
+        if (ret != SUCCESS) {
+            --stats_.hedged;
+        }
+    }
+}
+
+HedgeStats RequestHedger::GetStats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    HedgeStats stats = stats_;
+    stats.delayMs = chrono::duration<double, milli>(delay_).count();
+    return stats;
+}
+
+void RequestHedger::Stop()
+{
+    enabled_ = false;
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+        timers_.clear();
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
@@ -0,0 +1,202 @@
+/**
+* @file result_cache.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "result_cache.h"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+namespace {
+const uint64_t HASH_PRIME1 = 0x9E3779B185EBCA87ULL;
+const uint64_t HASH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t MIX_PRIME1 = 0xFF51AFD7ED558CCDULL;
+const uint64_t MIX_PRIME2 = 0xC4CEB9FE1A85EC53ULL;
+const size_t LANE_NUM = 4;
+const size_t WORD_SIZE = sizeof(uint64_t);
+const size_t STRIPE_SIZE = LANE_NUM * WORD_SIZE;
+const size_t SHARD_SHIFT = 60;  // the top 4 bits select one of the 16 shards, the map buckets use the low bits
+
+inline uint64_t Rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t Round(uint64_t lane, uint64_t word)
+{
+    lane += word * HASH_PRIME2;
+    return Rotate(lane, 31) * HASH_PRIME1;
+}
+
+inline uint64_t Mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= MIX_PRIME1;
+    hash ^= hash >> 33;
+    hash *= MIX_PRIME2;
+    return hash ^ (hash >> 33);
+}
+}
+
+ResultCache::ResultCache() : shardCapacity_(0), ttl_(0)
+{
+}
+
+void ResultCache::SetConfig(const ResultCacheConfig &config)
+{
+    // 容量平均分给各分片 每个分片至少一个
+    shardCapacity_ = (config.entries == 0) ? 0 : max((config.entries + SHARD_NUM - 1) / SHARD_NUM,
+        static_cast<size_t>(1));
+    ttl_ = chrono::milliseconds(config.ttlMs);
+}
+
+bool ResultCache::IsEnabled() const
+{
+    return shardCapacity_ > 0;
+}
+
+uint64_t ResultCache::Hash(const uint8_t *data, size_t size)
+{
+    // 四路互不依赖 每次各取8字节 乘法的延迟互相掩盖
+    uint64_t lanes[LANE_NUM] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0, 0 - HASH_PRIME1 };
+    size_t i = 0;
+    for (; i + STRIPE_SIZE <= size; i += STRIPE_SIZE) {
+        for (size_t j = 0; j < LANE_NUM; ++j) {
+            uint64_t word = 0;
+            memcpy(&word, data + i + j * WORD_SIZE, WORD_SIZE);
+            lanes[j] = Round(lanes[j], word);
+        }
+    }
+    uint64_t hash = size * HASH_PRIME1;
+    for (size_t j = 0; j < LANE_NUM; ++j) {
+        hash = Round(hash, lanes[j]);
+    }
+    // 不足一组的尾部 最后一个字不满8字节时补零
+    for (; i < size; i += WORD_SIZE) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, min(WORD_SIZE, size - i));
+        hash = Round(hash, word);
+    }
+    return Mix(hash);
+}
+
+ResultCache::Shard &ResultCache::GetShard(const ResultCacheKey &key)
+{
+    return shards_[(key.hash >> SHARD_SHIFT) % SHARD_NUM];
+}
+
+CacheLookup ResultCache::Lookup(const ResultCacheKey &key, const InferRequestPtr &request, InferResult &result)
+{
+    Shard &shard = GetShard(key);
+    lock_guard<mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        if ((ttl_.count() == 0) || (chrono::steady_clock::now() - it->second.time < ttl_)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lruPosition);
+            result = it->second.result;
+            ++shard.stats.hits;
+            return CACHE_HIT;
+        }
+        shard.lru.erase(it->second.lruPosition);
+        shard.entries.erase(it);
+        ++shard.stats.expired;
+    }
+    // 同样的输入正在执行 等待它的结果 不再重复执行
+    auto inflight = shard.inflight.find(key);
+    if (inflight != shard.inflight.end()) {
+        // 正在执行的请求优先级更低或截止时间更晚时 结果可能来不及 单独执行
+        if ((inflight->second.priority > request->priority) || (inflight->second.deadline > request->deadline)) {
+            ++shard.stats.misses;
+            return CACHE_BYPASS;
+        }
+        inflight->second.waiters.push_back(request);
+        ++shard.stats.coalesced;
+        return CACHE_COALESCED;
+    }
+    Inflight &leader = shard.inflight[key];
+    leader.priority = request->priority;
+    leader.deadline = request->deadline;
+    ++shard.stats.misses;
+    return CACHE_MISS;
+}
+
+void ResultCache::Complete(const ResultCacheKey &key, const InferResult &result, vector<InferRequestPtr> &readmit)
+{
+    Shard &shard = GetShard(key);
+    vector<InferRequestPtr> waiters;
+    {
+        lock_guard<mutex> lock(shard.mutex);
+        auto inflight = shard.inflight.find(key);
+        if (inflight != shard.inflight.end()) {
+            waiters.swap(inflight->second.waiters);
+            shard.inflight.erase(inflight);
+        }
+        // 被丢弃或取消的结果只说明这个请求没有执行 截止时间更晚的等待者可能仍来得及 交给调用者重新执行
+        if (result.shed || result.cancelled) {
+            shard.stats.readmitted += waiters.size();
+            readmit.swap(waiters);
+        }
+        // 只保存成功的结果 被丢弃或失败的请求下次重新执行
+        if (result.ret == SUCCESS) {
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end()) {
+                shard.lru.erase(it->second.lruPosition);
+                shard.entries.erase(it);
+            }
+            shard.lru.push_front(key);
+            Entry &entry = shard.entries[key];
+            entry.result = result;
+            entry.time = chrono::steady_clock::now();
+            entry.lruPosition = shard.lru.begin();
+            while (shard.entries.size() > shardCapacity_) {
+                shard.entries.erase(shard.lru.back());
+                shard.lru.pop_back();
+                ++shard.stats.evictions;
+            }
+        }
+    }
+    // 回调在锁外调用 回调中可以再次提交请求
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        if (waiters[i]->callback) {
+            waiters[i]->callback(result);
+        }
+    }
+}
+
+void ResultCache::Invalidate(const ModelKey &model)
+{
+    for (size_t i = 0; i < SHARD_NUM; ++i) {
+        Shard &shard = shards_[i];
+        lock_guard<mutex> lock(shard.mutex);
+        for (auto it = shard.lru.begin(); it != shard.lru.end();) {
+            if (!(it->model < model) && !(model < it->model)) {
+                shard.entries.erase(*it);
+                it = shard.lru.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+ResultCacheStats ResultCache::GetStats() const
+{
+    ResultCacheStats stats;
+    for (size_t i = 0; i < SHARD_NUM; ++i) {
+        const Shard &shard = shards_[i];
+        lock_guard<mutex> lock(shard.mutex);
+        stats.hits += shard.stats.hits;
+        stats.misses += shard.stats.misses;
+        stats.coalesced += shard.stats.coalesced;
+        stats.readmitted += shard.stats.readmitted;
+        stats.evictions += shard.stats.evictions;
+        stats.expired += shard.stats.expired;
+        stats.entries += shard.entries.size();
+    }
+    return stats;
+}
@@ -0,0 +1,130 @@
+/**
+* @file roi_preprocessor.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "roi_preprocessor.h"
+#include <algorithm>
+#include "acl/acl.h"
+using namespace std;
+
+namespace {
+const size_t CHANNEL_NUM = 3;
+const float DEFAULT_MEAN[CHANNEL_NUM] = {104.0f, 117.0f, 123.0f};
+const uint64_t DEFAULT_SIZE = 224;
+
+/**
+* Taps: the two source pixels and the weight of the second one for each output row or column
+*/
+struct Taps {
+    vector<uint32_t> first;
+    vector<uint32_t> second;
+    vector<float> weight;
+};
+
+Taps GetTaps(uint32_t start, uint32_t length, uint64_t outLength)
+{
+    // 按像素中心对齐 超出box的位置取边缘像素
+    Taps taps;
+    float ratio = static_cast<float>(length) / outLength;
+    for (uint64_t i = 0; i < outLength; ++i) {
+        float pos = (i + 0.5f) * ratio - 0.5f;
+        pos = min(max(pos, 0.0f), static_cast<float>(length - 1));
+        uint32_t low = static_cast<uint32_t>(pos);
+        uint32_t high = min(low + 1, length - 1);
+        taps.first.push_back(start + low);
+        taps.second.push_back(start + high);
+        taps.weight.push_back(pos - low);
+    }
+    return taps;
+}
+
+template<typename T>
+void WritePlanes(const DecodedImage &image, const RoiBox &box, const RoiNormalize &normalize, uint64_t height,
+    uint64_t width, T *sample, T (*convert)(float))
+{
+    const uint8_t *pixels = image.pixels->data();
+    size_t stride = static_cast<size_t>(image.width) * CHANNEL_NUM;
+    size_t planeSize = height * width;
+    Taps rows = GetTaps(box.y, box.height, height);
+    Taps cols = GetTaps(box.x, box.width, width);
+    for (uint64_t y = 0; y < height; ++y) {
+        const uint8_t *top = pixels + rows.first[y] * stride;
+        const uint8_t *bottom = pixels + rows.second[y] * stride;
+        float wy = rows.weight[y];
+        for (uint64_t x = 0; x < width; ++x) {
+            size_t left = cols.first[x] * CHANNEL_NUM;
+            size_t right = cols.second[x] * CHANNEL_NUM;
+            float wx = cols.weight[x];
+            for (size_t c = 0; c < CHANNEL_NUM; ++c) {
+                // 模型通道c对应的RGB通道
+                size_t ch = normalize.bgr ? (CHANNEL_NUM - 1 - c) : c;
+                float upper = top[left + ch] + (top[right + ch] - top[left + ch]) * wx;
+                float lower = bottom[left + ch] + (bottom[right + ch] - bottom[left + ch]) * wx;
+                float value = upper + (lower - upper) * wy;
+                sample[c * planeSize + y * width + x] = convert((value - normalize.mean[c]) * normalize.scale[c]);
+            }
+        }
+    }
+}
+
+aclFloat16 ToFloat16(float value)
+{
+    return aclFloatToFloat16(value);
+}
+
+float ToFloat(float value)
+{
+    return value;
+}
+}
+
+RoiNormalize::RoiNormalize() : bgr(true)
+{
+    for (size_t c = 0; c < CHANNEL_NUM; ++c) {
+        mean[c] = DEFAULT_MEAN[c];
+        scale[c] = 1.0f;
+    }
+}
+
+RoiRequest::RoiRequest() : height(DEFAULT_SIZE), width(DEFAULT_SIZE), priority(PRIORITY_INTERACTIVE),
+    deadline(chrono::steady_clock::time_point::max())
+{
+}
+
+Result RoiPreprocessor::Check(const DecodedImage &image, const RoiBox &box)
+{
+    size_t imageSize = static_cast<size_t>(image.width) * image.height * CHANNEL_NUM;
+    if ((image.pixels == nullptr) || (image.pixels->size() < imageSize)) {
+        ERROR_LOG("image of %ux%u has %zu bytes, %zu are needed", image.width, image.height,
+            (image.pixels != nullptr) ? image.pixels->size() : 0, imageSize);
+        return FAILED;
+    }
+    if ((box.width == 0) || (box.height == 0) || (box.x >= image.width) || (box.y >= image.height) ||
+        (box.width > image.width - box.x) || (box.height > image.height - box.y)) {
+        ERROR_LOG("box %u,%u %ux%u is empty or exceeds the image of %ux%u", box.x, box.y, box.width, box.height,
+            image.width, image.height);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+Result RoiPreprocessor::Write(const DecodedImage &image, const RoiBox &box, const RoiNormalize &normalize,
+    uint64_t height, uint64_t width, uint8_t *sample, size_t size)
+{
+    // 元素类型由样本大小决定 resnet50的输入为float16
+    size_t values = CHANNEL_NUM * height * width;
+    if (size == values * sizeof(aclFloat16)) {
+        WritePlanes(image, box, normalize, height, width, reinterpret_cast<aclFloat16 *>(sample), ToFloat16);
+    } else if (size == values * sizeof(float)) {
+        WritePlanes(image, box, normalize, height, width, reinterpret_cast<float *>(sample), ToFloat);
+    } else {
+        ERROR_LOG("sample size %zu is not %lux%lu with 3 channels of float16 or float32", size, height, width);
+        return FAILED;
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,289 @@
+/**
+* @file sample_config.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "sample_config.h"
+#include <cstdlib>
+#include <iterator>
+#include <sstream>
+using namespace std;
+
+namespace {
+const size_t DEFAULT_STREAM_NUM = 1;
+const size_t DEFAULT_SLOT_NUM = 2;
+const size_t DEFAULT_MAX_BATCH_SIZE = 1;
+const uint32_t DEFAULT_MAX_BATCH_DELAY_US = 0;
+const uint32_t DEFAULT_VARIANT_IDLE_UNLOAD_SEC = 60;
+const size_t DEFAULT_WARMUP_ITERATIONS = 3;
+const size_t DEFAULT_WARMUP_MAX_ITERATIONS = 20;
+const size_t DEFAULT_WARMUP_STABLE_PCT = 10;
+const size_t DEFAULT_INTERACTIVE_STREAMS = 0;
+const size_t DEFAULT_INTERACTIVE_SLOTS = 1;
+const uint32_t DEFAULT_BULK_MAX_BATCH_DELAY_US = 20000;
+const size_t DEFAULT_HEDGE_PERCENTILE = 0;
+const size_t DEFAULT_HEDGE_BUDGET_PCT = 5;
+const size_t DEFAULT_CPU_THREADS = 2;
+const float DEFAULT_CASCADE_MARGIN = 0.5f;
+const char *DEFAULT_AUTOTUNE_RESULT_PATH = "./autotune.cfg";
+const size_t DEFAULT_AUTOTUNE_TRIAL_MS = 2000;
+const size_t DEFAULT_AUTOTUNE_STREAM_NUMS[] = {1, 2, 4};
+const size_t DEFAULT_AUTOTUNE_SLOT_NUMS[] = {2, 3, 4};
+const size_t DEFAULT_AUTOTUNE_BATCH_SIZES[] = {1, 4, 8, 16};
+const size_t DEFAULT_FRAME_GATE_MAX_REUSE = 30;
+const size_t DEFAULT_FRAME_GATE_MAX_REUSE_MS = 1000;
+const size_t DEFAULT_RESULT_CACHE_TTL_MS = 60000;
+const size_t DEFAULT_NEAR_DUPLICATE_DISTANCE = 6;
+const size_t MAX_NEAR_DUPLICATE_DISTANCE = 64;  // bits of the perceptual hash
+const char *DEFAULT_MODEL_VERSION = "1";
+
+Result GetSize(const ConfigMap &config, const string &key, size_t &value)
+{
+    auto it = config.find(key);
+    if (it == config.end()) {
+        return SUCCESS;
+    }
+    // strtoull会把负数转换为很大的正数 负号直接拒绝
+    char *end = nullptr;
+    unsigned long long parsed = strtoull(it->second.c_str(), &end, 10);
+    if ((end == it->second.c_str()) || (*end != '\0') || (it->second.find('-') != string::npos)) {
+        ERROR_LOG("config %s = %s is not a non-negative number", key.c_str(), it->second.c_str());
+        return FAILED;
+    }
+    value = static_cast<size_t>(parsed);
+    return SUCCESS;
+}
+
+Result GetIntList(const ConfigMap &config, const string &key, vector<int32_t> &value)
+{
+    auto it = config.find(key);
+    if ((it == config.end()) || (it->second == "all")) {
+        return SUCCESS;
+    }
+    value.clear();
+    stringstream ss(it->second);
+    string item;
+    while (getline(ss, item, ',')) {
+        char *end = nullptr;
+        long parsed = strtol(item.c_str(), &end, 10);
+        while ((end != nullptr) && (*end == ' ')) {
+            ++end;
+        }
+        if ((end == item.c_str()) || (*end != '\0')) {
+            ERROR_LOG("config %s = %s is not a list of numbers", key.c_str(), it->second.c_str());
+            return FAILED;
+        }
+        value.push_back(static_cast<int32_t>(parsed));
+    }
+    return SUCCESS;
+}
+
+Result GetSizeList(const ConfigMap &config, const string &key, vector<size_t> &value)
+{
+    if (config.count(key) == 0) {
+        return SUCCESS;
+    }
+    vector<int32_t> items;
+    if (GetIntList(config, key, items) != SUCCESS) {
+        return FAILED;
+    }
+    value.clear();
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i] <= 0) {
+            ERROR_LOG("config %s must list positive numbers", key.c_str());
+            return FAILED;
+        }
+        value.push_back(static_cast<size_t>(items[i]));
+    }
+    return SUCCESS;
+}
+
+Result GetFloat(const ConfigMap &config, const string &key, float &value)
+{
+    auto it = config.find(key);
+    if (it == config.end()) {
+        return SUCCESS;
+    }
+    char *end = nullptr;
+    double parsed = strtod(it->second.c_str(), &end);
+    if ((end == it->second.c_str()) || (*end != '\0')) {
+        ERROR_LOG("config %s = %s is not a number", key.c_str(), it->second.c_str());
+        return FAILED;
+    }
+    value = static_cast<float>(parsed);
+    return SUCCESS;
+}
+
+void GetString(const ConfigMap &config, const string &key, string &value)
+{
+    auto it = config.find(key);
+    if (it != config.end()) {
+        value = it->second;
+    }
+}
+
+void GetStringList(const ConfigMap &config, const string &key, vector<string> &value)
+{
+    auto it = config.find(key);
+    if (it == config.end()) {
+        return;
+    }
+    value.clear();
+    stringstream ss(it->second);
+    string item;
+    while (getline(ss, item, ',')) {
+        size_t begin = item.find_first_not_of(' ');
+        if (begin == string::npos) {
+            continue;
+        }
+        value.push_back(item.substr(begin, item.find_last_not_of(' ') - begin + 1));
+    }
+}
+}
+
+ModelConfig::ModelConfig() : cascadeMargin(DEFAULT_CASCADE_MARGIN),
+    variantIdleUnloadSec(DEFAULT_VARIANT_IDLE_UNLOAD_SEC), streamNum(DEFAULT_STREAM_NUM), slotNum(DEFAULT_SLOT_NUM),
+    maxBatchSize(DEFAULT_MAX_BATCH_SIZE), maxBatchDelayUs(DEFAULT_MAX_BATCH_DELAY_US), latencyTargetMs(0),
+    warmupIterations(DEFAULT_WARMUP_ITERATIONS), warmupMaxIterations(DEFAULT_WARMUP_MAX_ITERATIONS),
+    warmupStablePct(DEFAULT_WARMUP_STABLE_PCT)
+{
+}
+
+Result ModelConfig::Load(const ConfigMap &config, const string &section)
+{
+    string prefix = section + ".";
+    name = section;
+    version = DEFAULT_MODEL_VERSION;
+    GetString(config, prefix + "name", name);
+    GetString(config, prefix + "version", version);
+    modelPath = "../model/" + section + ".om";
+    GetString(config, prefix + "model_path", modelPath);
+    GetStringList(config, prefix + "variant_paths", variantPaths);
+    GetString(config, prefix + "cpu_model_path", cpuModelPath);
+    GetString(config, prefix + "cascade_model", cascadeModel);
+    size_t batchDelay = maxBatchDelayUs;
+    size_t idleUnload = variantIdleUnloadSec;
+    if ((GetSize(config, prefix + "variant_idle_unload_s", idleUnload) != SUCCESS) ||
+        (GetSize(config, prefix + "stream_num", streamNum) != SUCCESS) ||
+        (GetSize(config, prefix + "slot_num", slotNum) != SUCCESS) ||
+        (GetSize(config, prefix + "max_batch_size", maxBatchSize) != SUCCESS) ||
+        (GetSize(config, prefix + "max_batch_delay_us", batchDelay) != SUCCESS) ||
+        (GetSize(config, prefix + "latency_target_ms", latencyTargetMs) != SUCCESS) ||
+        (GetFloat(config, prefix + "cascade_margin", cascadeMargin) != SUCCESS) ||
+        (GetSize(config, prefix + "warmup_iterations", warmupIterations) != SUCCESS) ||
+        (GetSize(config, prefix + "warmup_max_iterations", warmupMaxIterations) != SUCCESS) ||
+        (GetSize(config, prefix + "warmup_stable_pct", warmupStablePct) != SUCCESS)) {
+        return FAILED;
+    }
+    maxBatchDelayUs = static_cast<uint32_t>(batchDelay);
+    variantIdleUnloadSec = static_cast<uint32_t>(idleUnload);
+    if ((streamNum == 0) || (maxBatchSize == 0)) {
+        ERROR_LOG("stream_num and max_batch_size of model %s must be positive", section.c_str());
+        return FAILED;
+    }
+    if (cascadeModel == name) {
+        ERROR_LOG("cascade_model of model %s names the model itself", section.c_str());
+        return FAILED;
+    }
+    if (warmupMaxIterations < warmupIterations) {
+        WARN_LOG("warmup_max_iterations of model %s is below warmup_iterations, use %zu", section.c_str(),
+            warmupIterations);
+        warmupMaxIterations = warmupIterations;
+    }
+
+    if (!variantPaths.empty()) {
+        INFO_LOG("model %s: %zu batch size variants, idle ones unloaded after %u s", section.c_str(),
+            variantPaths.size(), variantIdleUnloadSec);
+    }
+    if (!cascadeModel.empty()) {
+        INFO_LOG("model %s: runs %s first, escalates samples with a top 1 margin below %.3f", section.c_str(),
+            cascadeModel.c_str(), cascadeMargin);
+    }
+    INFO_LOG("model %s version %s from section %s", name.c_str(), version.c_str(), section.c_str());
+    INFO_LOG("model %s: path %s, %zu streams, %zu slots per stream, batch %zu within %u us", section.c_str(),
+        modelPath.c_str(), streamNum, slotNum, maxBatchSize, maxBatchDelayUs);
+    return SUCCESS;
+}
+
+PriorityConfig::PriorityConfig() : interactiveStreams(DEFAULT_INTERACTIVE_STREAMS),
+    interactiveSlots(DEFAULT_INTERACTIVE_SLOTS), bulkMaxBatchDelayUs(DEFAULT_BULK_MAX_BATCH_DELAY_US)
+{
+}
+
+HedgeConfig::HedgeConfig() : percentile(DEFAULT_HEDGE_PERCENTILE), budgetPct(DEFAULT_HEDGE_BUDGET_PCT)
+{
+}
+
+AutotuneConfig::AutotuneConfig() : enabled(false), resultPath(DEFAULT_AUTOTUNE_RESULT_PATH),
+    trialMs(DEFAULT_AUTOTUNE_TRIAL_MS), latencyMs(0),
+    streamNums(begin(DEFAULT_AUTOTUNE_STREAM_NUMS), end(DEFAULT_AUTOTUNE_STREAM_NUMS)),
+    slotNums(begin(DEFAULT_AUTOTUNE_SLOT_NUMS), end(DEFAULT_AUTOTUNE_SLOT_NUMS)),
+    batchSizes(begin(DEFAULT_AUTOTUNE_BATCH_SIZES), end(DEFAULT_AUTOTUNE_BATCH_SIZES))
+{
+}
+
+FrameGateConfig::FrameGateConfig() : threshold(0.0f), maxReuse(DEFAULT_FRAME_GATE_MAX_REUSE),
+    maxReuseMs(DEFAULT_FRAME_GATE_MAX_REUSE_MS)
+{
+}
+
+ResultCacheConfig::ResultCacheConfig() : entries(0), ttlMs(DEFAULT_RESULT_CACHE_TTL_MS)
+{
+}
+
+NearDuplicateConfig::NearDuplicateConfig() : entries(0), maxDistance(DEFAULT_NEAR_DUPLICATE_DISTANCE)
+{
+}
+
+EngineConfig::EngineConfig() : deviceMemBudgetMb(0), defaultDeadlineMs(0), cpuThreads(DEFAULT_CPU_THREADS)
+{
+}
+
+Result EngineConfig::Load(const ConfigMap &config)
+{
+    GetStringList(config, "engine.models", models);
+    GetString(config, "engine.cpu_backend", cpuBackend);
+    GetString(config, "engine.autotune_file", autotune.resultPath);
+    size_t autotuneEnabled = autotune.enabled ? 1 : 0;
+    size_t bulkDelay = priority.bulkMaxBatchDelayUs;
+    if ((GetIntList(config, "engine.device_ids", deviceIds) != SUCCESS) ||
+        (GetIntList(config, "engine.device_numa_nodes", numaNodes) != SUCCESS) ||
+        (GetIntList(config, "engine.lane_groups", laneGroups) != SUCCESS) ||
+        (GetSize(config, "engine.device_mem_budget_mb", deviceMemBudgetMb) != SUCCESS) ||
+        (GetSize(config, "engine.interactive_streams", priority.interactiveStreams) != SUCCESS) ||
+        (GetSize(config, "engine.interactive_slots", priority.interactiveSlots) != SUCCESS) ||
+        (GetSize(config, "engine.bulk_max_batch_delay_us", bulkDelay) != SUCCESS) ||
+        (GetSize(config, "engine.default_deadline_ms", defaultDeadlineMs) != SUCCESS) ||
+        (GetSize(config, "engine.hedge_percentile", hedge.percentile) != SUCCESS) ||
+        (GetSize(config, "engine.hedge_budget_pct", hedge.budgetPct) != SUCCESS) ||
+        (GetSize(config, "engine.cpu_threads", cpuThreads) != SUCCESS) ||
+        (GetSize(config, "engine.autotune", autotuneEnabled) != SUCCESS) ||
+        (GetSize(config, "engine.autotune_trial_ms", autotune.trialMs) != SUCCESS) ||
+        (GetSize(config, "engine.autotune_latency_ms", autotune.latencyMs) != SUCCESS) ||
+        (GetSizeList(config, "engine.autotune_stream_nums", autotune.streamNums) != SUCCESS) ||
+        (GetSizeList(config, "engine.autotune_slot_nums", autotune.slotNums) != SUCCESS) ||
+        (GetSizeList(config, "engine.autotune_batch_sizes", autotune.batchSizes) != SUCCESS) ||
+        (GetFloat(config, "engine.frame_gate_threshold", frameGate.threshold) != SUCCESS) ||
+        (GetSize(config, "engine.frame_gate_max_reuse", frameGate.maxReuse) != SUCCESS) ||
+        (GetSize(config, "engine.frame_gate_max_reuse_ms", frameGate.maxReuseMs) != SUCCESS) ||
+        (GetSize(config, "engine.result_cache_entries", resultCache.entries) != SUCCESS) ||
+        (GetSize(config, "engine.result_cache_ttl_ms", resultCache.ttlMs) != SUCCESS) ||
+        (GetSize(config, "engine.near_duplicate_entries", nearDuplicate.entries) != SUCCESS) ||
+        (GetSize(config, "engine.near_duplicate_distance", nearDuplicate.maxDistance) != SUCCESS)) {
+        return FAILED;
+    }
+    if (nearDuplicate.maxDistance > MAX_NEAR_DUPLICATE_DISTANCE) {
+        ERROR_LOG("config engine.near_duplicate_distance = %zu exceeds the %zu bits of the hash",
+            nearDuplicate.maxDistance, MAX_NEAR_DUPLICATE_DISTANCE);
+        return FAILED;
+    }
+    autotune.enabled = (autotuneEnabled != 0);
+    priority.bulkMaxBatchDelayUs = static_cast<uint32_t>(bulkDelay);
+    INFO_LOG("priorities: %zu interactive streams and %zu interactive slots per stream, bulk batch within %u us",
+        priority.interactiveStreams, priority.interactiveSlots, priority.bulkMaxBatchDelayUs);
+    return SUCCESS;
+}
@@ -9,13 +9,42 @@
 */
 #include "sample_process.h"
 #include <iostream>
-#include "model_process.h"
+#include <memory>
 #include "acl/acl.h"
+#include "autotuner.h"
+#include "model_file_cache.h"
+#include "startup_timeline.h"
 #include "utils.h"
 using namespace std;
 extern bool g_isDevice;
 
-SampleProcess::SampleProcess() :deviceId_(0), context_(nullptr), stream_(nullptr)
+namespace {
+const char *SAMPLE_CONFIG_PATH = "../src/sample.cfg";
+const char *MODEL_NAME = "resnet50";
+const size_t TOP_NUM = 5;
+const vector<string> TEST_FILES = {
+    "../data/dog1_1024_683.bin",
+    "../data/dog2_1024_683.bin"
+};
+
+// 读取全部测试输入 任一文件读取失败返回空
+vector<InferRequestPtr> ReadTestFiles()
+{
+    TimelineStage stage("read inputs");
+    vector<InferRequestPtr> requests;
+    for (size_t index = 0; index < TEST_FILES.size(); ++index) {
+        InferRequestPtr request(new InferRequest());
+        if (Utils::ReadFileToHost(TEST_FILES[index], request->input) != SUCCESS) {
+            ERROR_LOG("read pic file failed, index is %zu", index);
+            return vector<InferRequestPtr>();
+        }
+        requests.push_back(request);
+    }
+    return requests;
+}
+}
+
+SampleProcess::SampleProcess() :aclInited_(false)
 {
 }
 
@@ -27,43 +56,31 @@ SampleProcess::~SampleProcess()
 // 初始化硬件环境
 Result SampleProcess::InitResource()
 {
+    StartupTimeline::Instance().Start();
+	// 先读配置 模型文件在aclInit和打开device的同时读入内存
+    if (LoadConfig() != SUCCESS) {
+        return FAILED;
+    }
+    vector<string> modelPaths = modelConfigs_[0].variantPaths;
+    if (modelPaths.empty()) {
+        modelPaths.push_back(modelConfigs_[0].modelPath);
+    }
+    for (size_t i = 0; i < modelPaths.size(); ++i) {
+        ModelFileCache::Instance().Prefetch(modelPaths[i]);
+    }
+
     // ACL init
     const char *aclConfigPath = "../src/acl.json";
+    TimelineStage aclStage("acl init");
 	// 初始化函数 进程环境初始化 只能调用一次
     aclError ret = aclInit(aclConfigPath);
     if (ret != ACL_ERROR_NONE) {
         ERROR_LOG("acl init failed");
         return FAILED;
     }
+    aclInited_ = true;
     INFO_LOG("acl init success");
 
-    // open device
-	// 指定用于运算的Device，（同时隐式创建默认Context。）
-    ret = aclrtSetDevice(deviceId_);
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("acl open device %d failed", deviceId_);
-        return FAILED;
-    }
-    INFO_LOG("open device %d success", deviceId_);
-
-    // create context (set current)
-	// 在当前进程或线程中显式创建一个Context.使用显式的Context增加可读性
-    ret = aclrtCreateContext(&context_, deviceId_);
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("acl create context failed");
-        return FAILED;
-    }
-    INFO_LOG("create context success");
-
-    // create stream
-	// 创建一个Stream
-    ret = aclrtCreateStream(&stream_);
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("acl create stream failed");
-        return FAILED;
-    }
-    INFO_LOG("create stream success");
-
     // get run mode
     aclrtRunMode runMode;
 	// 获取当前昇腾AI软件栈的运行模式
@@ -77,108 +94,116 @@ Result SampleProcess::InitResource()
     // 如果查询结果为ACL_DEVICE，则数据传输时仅需申请Device上的内存。
     g_isDevice = (runMode == ACL_DEVICE);
     INFO_LOG("get run mode success");
+    aclStage.End();
+
+	// 输入数据在加载模型的同时读取
+    inputs_ = async(launch::async, ReadTestFiles);
+
+	// 按芯片型号和模型文件调优stream数 slot数和batch大小 已有结果时直接使用
+    {
+        TimelineStage tuneStage("autotune");
+        if (Autotuner().Tune(engineConfig_, modelConfigs_) != SUCCESS) {
+            ERROR_LOG("autotune failed");
+            return FAILED;
+        }
+    }
+
+	// 在每个device上并行打开device 创建context 加载默认模型 启动executor
+    {
+        TimelineStage engineStage("engine init");
+        if (engine_.Init(engineConfig_, modelConfigs_) != SUCCESS) {
+            ERROR_LOG("init inference engine failed");
+            return FAILED;
+        }
+    }
+	// 默认模型已加载到每个device 其余模型按需从文件加载
+    ModelFileCache::Instance().Clear();
+    StartupTimeline::Instance().Report();
 	// 全部资源初始化完成
     return SUCCESS;
 }
 
-Result SampleProcess::Process()
+Result SampleProcess::LoadConfig()
 {
-    // model init
-    ModelProcess processModel;
-    const char* omModelPath = "../model/resnet50.om";
-	// 1.将模型文件加载进内存  得到模型ID 为识别模型的标志
-    Result ret = processModel.LoadModelFromFileWithMem(omModelPath);//返回了一个modelID
-    if (ret != SUCCESS) {
-        ERROR_LOG("execute LoadModelFromFileWithMem failed");
-        return FAILED;
+	// 读取模型的配置 stream数等参数按模型调整
+    ConfigMap config;
+    if (Utils::ReadConfigFile(SAMPLE_CONFIG_PATH, config) != SUCCESS) {
+        WARN_LOG("read config file %s failed, use default config", SAMPLE_CONFIG_PATH);
+        config.clear();
     }
-	// 2.获得模型的描述信息
-    ret = processModel.CreateDesc();
-    if (ret != SUCCESS) {
-        ERROR_LOG("execute CreateDesc failed");
+    if (engineConfig_.Load(config) != SUCCESS) {
+        ERROR_LOG("load engine config failed");
         return FAILED;
     }
-	// 3.从描述信息中获得模块的输出信息
-    ret = processModel.CreateOutput();
-    if (ret != SUCCESS) {
-        ERROR_LOG("execute CreateOutput failed");
-        return FAILED;
+	// 没有配置模型列表时只使用默认模型
+    if (engineConfig_.models.empty()) {
+        engineConfig_.models.push_back(MODEL_NAME);
     }
-	// 上面三步  得到了我们想要什么输出数据
-	
-    // loop begin
-    string testFile[] = {
-        "../data/dog1_1024_683.bin",
-        "../data/dog2_1024_683.bin"
-    };
-
-    for (size_t index = 0; index < sizeof(testFile) / sizeof(testFile[0]); ++index) {
-        INFO_LOG("start to process file:%s", testFile[index].c_str());
-        // model process
-		// 1.将文件读取至内存 得到大小和内容
-        uint32_t devBufferSize;
-        void *picDevBuffer = Utils::GetDeviceBufferOfFile(testFile[index], devBufferSize);
-        if (picDevBuffer == nullptr) {
-            ERROR_LOG("get pic device buffer failed,index is %zu", index);
+    modelConfigs_.resize(engineConfig_.models.size());
+    for (size_t i = 0; i < modelConfigs_.size(); ++i) {
+        const string &section = engineConfig_.models[i];
+        if (modelConfigs_[i].Load(config, section) != SUCCESS) {
+            ERROR_LOG("load config of model %s failed", section.c_str());
             return FAILED;
         }
-        // 2.将文件的内容放到输入中
-        ret = processModel.CreateInput(picDevBuffer, devBufferSize);
-        if (ret != SUCCESS) {
-            ERROR_LOG("execute CreateInput failed");
-            aclrtFree(picDevBuffer);
+        // stream和slot由所有模型共用 只读取默认模型的设置 其他模型设置了也不会生效
+        if ((i > 0) && ((config.count(section + ".stream_num") > 0) || (config.count(section + ".slot_num") > 0))) {
+            ERROR_LOG("stream_num and slot_num are shared by all models and set in the default model %s only, "
+                "remove them from model %s", engineConfig_.models[0].c_str(), section.c_str());
             return FAILED;
         }
-		// 3.执行模型推理，直到返回推理结果
-        ret = processModel.Execute();
-        if (ret != SUCCESS) {
-            ERROR_LOG("execute inference failed");
+    }
+    return SUCCESS;
+}
+
+Result SampleProcess::Process()
+{
+	// 输入在初始化时已开始读取
+    vector<InferRequestPtr> requests = inputs_.valid() ? inputs_.get() : ReadTestFiles();
+    if (requests.empty()) {
+        return FAILED;
+    }
+
+    for (size_t index = 0; index < requests.size(); ++index) {
+        INFO_LOG("start to process file:%s", TEST_FILES[index].c_str());
+        string fileName = TEST_FILES[index];
+        requests[index]->callback = [fileName](const InferResult &result) {
+            if (result.shed) {
+                WARN_LOG("file %s is shed, it could not finish before its deadline", fileName.c_str());
+                return;
+            }
+            if (result.ret != SUCCESS) {
+                ERROR_LOG("execute inference failed, file is %s", fileName.c_str());
+                return;
+            }
+            // print the top 5 confidence values with indexes
+            INFO_LOG("inference result of file:%s", fileName.c_str());
+            Utils::PrintTopResult(result.scores, TOP_NUM);
+        };
+        if (engine_.Submit(requests[index]) != SUCCESS) {
+            ERROR_LOG("submit inference failed, index is %zu", index);
             return FAILED;
         }
-	
-        // print the top 5 confidence values with indexes.use function DumpModelOutputResult
-        // if want to dump output result to file in the current directory
-        processModel.OutputModelResult(); //打印结果
-		// 释放
-        aclrtFree(picDevBuffer); // 释放保存文件的内存
-        processModel.DestroyInput(); // 必须释放输入 因为内存已经释放 输入无效
-    }// release model input buffer
-    // loop end
+    }
 
+	// 等待所有请求完成
+    engine_.WaitIdle();
     return SUCCESS;
 }
 
 void SampleProcess::DestroyResource()
 {
-    aclError ret;
-    if (stream_ != nullptr) {
-        ret = aclrtDestroyStream(stream_);
-        if (ret != ACL_ERROR_NONE) {
-            ERROR_LOG("destroy stream failed");
-        }
-        stream_ = nullptr;
+    if (inputs_.valid()) {
+        inputs_.wait();
     }
-    INFO_LOG("end to destroy stream");
+    engine_.Destroy();
 
-    if (context_ != nullptr) {
-        ret = aclrtDestroyContext(context_);
+    if (aclInited_) {
+        aclError ret = aclFinalize();
         if (ret != ACL_ERROR_NONE) {
-            ERROR_LOG("destroy context failed");
+            ERROR_LOG("finalize acl failed");
         }
-        context_ = nullptr;
+        aclInited_ = false;
+        INFO_LOG("end to finalize acl");
     }
-    INFO_LOG("end to destroy context");
-
-    ret = aclrtResetDevice(deviceId_);
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("reset device failed");
-    }
-    INFO_LOG("end to reset device is %d", deviceId_);
-
-    ret = aclFinalize();
-    if (ret != ACL_ERROR_NONE) {
-        ERROR_LOG("finalize acl failed");
-    }
-    INFO_LOG("end to finalize acl");
-
 }
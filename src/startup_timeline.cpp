@@ -0,0 +1,102 @@
+/**
+* @file startup_timeline.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "startup_timeline.h"
+#include <algorithm>
+using namespace std;
+
+namespace {
+const size_t BAR_WIDTH = 40;
+}
+
+StartupTimeline &StartupTimeline::Instance()
+{
+    static StartupTimeline timeline;
+    return timeline;
+}
+
+StartupTimeline::StartupTimeline() : zero_(chrono::steady_clock::now()), recording_(false)
+{
+}
+
+void StartupTimeline::Start()
+{
+    lock_guard<mutex> lock(mutex_);
+    zero_ = chrono::steady_clock::now();
+    stages_.clear();
+    recording_ = true;
+}
+
+void StartupTimeline::Record(const string &name, chrono::steady_clock::time_point begin,
+    chrono::steady_clock::time_point end)
+{
+    lock_guard<mutex> lock(mutex_);
+    // 启动结束后的加载 如按需加载和重新加载 不再记录
+    if (!recording_) {
+        return;
+    }
+    Stage stage;
+    stage.name = name;
+    stage.beginMs = chrono::duration<double, milli>(begin - zero_).count();
+    stage.endMs = chrono::duration<double, milli>(end - zero_).count();
+    stages_.push_back(stage);
+}
+
+void StartupTimeline::Report()
+{
+    vector<Stage> stages;
+    {
+        lock_guard<mutex> lock(mutex_);
+        stages.swap(stages_);
+        recording_ = false;
+    }
+    if (stages.empty()) {
+        return;
+    }
+    sort(stages.begin(), stages.end(), [](const Stage &a, const Stage &b) {
+        return a.beginMs < b.beginMs;
+    });
+    double totalMs = 0.0;
+    for (size_t i = 0; i < stages.size(); ++i) {
+        totalMs = max(totalMs, stages[i].endMs);
+    }
+
+    INFO_LOG("startup timeline, %.1f ms in total", totalMs);
+    for (size_t i = 0; i < stages.size(); ++i) {
+        // 每个阶段画成一段横条 同一列上重叠的横条就是并行执行的阶段
+        string bar(BAR_WIDTH, ' ');
+        if (totalMs > 0.0) {
+            size_t from = static_cast<size_t>(stages[i].beginMs / totalMs * BAR_WIDTH);
+            size_t to = static_cast<size_t>(stages[i].endMs / totalMs * BAR_WIDTH);
+            from = min(from, BAR_WIDTH - 1);
+            to = min(max(to, from + 1), BAR_WIDTH);
+            bar.replace(from, to - from, to - from, '#');
+        }
+        INFO_LOG("  |%s| %8.1f - %8.1f ms %8.1f ms  %s", bar.c_str(), stages[i].beginMs, stages[i].endMs,
+            stages[i].endMs - stages[i].beginMs, stages[i].name.c_str());
+    }
+}
+
+TimelineStage::TimelineStage(const string &name) : name_(name), begin_(chrono::steady_clock::now()), ended_(false)
+{
+}
+
+TimelineStage::~TimelineStage()
+{
+    End();
+}
+
+void TimelineStage::End()
+{
+    if (ended_) {
+        return;
+    }
+    ended_ = true;
+    StartupTimeline::Instance().Record(name_, begin_, chrono::steady_clock::now());
+}
@@ -0,0 +1,653 @@
+/**
+* @file stream_executor.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "stream_executor.h"
+#include <algorithm>
+#include "acl/acl.h"
+using namespace std;
+
+namespace {
+const size_t MIN_SLOT_NUM = 2;
+const double US_PER_MS = 1000.0;
+
+float GetTopMargin(const vector<float> &scores)
+{
+    // top1与top2之差 只有一个分数时无法判断 按不确定处理
+    if (scores.size() < 2) {
+        return 0.0f;
+    }
+    vector<float> top(2);
+    partial_sort_copy(scores.begin(), scores.end(), top.begin(), top.end(), greater<float>());
+    return top[0] - top[1];
+}
+}
+
+StreamExecutor::StreamExecutor() : registry_(nullptr), reporter_(nullptr), context_(nullptr), stream_(nullptr), nextSlot_(0),
+    outstanding_(0), busyUs_(0), reserved_(false), bulkSlotLimit_(0), bulkBusy_(0), stealer_(nullptr), stop_(false)
+{
+    for (size_t i = 0; i < PRIORITY_NUM; ++i) {
+        queuedBatches_[i] = 0;
+    }
+}
+
+StreamExecutor::~StreamExecutor()
+{
+    Destroy();
+}
+
+Result StreamExecutor::Init(ModelRegistry *registry, const ModelKey &defaultModel, CallbackReporter *reporter,
+    aclrtContext context, size_t slotNum)
+{
+    shared_ptr<ModelFamily> family = (registry != nullptr) ? registry->Acquire(defaultModel) : nullptr;
+    shared_ptr<const ModelProcess> model = (family != nullptr) ? family->GetModel() : nullptr;
+    if ((model == nullptr) || (model->GetModelDesc() == nullptr) || (reporter == nullptr) || (context == nullptr)) {
+        ERROR_LOG("model is not ready or reporter / context is null, init stream executor failed");
+        return FAILED;
+    }
+    // 至少两个slot 才能让上传/回传与计算交叠
+    if (slotNum < MIN_SLOT_NUM) {
+        WARN_LOG("slot num %zu is too small, use %zu instead", slotNum, MIN_SLOT_NUM);
+        slotNum = MIN_SLOT_NUM;
+    }
+
+    registry_ = registry;
+    context_ = context;
+    aclError ret = aclrtCreateStream(&stream_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("acl create stream failed");
+        return FAILED;
+    }
+    if (reporter->Subscribe(stream_) != SUCCESS) {
+        return FAILED;
+    }
+    reporter_ = reporter;
+    // slot的buffer按所有变体中最大的尺寸申请 执行不同变体时只重新绑定
+    ModelIoSizes capacity = family->GetIoCapacity();
+    slots_.resize(slotNum);
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        slots_[i].owner = this;
+        slots_[i].context.reset(new ModelContext());
+        if (slots_[i].context->Init(model, capacity) != SUCCESS) {
+            ERROR_LOG("create execution slot %zu failed", i);
+            return FAILED;
+        }
+    }
+
+    bulkSlotLimit_ = slotNum;
+    INFO_LOG("create stream executor with %zu slots success", slotNum);
+    return SUCCESS;
+}
+
+void StreamExecutor::SetPriorityPolicy(bool reserved, size_t reservedSlots)
+{
+    lock_guard<mutex> lock(mutex_);
+    reserved_ = reserved;
+    // 预留的slot只给交互请求 保证交互batch到达时总有空闲slot 批量请求至少可以用一个slot
+    if (reserved) {
+        bulkSlotLimit_ = 1;
+    } else {
+        bulkSlotLimit_ = (slots_.size() > reservedSlots) ? (slots_.size() - reservedSlots) : 1;
+    }
+}
+
+Result StreamExecutor::Warmup(const ModelKey &model, const WarmupPolicy &policy, vector<WarmupResult> &results)
+{
+    results.clear();
+    shared_ptr<ModelFamily> family = (registry_ != nullptr) ? registry_->Acquire(model) : nullptr;
+    if ((family == nullptr) || thread_.joinable()) {
+        ERROR_LOG("model is not ready or stream executor already started, warmup failed");
+        return FAILED;
+    }
+    if (policy.minIterations == 0) {
+        return SUCCESS;
+    }
+    // 每个slot的buffer和每个变体都要经过预热 首次执行的开销不落到真实请求上
+    shared_ptr<VariantSelector> selector = family->GetSelector();
+    vector<size_t> batchSizes = family->GetBatchSizes();
+    for (size_t i = 0; i < batchSizes.size(); ++i) {
+        shared_ptr<const ModelProcess> variant = family->Acquire(batchSizes[i]);
+        for (size_t j = 0; j < slots_.size(); ++j) {
+            WarmupResult result;
+            if ((variant == nullptr) || (slots_[j].context->Bind(variant) != SUCCESS) ||
+                (slots_[j].context->Warmup(stream_, policy, result) != SUCCESS)) {
+                ERROR_LOG("warm up slot %zu with batch %zu failed", j, batchSizes[i]);
+                return FAILED;
+            }
+            results.push_back(result);
+            if ((selector != nullptr) && (result.steadyMs > 0.0f)) {
+                selector->Record(result.batchSize, result.steadyMs);
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+Result StreamExecutor::Start()
+{
+    if (slots_.empty() || thread_.joinable()) {
+        ERROR_LOG("stream executor is not initialized or already started");
+        return FAILED;
+    }
+    stop_ = false;
+    thread_ = thread(&StreamExecutor::Run, this);
+    return SUCCESS;
+}
+
+Result StreamExecutor::Enqueue(const InferBatchPtr &batch)
+{
+    bool backlog = false;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (stop_ || !thread_.joinable()) {
+            ERROR_LOG("stream executor is not running, enqueue failed");
+            return FAILED;
+        }
+        queues_[batch->priority].push_back(batch);
+        ++queuedBatches_[batch->priority];
+        outstanding_ += batch->requests.size();
+        RecordLane(batch, this);
+        backlog = (queues_[batch->priority].size() > 1) || (GetRunnablePriority() == PRIORITY_NUM);
+    }
+    cond_.notify_one();
+    // 本lane处理不过来 唤醒其他lane来取走排队的batch
+    WorkStealer *stealer = stealer_.load();
+    if (backlog && (stealer != nullptr)) {
+        stealer->NotifyBacklog(this);
+    }
+    return SUCCESS;
+}
+
+void StreamExecutor::SetStealer(WorkStealer *stealer)
+{
+    stealer_ = stealer;
+    Wake();
+}
+
+size_t StreamExecutor::GetOutstanding() const
+{
+    return outstanding_.load();
+}
+
+size_t StreamExecutor::GetQueuedBatches(InferPriority priority) const
+{
+    return queuedBatches_[priority].load();
+}
+
+double StreamExecutor::GetBusyMs() const
+{
+    return busyUs_.load() / US_PER_MS;
+}
+
+void StreamExecutor::RecordLane(const InferBatchPtr &batch, StreamExecutor *lane)
+{
+    // 对冲的请求记下所在lane 副本不会被派到同一个lane
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        if (batch->requests[i]->lane != nullptr) {
+            batch->requests[i]->lane->store(lane);
+        }
+    }
+}
+
+InferBatchPtr StreamExecutor::StealBatch(StreamExecutor *thief, InferPriority priority)
+{
+    InferBatchPtr batch;
+    {
+        lock_guard<mutex> lock(mutex_);
+        deque<InferBatchPtr> &queue = queues_[priority];
+        if (queue.empty()) {
+            return nullptr;
+        }
+        // 从队尾取最新的batch 本lane自己从队头取 两端互不干扰
+        batch = queue.back();
+        queue.pop_back();
+        --queuedBatches_[priority];
+        // 先计入thief再从本lane扣除 等待空闲的一方不会看到积压数短暂为0
+        thief->outstanding_ += batch->requests.size();
+        outstanding_ -= batch->requests.size();
+        RecordLane(batch, thief);
+    }
+    idleCond_.notify_all();
+    return batch;
+}
+
+void StreamExecutor::Wake()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+    }
+    cond_.notify_all();
+}
+
+void StreamExecutor::WaitIdle()
+{
+    unique_lock<mutex> lock(mutex_);
+    idleCond_.wait(lock, [this] { return outstanding_.load() == 0; });
+}
+
+void StreamExecutor::Run()
+{
+    // 每个线程都要设置当前context 才能在该device上下发任务
+    aclError aclRet = aclrtSetCurrentContext(context_);
+    if (aclRet != ACL_ERROR_NONE) {
+        ERROR_LOG("set current context failed, ret[%d]", aclRet);
+    }
+
+    while (true) {
+        InferBatchPtr batch;
+        ExecSlot *slot = nullptr;
+        bool escalate = false;
+        bool allowBulk = false;
+        {
+            // 只等待队列和空闲slot 执行完成由回调线程通知 这里不会阻塞在stream同步上
+            unique_lock<mutex> lock(mutex_);
+            cond_.wait(lock, [this] {
+                return (stop_ && !HasQueuedBatch()) || (GetRunnablePriority() != PRIORITY_NUM) || CanSteal() ||
+                    !cascades_.empty();
+            });
+            if (cascades_.empty() && !HasQueuedBatch() && stop_) {
+                // 停止时等所有已下发的slot回调完成再退出 回调中转给完整模型的样本照常执行
+                cond_.wait(lock, [this] { return !HasBusySlot() || !cascades_.empty(); });
+                if (cascades_.empty()) {
+                    break;
+                }
+            }
+            // 级联中转给完整模型的样本已占有slot 最先执行 交互请求总是先于批量请求 批量请求只能占用限定数量的slot
+            InferPriority priority = GetRunnablePriority();
+            if (!cascades_.empty()) {
+                slot = cascades_.front();
+                cascades_.pop_front();
+                escalate = true;
+            } else if (priority != PRIORITY_NUM) {
+                batch = queues_[priority].front();
+                queues_[priority].pop_front();
+                --queuedBatches_[priority];
+                slot = FindFreeSlot();
+                slot->busy = true;
+                slot->bulk = (priority == PRIORITY_BULK);
+                bulkBusy_ += slot->bulk ? 1 : 0;
+            }
+            allowBulk = CanRunBulk();
+        }
+        if (escalate) {
+            (void)Escalate(*slot);
+            continue;
+        }
+        if (slot != nullptr) {
+            (void)Submit(*slot, batch);
+            continue;
+        }
+        // 自己空闲而其他lane有积压 取一个batch放到自己队头 下一轮照常执行
+        batch = stealer_.load()->Steal(this, allowBulk);
+        if (batch != nullptr) {
+            lock_guard<mutex> lock(mutex_);
+            queues_[batch->priority].push_front(batch);
+            ++queuedBatches_[batch->priority];
+        }
+    }
+}
+
+bool StreamExecutor::HasQueuedBatch() const
+{
+    for (size_t i = 0; i < PRIORITY_NUM; ++i) {
+        if (!queues_[i].empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StreamExecutor::CanRunBulk() const
+{
+    // 预留给交互请求的lane 只在完全空闲时执行一个批量batch
+    if (reserved_ && HasBusySlot()) {
+        return false;
+    }
+    return bulkBusy_ < bulkSlotLimit_;
+}
+
+InferPriority StreamExecutor::GetRunnablePriority() const
+{
+    if (!HasFreeSlot()) {
+        return PRIORITY_NUM;
+    }
+    if (!queues_[PRIORITY_INTERACTIVE].empty()) {
+        return PRIORITY_INTERACTIVE;
+    }
+    if (!queues_[PRIORITY_BULK].empty() && CanRunBulk()) {
+        return PRIORITY_BULK;
+    }
+    return PRIORITY_NUM;
+}
+
+bool StreamExecutor::CanSteal() const
+{
+    WorkStealer *stealer = stealer_.load();
+    return !stop_ && !HasQueuedBatch() && (stealer != nullptr) && HasFreeSlot() &&
+        stealer->HasBacklog(this, CanRunBulk());
+}
+
+bool StreamExecutor::HasFreeSlot() const
+{
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        if (!slots_[i].busy) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ExecSlot *StreamExecutor::FindFreeSlot()
+{
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        ExecSlot &slot = slots_[(nextSlot_ + i) % slots_.size()];
+        if (!slot.busy) {
+            nextSlot_ = (nextSlot_ + i + 1) % slots_.size();
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+bool StreamExecutor::HasBusySlot() const
+{
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        if (slots_[i].busy) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void StreamExecutor::FinishBatch(const InferBatchPtr &batch, const ModelContext *context)
+{
+    // context为空表示执行失败 否则按batch顺序把各样本的结果分发给对应请求
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        InferResult result;
+        if (context != nullptr) {
+            (void)context->GetResult(i, result);
+        }
+        if (batch->requests[i]->callback) {
+            batch->requests[i]->callback(result);
+        }
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        outstanding_ -= batch->requests.size();
+    }
+    idleCond_.notify_all();
+}
+
+void StreamExecutor::DropUnneededRequests(const InferBatchPtr &batch, double latencyMs)
+{
+    chrono::steady_clock::time_point finish = chrono::steady_clock::now() +
+        chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(latencyMs));
+    vector<InferRequestPtr> live;
+    vector<InferRequestPtr> late;
+    vector<InferRequestPtr> cancelled;
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        if (IsCancelled(batch->requests[i])) {
+            cancelled.push_back(batch->requests[i]);
+        } else if (batch->requests[i]->deadline < finish) {
+            late.push_back(batch->requests[i]);
+        } else {
+            live.push_back(batch->requests[i]);
+        }
+    }
+    if (late.empty() && cancelled.empty()) {
+        return;
+    }
+    batch->requests.swap(live);
+    for (size_t i = 0; i < late.size(); ++i) {
+        ShedRequest(late[i]);
+    }
+    for (size_t i = 0; i < cancelled.size(); ++i) {
+        CancelRequest(cancelled[i]);
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        outstanding_ -= late.size() + cancelled.size();
+    }
+    idleCond_.notify_all();
+}
+
+void StreamExecutor::ReleaseRetiredModels()
+{
+    lock_guard<mutex> lock(mutex_);
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        shared_ptr<const ModelProcess> model = slots_[i].context->GetModel();
+        if (!slots_[i].busy && (model != nullptr) && model->IsRetired()) {
+            model.reset();
+            slots_[i].context->Unbind();
+        }
+    }
+}
+
+void StreamExecutor::ReleaseSlot(ExecSlot &slot)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        // 模型已被淘汰或被重新加载替换 执行完成后立即解除绑定 最后一个slot解除时旧模型卸载
+        shared_ptr<const ModelProcess> model = slot.context->GetModel();
+        if ((model != nullptr) && model->IsRetired()) {
+            model.reset();
+            slot.context->Unbind();
+        }
+        slot.batch.reset();
+        slot.cascadeSources.clear();
+        slot.family.reset();
+        slot.busy = false;
+        bulkBusy_ -= slot.bulk ? 1 : 0;
+        slot.bulk = false;
+    }
+    cond_.notify_all();
+}
+
+Result StreamExecutor::Submit(ExecSlot &slot, const InferBatchPtr &batch)
+{
+    // 取得batch所属的模型(未加载时按需加载) 选择能容纳该batch的最小变体 绑定到slot的buffer上
+    ModelContext &context = *slot.context;
+    slot.family = registry_->Acquire(batch->model);
+    // 上传前丢弃执行完也赶不上截止时间的请求和已被对冲副本取代的请求 不在无用的结果上花费device时间
+    shared_ptr<VariantSelector> selector = (slot.family != nullptr) ? slot.family->GetSelector() : nullptr;
+    DropUnneededRequests(batch, (selector != nullptr) ? selector->GetLatency(batch->requests.size()) : 0.0);
+    if (batch->requests.empty()) {
+        ReleaseSlot(slot);
+        return SUCCESS;
+    }
+    size_t batchSize = batch->requests.size();
+    shared_ptr<const ModelProcess> model = (slot.family != nullptr) ? slot.family->Acquire(batchSize) : nullptr;
+    if ((model == nullptr) || (context.Bind(model) != SUCCESS)) {
+        ERROR_LOG("no model variant of %s for batch %zu", batch->model.name.c_str(), batchSize);
+        FinishBatch(batch, nullptr);
+        ReleaseSlot(slot);
+        return FAILED;
+    }
+
+    // 各样本依次放到输入的对应位置 整个batch一次上传
+    size_t sampleSize = model->GetSampleInputSize(batch->height, batch->width);
+    for (size_t i = 0; i < batchSize; ++i) {
+        const InferRequestPtr &request = batch->requests[i];
+        const vector<uint8_t> &input = request->input;
+        Result staged = FAILED;
+        if (request->writer) {
+            staged = context.StageInput(i * sampleSize, sampleSize, request->writer);
+        } else if (input.size() <= sampleSize) {
+            staged = context.StageInput(i * sampleSize, input.data(), input.size());
+        }
+        if (staged != SUCCESS) {
+            ERROR_LOG("stage sample %zu of batch failed, input size %zu", i, input.size());
+            FinishBatch(batch, nullptr);
+            ReleaseSlot(slot);
+            return FAILED;
+        }
+    }
+    if ((context.SetBatchSize(batchSize) != SUCCESS) ||
+        (context.SetImageSize(batch->height, batch->width) != SUCCESS) ||
+        (context.UploadInputAsync(batchSize * sampleSize, stream_) != SUCCESS) ||
+        (context.ExecuteAsync(stream_) != SUCCESS)) {
+        FinishBatch(batch, nullptr);
+        ReleaseSlot(slot);
+        return FAILED;
+    }
+    return LaunchCompletion(slot, batch);
+}
+
+Result StreamExecutor::Escalate(ExecSlot &slot)
+{
+    // 完整模型直接使用slot中已上传给轻量模型的输入 要执行的样本在device上前移补齐空位 不再从host上传
+    InferBatchPtr batch = slot.batch;
+    ModelContext &context = *slot.context;
+    shared_ptr<const ModelProcess> light = context.GetModel();
+    slot.family = registry_->Acquire(batch->model);
+    size_t batchSize = batch->requests.size();
+    shared_ptr<const ModelProcess> model = (slot.family != nullptr) ? slot.family->Acquire(batchSize) : nullptr;
+    size_t sampleSize = (light != nullptr) ? light->GetSampleInputSize(batch->height, batch->width) : 0;
+    if ((model == nullptr) || (sampleSize == 0) ||
+        (model->GetSampleInputSize(batch->height, batch->width) != sampleSize) || !context.CanBind(model)) {
+        // buffer放不下完整模型时要重新申请 输入只能从host重新上传
+        WARN_LOG("input of model %s cannot be reused on device, upload it again", batch->model.name.c_str());
+        return Submit(slot, batch);
+    }
+    if (context.Bind(model) != SUCCESS) {
+        FinishBatch(batch, nullptr);
+        ReleaseSlot(slot);
+        return FAILED;
+    }
+    for (size_t i = 0; i < batchSize; ++i) {
+        size_t source = slot.cascadeSources[i];
+        if ((source != i) && (context.MoveInputAsync(source * sampleSize, i * sampleSize, sampleSize, stream_) !=
+            SUCCESS)) {
+            FinishBatch(batch, nullptr);
+            ReleaseSlot(slot);
+            return FAILED;
+        }
+    }
+    if ((context.SetBatchSize(batchSize) != SUCCESS) ||
+        (context.SetImageSize(batch->height, batch->width) != SUCCESS) ||
+        (context.ExecuteAsync(stream_) != SUCCESS)) {
+        FinishBatch(batch, nullptr);
+        ReleaseSlot(slot);
+        return FAILED;
+    }
+    return LaunchCompletion(slot, batch);
+}
+
+Result StreamExecutor::LaunchCompletion(ExecSlot &slot, const InferBatchPtr &batch)
+{
+    slot.batch = batch;
+    // 回调排在回传之后 在回调线程中分发结果并释放slot 不阻塞stream
+    aclError ret = aclrtLaunchCallback(&StreamExecutor::SlotCallback, &slot, ACL_CALLBACK_NO_BLOCK, stream_);
+    if (ret != ACL_ERROR_NONE) {
+        ERROR_LOG("launch callback failed, ret[%d], wait for the slot instead", ret);
+        CompleteSlot(slot);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+void StreamExecutor::SlotCallback(void *userData)
+{
+    ExecSlot *slot = static_cast<ExecSlot *>(userData);
+    slot->owner->CompleteSlot(*slot);
+}
+
+void StreamExecutor::CompleteSlot(ExecSlot &slot)
+{
+    // 回调在event之后执行 此时同步会立即返回 只用于取得执行结果
+    Result ret = slot.context->Synchronize();
+    float ms = 0.0f;
+    if ((ret == SUCCESS) && (slot.context->GetElapsedTime(ms) == SUCCESS)) {
+        busyUs_ += static_cast<uint64_t>(ms * US_PER_MS);
+        shared_ptr<VariantSelector> selector = slot.family->GetSelector();
+        if (selector != nullptr) {
+            selector->Record(slot.context->GetModel()->GetMaxBatchSize(), ms);
+        }
+    }
+    if ((ret == SUCCESS) && (slot.batch->cascade != nullptr)) {
+        CompleteCascadeStage(slot);
+        return;
+    }
+    FinishBatch(slot.batch, (ret == SUCCESS) ? slot.context.get() : nullptr);
+    ReleaseSlot(slot);
+}
+
+void StreamExecutor::CompleteCascadeStage(ExecSlot &slot)
+{
+    // 轻量模型top1领先top2足够多的样本直接返回结果 其余样本转给完整模型 slot和其中的输入保留给它们
+    InferBatchPtr batch = slot.batch;
+    CascadePlan &plan = *batch->cascade;
+    InferBatchPtr escalated(new InferBatch());
+    escalated->model = plan.full;
+    escalated->height = batch->height;
+    escalated->width = batch->width;
+    escalated->priority = batch->priority;
+    vector<size_t> sources;
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+        InferResult result;
+        if ((slot.context->GetResult(i, result) == SUCCESS) && (GetTopMargin(result.scores) >= plan.margin)) {
+            if (batch->requests[i]->callback) {
+                batch->requests[i]->callback(result);
+            }
+        } else {
+            escalated->requests.push_back(batch->requests[i]);
+            sources.push_back(i);
+        }
+    }
+    plan.samples += batch->requests.size();
+    plan.escalated += sources.size();
+    bool escalate = !sources.empty();
+    {
+        lock_guard<mutex> lock(mutex_);
+        outstanding_ -= batch->requests.size() - sources.size();
+        if (escalate) {
+            slot.batch = escalated;
+            slot.cascadeSources.swap(sources);
+            cascades_.push_back(&slot);
+        }
+    }
+    idleCond_.notify_all();
+    if (escalate) {
+        cond_.notify_all();
+    } else {
+        ReleaseSlot(slot);
+    }
+}
+
+void StreamExecutor::Stop()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void StreamExecutor::Destroy()
+{
+    Stop();
+    stealer_ = nullptr;
+    slots_.clear();
+    nextSlot_ = 0;
+    if ((stream_ != nullptr) && (reporter_ != nullptr)) {
+        reporter_->Unsubscribe(stream_);
+    }
+    reporter_ = nullptr;
+    if (stream_ != nullptr) {
+        aclError ret = aclrtDestroyStream(stream_);
+        if (ret != ACL_ERROR_NONE) {
+            ERROR_LOG("destroy stream failed");
+        }
+        stream_ = nullptr;
+    }
+    context_ = nullptr;
+    registry_ = nullptr;
+}
@@ -11,6 +11,7 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <algorithm>
 #include "acl/acl.h"
 #include <sys/stat.h>
 
@@ -118,3 +119,89 @@ void* Utils::GetDeviceBufferOfFile(std::string fileName, uint32_t &fileSize)
 	// 结果就是  如果是acl_mode  会直接将文件内容读取至设备内存   
 	// 如果不是  先将文件内容读取到host内存 再拷贝至设备
 }
+
+// 按置信度从大到小输出前topNum个结果
+void Utils::PrintTopResult(const std::vector<float> &scores, size_t topNum)
+{
+    std::vector<size_t> index(scores.size());
+    for (size_t i = 0; i < index.size(); ++i) {
+        index[i] = i;
+    }
+    topNum = std::min(topNum, index.size());
+    std::partial_sort(index.begin(), index.begin() + topNum, index.end(),
+        [&scores](size_t a, size_t b) { return scores[a] > scores[b]; });
+    for (size_t i = 0; i < topNum; ++i) {
+        INFO_LOG("top %zu: index[%zu] value[%lf]", i + 1, index[i], scores[index[i]]);
+    }
+}
+
+// 读取文件内容到普通host内存 不依赖运行模式
+Result Utils::ReadFileToHost(const std::string &fileName, std::vector<uint8_t> &data)
+{
+    std::ifstream binFile(fileName, std::ifstream::binary);
+    if (!binFile.is_open()) {
+        ERROR_LOG("open file %s failed", fileName.c_str());
+        return FAILED;
+    }
+    binFile.seekg(0, binFile.end);
+    std::streamoff fileLen = binFile.tellg();
+    if (fileLen <= 0) {
+        ERROR_LOG("file is empty, filename is %s", fileName.c_str());
+        return FAILED;
+    }
+    binFile.seekg(0, binFile.beg);
+    data.resize(static_cast<size_t>(fileLen));
+    binFile.read(reinterpret_cast<char *>(data.data()), fileLen);
+    return SUCCESS;
+}
+
+namespace {
+std::string Trim(const std::string &str)
+{
+    const char *blank = " \t\r\n";
+    size_t begin = str.find_first_not_of(blank);
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = str.find_last_not_of(blank);
+    return str.substr(begin, end - begin + 1);
+}
+}
+
+// 配置文件按行解析 [section] 下的key保存为 section.key
+Result Utils::ReadConfigFile(const std::string &fileName, ConfigMap &config)
+{
+    std::ifstream cfgFile(fileName);
+    if (!cfgFile.is_open()) {
+        ERROR_LOG("open config file %s failed", fileName.c_str());
+        return FAILED;
+    }
+
+    std::string section;
+    std::string line;
+    size_t lineNo = 0;
+    while (std::getline(cfgFile, line)) {
+        ++lineNo;
+        size_t commentPos = line.find('#');
+        if (commentPos != std::string::npos) {
+            line.erase(commentPos);
+        }
+        line = Trim(line);
+        if (line.empty()) {
+            continue;
+        }
+        if ((line.front() == '[') && (line.back() == ']')) {
+            section = Trim(line.substr(1, line.size() - 2));
+            continue;
+        }
+        size_t eqPos = line.find('=');
+        if (eqPos == std::string::npos) {
+            ERROR_LOG("invalid line %zu in config file %s", lineNo, fileName.c_str());
+            return FAILED;
+        }
+        std::string key = Trim(line.substr(0, eqPos));
+        std::string value = Trim(line.substr(eqPos + 1));
+        config[section.empty() ? key : section + "." + key] = value;
+    }
+    return SUCCESS;
+}
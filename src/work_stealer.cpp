@@ -0,0 +1,90 @@
+/**
+* @file work_stealer.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include "work_stealer.h"
+#include "stream_executor.h"
+using namespace std;
+
+void WorkStealer::AddLane(StreamExecutor *lane, int32_t numaNode)
+{
+    Lane entry;
+    entry.executor = lane;
+    entry.numaNode = numaNode;
+    lanes_.push_back(entry);
+}
+
+int32_t WorkStealer::GetNumaNode(const StreamExecutor *lane) const
+{
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+        if (lanes_[i].executor == lane) {
+            return lanes_[i].numaNode;
+        }
+    }
+    return -1;
+}
+
+bool WorkStealer::HasBacklog(const StreamExecutor *thief, bool allowBulk) const
+{
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+        if (lanes_[i].executor == thief) {
+            continue;
+        }
+        if ((lanes_[i].executor->GetQueuedBatches(PRIORITY_INTERACTIVE) > 0) ||
+            (allowBulk && (lanes_[i].executor->GetQueuedBatches(PRIORITY_BULK) > 0))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+InferBatchPtr WorkStealer::Steal(StreamExecutor *thief, bool allowBulk)
+{
+    // 交互请求优先 同一优先级先在同一NUMA节点内找积压最多的lane 没有再跨节点 避免输入数据跨节点访问
+    int32_t numaNode = GetNumaNode(thief);
+    size_t priorityNum = allowBulk ? PRIORITY_NUM : (PRIORITY_INTERACTIVE + 1);
+    for (size_t priority = 0; priority < priorityNum; ++priority) {
+        for (int pass = 0; pass < 2; ++pass) {
+            StreamExecutor *victim = nullptr;
+            size_t victimQueued = 0;
+            for (size_t i = 0; i < lanes_.size(); ++i) {
+                StreamExecutor *lane = lanes_[i].executor;
+                if ((lane == thief) || ((lanes_[i].numaNode == numaNode) != (pass == 0))) {
+                    continue;
+                }
+                size_t queued = lane->GetQueuedBatches(static_cast<InferPriority>(priority));
+                if (queued > victimQueued) {
+                    victim = lane;
+                    victimQueued = queued;
+                }
+            }
+            if (victim == nullptr) {
+                continue;
+            }
+            InferBatchPtr batch = victim->StealBatch(thief, static_cast<InferPriority>(priority));
+            if (batch != nullptr) {
+                return batch;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void WorkStealer::NotifyBacklog(const StreamExecutor *busy)
+{
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+        if (lanes_[i].executor != busy) {
+            lanes_[i].executor->Wake();
+        }
+    }
+}
+
+void WorkStealer::Clear()
+{
+    lanes_.clear();
+}
@@ -0,0 +1,75 @@
+/**
+* @file frame_gate_test.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include <cstdlib>
+#include <vector>
+#include "frame_gate.h"
+using namespace std;
+
+namespace {
+const size_t MAX_LENGTH = 80;      // covers the 16 byte blocks and every tail length
+const size_t LONG_LENGTH = 4103;   // 256 full blocks and a tail of 7 bytes
+const uint32_t SEED = 12345;
+
+uint32_t ScalarSumAbsDiff(const vector<uint8_t> &first, const vector<uint8_t> &second)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < first.size(); ++i) {
+        sum += static_cast<uint32_t>(abs(static_cast<int>(first[i]) - static_cast<int>(second[i])));
+    }
+    return sum;
+}
+
+bool Check(const vector<uint8_t> &first, const vector<uint8_t> &second, const char *name)
+{
+    uint32_t expected = ScalarSumAbsDiff(first, second);
+    uint32_t actual = FrameGate::SumAbsDiff(first.data(), second.data(), first.size());
+    if (actual != expected) {
+        ERROR_LOG("%s: length %zu gives %u, expected %u", name, first.size(), actual, expected);
+        return false;
+    }
+    return true;
+}
+
+uint8_t NextByte(uint32_t &state)
+{
+    state = state * 1103515245 + 12345;
+    return static_cast<uint8_t>(state >> 16);
+}
+}
+
+int main()
+{
+    bool passed = true;
+    uint32_t state = SEED;
+    // 随机数据 覆盖不是16整数倍的长度
+    for (size_t length = 0; length <= MAX_LENGTH; ++length) {
+        vector<uint8_t> first(length);
+        vector<uint8_t> second(length);
+        for (size_t i = 0; i < length; ++i) {
+            first[i] = NextByte(state);
+            second[i] = NextByte(state);
+        }
+        passed = Check(first, second, "random") && passed;
+        passed = Check(first, first, "identical") && passed;
+    }
+    // 每个字节的差都是255 部分和不能溢出
+    for (size_t length = 0; length <= MAX_LENGTH; ++length) {
+        passed = Check(vector<uint8_t>(length, 0xFF), vector<uint8_t>(length, 0), "0xFF and 0") && passed;
+        passed = Check(vector<uint8_t>(length, 0), vector<uint8_t>(length, 0xFF), "0 and 0xFF") && passed;
+        passed = Check(vector<uint8_t>(length, 0xFF), vector<uint8_t>(length, 0xFF), "all 0xFF") && passed;
+    }
+    passed = Check(vector<uint8_t>(LONG_LENGTH, 0xFF), vector<uint8_t>(LONG_LENGTH, 0), "long 0xFF") && passed;
+    if (!passed) {
+        ERROR_LOG("frame gate test failed");
+        return 1;
+    }
+    INFO_LOG("frame gate test passed");
+    return 0;
+}
@@ -0,0 +1,187 @@
+/**
+* @file near_duplicate_index_test.cpp
+*
+* Copyright (C) 2020. Huawei Technologies Co., Ltd. All rights reserved.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "near_duplicate_index.h"
+using namespace std;
+
+namespace {
+const uint32_t IMAGE_WIDTH = 320;
+const uint32_t IMAGE_HEIGHT = 240;
+const uint32_t RESIZED_WIDTH = 200;
+const uint32_t RESIZED_HEIGHT = 150;
+const size_t CHANNEL_NUM = 3;
+const size_t MAX_PROBED_DISTANCE = 11;  // distance / 4 chunks stays within the probe radius of 2
+const size_t HASH_NUM = 2000;
+const size_t QUERY_NUM = 2000;
+const size_t MAX_FLIPPED_BITS = 14;
+const uint64_t SEED = 12345;
+
+/**
+* @brief smooth RGB test pattern, a few low frequency waves
+*/
+DecodedImage MakeImage(uint32_t width, uint32_t height)
+{
+    shared_ptr<vector<uint8_t>> pixels(new vector<uint8_t>(width * height * CHANNEL_NUM));
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            double u = static_cast<double>(x) / width;
+            double v = static_cast<double>(y) / height;
+            double value = 128.0 + 60.0 * sin(7.0 * u + 2.0 * v) + 40.0 * cos(5.0 * v - 3.0 * u * v) +
+                20.0 * sin(11.0 * u * v);
+            uint8_t *p = pixels->data() + (y * width + x) * CHANNEL_NUM;
+            p[0] = static_cast<uint8_t>(value);
+            p[1] = static_cast<uint8_t>(255.0 - value);
+            p[2] = static_cast<uint8_t>(value * 0.5 + 64.0);
+        }
+    }
+    DecodedImage image;
+    image.pixels = pixels;
+    image.width = width;
+    image.height = height;
+    return image;
+}
+
+/**
+* @brief bilinear resize of an RGB image
+*/
+DecodedImage Resize(const DecodedImage &image, uint32_t width, uint32_t height)
+{
+    shared_ptr<vector<uint8_t>> pixels(new vector<uint8_t>(width * height * CHANNEL_NUM));
+    const vector<uint8_t> &src = *image.pixels;
+    for (uint32_t y = 0; y < height; ++y) {
+        double sy = max(min((y + 0.5) * image.height / height - 0.5, image.height - 1.0), 0.0);
+        uint32_t y0 = static_cast<uint32_t>(sy);
+        uint32_t y1 = min(y0 + 1, image.height - 1);
+        double fy = sy - y0;
+        for (uint32_t x = 0; x < width; ++x) {
+            double sx = max(min((x + 0.5) * image.width / width - 0.5, image.width - 1.0), 0.0);
+            uint32_t x0 = static_cast<uint32_t>(sx);
+            uint32_t x1 = min(x0 + 1, image.width - 1);
+            double fx = sx - x0;
+            for (size_t c = 0; c < CHANNEL_NUM; ++c) {
+                double top = src[(y0 * image.width + x0) * CHANNEL_NUM + c] * (1.0 - fx) +
+                    src[(y0 * image.width + x1) * CHANNEL_NUM + c] * fx;
+                double bottom = src[(y1 * image.width + x0) * CHANNEL_NUM + c] * (1.0 - fx) +
+                    src[(y1 * image.width + x1) * CHANNEL_NUM + c] * fx;
+                double value = top * (1.0 - fy) + bottom * fy;
+                (*pixels)[(y * width + x) * CHANNEL_NUM + c] = static_cast<uint8_t>(value + 0.5);
+            }
+        }
+    }
+    DecodedImage resized;
+    resized.pixels = pixels;
+    resized.width = width;
+    resized.height = height;
+    return resized;
+}
+
+uint64_t NextRandom(uint64_t &state)
+{
+    // xorshift64
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+InferResult MakeResult(size_t id)
+{
+    InferResult result;
+    result.ret = SUCCESS;
+    result.scores.push_back(static_cast<float>(id));
+    return result;
+}
+
+bool TestIdentical()
+{
+    DecodedImage image = MakeImage(IMAGE_WIDTH, IMAGE_HEIGHT);
+    DecodedImage copy = MakeImage(IMAGE_WIDTH, IMAGE_HEIGHT);
+    uint32_t distance = NearDuplicateIndex::Distance(NearDuplicateIndex::Hash(image), NearDuplicateIndex::Hash(copy));
+    if (distance != 0) {
+        ERROR_LOG("identical images are %u bits apart", distance);
+        return false;
+    }
+    return true;
+}
+
+bool TestResized()
+{
+    NearDuplicateConfig config;
+    DecodedImage image = MakeImage(IMAGE_WIDTH, IMAGE_HEIGHT);
+    DecodedImage resized = Resize(image, RESIZED_WIDTH, RESIZED_HEIGHT);
+    uint32_t distance = NearDuplicateIndex::Distance(NearDuplicateIndex::Hash(image),
+        NearDuplicateIndex::Hash(resized));
+    if (distance > config.maxDistance) {
+        ERROR_LOG("resized copy is %u bits apart, more than the default distance %zu", distance, config.maxDistance);
+        return false;
+    }
+    return true;
+}
+
+bool TestFind(size_t maxDistance)
+{
+    NearDuplicateConfig config;
+    config.entries = HASH_NUM;
+    config.maxDistance = maxDistance;
+    NearDuplicateIndex index;
+    index.SetConfig(config);
+    ModelKey model("resnet50", "1");
+    uint64_t state = SEED + maxDistance;
+    vector<uint64_t> hashes;
+    for (size_t i = 0; i < HASH_NUM; ++i) {
+        hashes.push_back(NextRandom(state));
+        index.Insert(model, hashes[i], MakeResult(i));
+    }
+    for (size_t i = 0; i < QUERY_NUM; ++i) {
+        // 在已有哈希上翻转若干位 距离覆盖阈值两侧
+        uint64_t query = hashes[NextRandom(state) % HASH_NUM];
+        size_t flips = NextRandom(state) % (MAX_FLIPPED_BITS + 1);
+        for (size_t j = 0; j < flips; ++j) {
+            query ^= 1ULL << (NextRandom(state) % 64);
+        }
+        uint32_t nearest = 64 + 1;
+        for (size_t j = 0; j < hashes.size(); ++j) {
+            nearest = min(nearest, NearDuplicateIndex::Distance(hashes[j], query));
+        }
+        InferResult result;
+        bool found = index.Find(model, query, result);
+        if (found != (nearest <= maxDistance)) {
+            ERROR_LOG("distance %zu: find returned %d, nearest hash is %u bits apart", maxDistance, found, nearest);
+            return false;
+        }
+        if (found) {
+            uint32_t distance = NearDuplicateIndex::Distance(hashes[static_cast<size_t>(result.scores[0])], query);
+            if (distance != nearest) {
+                ERROR_LOG("distance %zu: found a hash %u bits apart, nearest is %u", maxDistance, distance, nearest);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+}
+
+int main()
+{
+    bool passed = TestIdentical();
+    passed = TestResized() && passed;
+    // 探测半径不超过2时 与逐个比较的结果一致
+    for (size_t distance = 0; distance <= MAX_PROBED_DISTANCE; ++distance) {
+        passed = TestFind(distance) && passed;
+    }
+    if (!passed) {
+        ERROR_LOG("near duplicate index test failed");
+        return 1;
+    }
+    INFO_LOG("near duplicate index test passed");
+    return 0;
+}